@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A fixture or a file given on the command line, read into memory whole
+struct BenchInput
+{
+	std::string Name; // The file name, to tell the results apart
+	std::vector<uint8_t> Data;
+};
+
+struct BenchTiming
+{
+	double BestSeconds;
+	double MeanSeconds;
+	bool Failed;
+};
+
+// Runs body until it has run for the minimum time and at least three times, after one run to warm up,
+// and records the fastest and the mean run with their throughput over bytes. A body that returns false
+// is recorded as failed and not repeated.
+BenchTiming run_benchmark(const std::string& name, const std::string& input, uint64_t bytes, const std::function<bool()>& body);
+
+// Records a figure derived from the runs, e.g. a speedup or an overhead
+void report_metric(const std::string& name, const std::string& input, double value);
+
+// Runs body once for every set of CPU features, from all those detected down to SSE2 only, and tags
+// the results with it, so that every vector path is measured against its fallback
+void for_each_cpu_path(const std::function<void()>& body);
+
+// The same bytes for the same seed
+std::vector<uint8_t> make_bench_data(size_t size, uint32_t seed);
+
+// Hashes, CRC-32 and transcoding on synthetic data
+void bench_kernels();
+
+// Listing, block checksums and decoding every folder; extract_cab_native with and without the checks
+// gives the overhead of verifying the blocks
+void bench_cabinet(const BenchInput& input);
+
+// An .lzma file: the properties, the unpacked size and the raw stream
+void bench_lzma(const BenchInput& input);
+
+// A raw LZMA2 stream, whose unpacked size is summed up from its chunk headers. The summed segment time
+// against the time of the whole decode gives the parallel speedup. A name ending in .bcj.lzma2 also
+// runs the BCJ x86 filter on the output.
+void bench_lzma2(const BenchInput& input);
+
+// Every folder of a 7z archive, with the parallel speedup of its LZMA2 coders
+void bench_7z(const BenchInput& input);
@@ -0,0 +1,315 @@
+#include <windows.h>
+#include <fdi.h>
+#include <chrono>
+#include "Bcj.h"
+#include "Bench.h"
+#include "Cabinet.h"
+#include "CabinetIndex.h"
+#include "Crc32.h"
+#include "Lzma.h"
+#include "Md5.h"
+#include "SevenZip.h"
+#include "Sha256.h"
+#include "Transcode.h"
+
+namespace
+{
+	const size_t StreamSize = 4 * 1024 * 1024;
+	const size_t SmallMessages = 4096;
+	const size_t SmallMessageSize = 256;
+
+	const char* get_compression_name(uint16_t compressionType)
+	{
+		switch (compressionType & tcompMASK_TYPE)
+		{
+		case tcompTYPE_NONE: return "stored";
+		case tcompTYPE_MSZIP: return "mszip";
+		case tcompTYPE_QUANTUM: return "quantum";
+		case tcompTYPE_LZX: return "lzx";
+		default: return "unknown";
+		}
+	}
+
+	// The sum of the unpacked sizes in the chunk headers; false if the stream is cut or invalid
+	bool get_lzma2_unpacked_size(const uint8_t* in, size_t inSize, size_t& size_out)
+	{
+		size_out = 0;
+		size_t pos = 0;
+		while (pos < inSize)
+		{
+			uint8_t control = in[pos];
+			if (control == 0)
+				return true;
+			if (control == 1 || control == 2)
+			{
+				if (inSize - pos < 3)
+					return false;
+				size_t size = ((in[pos + 1] << 8) | in[pos + 2]) + 1;
+				size_out += size;
+				pos += 3 + size;
+			}
+			else if (control >= 0x80)
+			{
+				size_t headerSize = control >= 0xC0 ? 6 : 5;
+				if (inSize - pos < headerSize)
+					return false;
+				size_out += (((control & 0x1F) << 16) | (in[pos + 1] << 8) | in[pos + 2]) + 1;
+				pos += headerSize + ((in[pos + 3] << 8) | in[pos + 4]) + 1;
+			}
+			else
+				return false;
+		}
+		return false;
+	}
+
+	// ASCII names with an accented character now and then, as the File table of an installer has them
+	std::vector<wchar_t> make_names(size_t length)
+	{
+		std::vector<wchar_t> names(length);
+		for (size_t i = 0; i < length; i++)
+			names[i] = i % 97 == 96 ? static_cast<wchar_t>(0xE9) : static_cast<wchar_t>('a' + i % 26);
+		return names;
+	}
+
+	void report_lzma2_speedup(const std::string& input, const Lzma2Stats& stats, size_t calls, double meanSeconds)
+	{
+		if (!calls || meanSeconds <= 0)
+			return;
+		double segmentSeconds = std::chrono::duration<double>(stats.SegmentTime).count() / calls;
+		report_metric("lzma2_segments", input, static_cast<double>(stats.Segments) / calls);
+		report_metric("lzma2_threads", input, static_cast<double>(stats.Threads) / calls);
+		report_metric("lzma2_parallel_speedup", input, segmentSeconds / meanSeconds);
+	}
+}
+
+void bench_kernels()
+{
+	const std::string input = "synthetic";
+	auto stream = make_bench_data(StreamSize, 1);
+	auto small = make_bench_data(SmallMessages * SmallMessageSize, 2);
+	std::vector<const uint8_t*> messages;
+	std::vector<size_t> sizes(SmallMessages, SmallMessageSize);
+	for (size_t i = 0; i < SmallMessages; i++)
+		messages.push_back(small.data() + i * SmallMessageSize);
+	std::vector<Sha256Digest> sha256Digests(SmallMessages);
+	std::vector<Md5Digest> md5Digests(SmallMessages);
+
+	auto names = make_names(StreamSize / 4);
+	std::vector<char> utf8(3 * names.size());
+	utf8.resize(utf16_to_utf8(names.data(), names.size(), utf8.data()));
+	std::vector<char> narrowed(3 * names.size());
+	std::vector<wchar_t> widened(utf8.size());
+
+	for_each_cpu_path([&]()
+	{
+		run_benchmark("crc32", input, stream.size(), [&]() { return crc32(stream.data(), stream.size()) != 0; });
+		run_benchmark("sha256", input, stream.size(), [&]()
+		{
+			Sha256 hash;
+			hash.update(stream.data(), stream.size());
+			return hash.finish()[0] != 0 || true;
+		});
+		run_benchmark("sha256_many", input, small.size(), [&]()
+		{
+			sha256_many(messages.data(), sizes.data(), SmallMessages, sha256Digests.data());
+			return true;
+		});
+		run_benchmark("md5", input, stream.size(), [&]()
+		{
+			Md5 hash;
+			hash.update(stream.data(), stream.size());
+			return hash.finish()[0] != 0 || true;
+		});
+		run_benchmark("md5_many", input, small.size(), [&]()
+		{
+			md5_many(messages.data(), sizes.data(), SmallMessages, md5Digests.data());
+			return true;
+		});
+		run_benchmark("utf16_to_utf8", input, names.size() * sizeof(wchar_t), [&]()
+		{
+			return utf16_to_utf8(names.data(), names.size(), narrowed.data()) == utf8.size();
+		});
+		run_benchmark("utf8_to_utf16", input, utf8.size(), [&]()
+		{
+			return utf8_to_utf16(utf8.data(), utf8.size(), widened.data()) == names.size();
+		});
+	});
+}
+
+void bench_cabinet(const BenchInput& input)
+{
+	const uint8_t* data = input.Data.data();
+	const size_t size = input.Data.size();
+	CabinetListing listing;
+	if (!list_cab_from_memory(data, size, listing))
+	{
+		run_benchmark("cab_list", input.Name, size, []() { return false; });
+		return;
+	}
+
+	std::vector<CabinetDataBlock> blocks;
+	uint64_t packedSize = 0;
+	uint64_t unpackedSize = 0;
+	const char* compression = listing.Folders.empty() ? "stored" : get_compression_name(listing.Folders[0].CompressionType);
+	for (auto& folder : listing.Folders)
+	{
+		size_t offset = folder.DataOffset;
+		for (uint16_t i = 0; i < folder.DataBlocks; i++)
+		{
+			CabinetDataBlock block;
+			if (!read_cab_data_block(data, size, listing.DataReserve, offset, block))
+				return;
+			blocks.push_back(block);
+			packedSize += block.Size;
+			unpackedSize += block.UncompressedSize;
+		}
+		if (get_compression_name(folder.CompressionType) != compression)
+			compression = "mixed";
+	}
+
+	run_benchmark("cab_list", input.Name, size, [&]()
+	{
+		CabinetListing l;
+		return list_cab_from_memory(data, size, l);
+	});
+
+	std::vector<uint8_t> out;
+	auto decode_folders = [&]()
+	{
+		size_t block = 0;
+		for (auto& folder : listing.Folders)
+		{
+			auto decoder = create_folder_decoder(folder.CompressionType);
+			if (!decoder)
+				return false;
+			for (uint16_t i = 0; i < folder.DataBlocks; i++, block++)
+			{
+				out.resize(blocks[block].UncompressedSize);
+				if (!decoder->decode_block(blocks[block].Data, blocks[block].Size, out.data(), out.size()))
+					return false;
+			}
+		}
+		return true;
+	};
+
+	for_each_cpu_path([&]()
+	{
+		run_benchmark("cab_checksums", input.Name, packedSize, [&]()
+		{
+			BlockVerifier verifier;
+			for (auto& block : blocks)
+			{
+				if (!verifier.verify(block))
+					return false;
+			}
+			return true;
+		});
+		run_benchmark(std::string("cab_decode_") + compression, input.Name, unpackedSize, decode_folders);
+	});
+
+	// The whole extraction as the pipeline runs it without an index, with and without the checks
+	auto all = [](const std::wstring&) { return true; };
+	auto discard = [](CabinetFile&&) { return true; };
+	BenchTiming plain = run_benchmark("cab_extract", input.Name, unpackedSize, [&]() { return extract_cab_native(data, size, nullptr, all, discard); });
+	BenchTiming verified = run_benchmark("cab_extract_verified", input.Name, unpackedSize, [&]()
+	{
+		BlockVerifier verifier;
+		return extract_cab_native(data, size, &verifier, all, discard);
+	});
+	if (!plain.Failed && !verified.Failed && plain.BestSeconds > 0)
+		report_metric("verify_overhead_percent", input.Name, (verified.BestSeconds - plain.BestSeconds) / plain.BestSeconds * 100);
+}
+
+void bench_lzma(const BenchInput& input)
+{
+	const size_t HeaderSize = 13;
+	LzmaProperties properties;
+	if (input.Data.size() < HeaderSize || !parse_lzma_properties(input.Data.data(), 5, properties))
+	{
+		run_benchmark("lzma_decode", input.Name, 0, []() { return false; });
+		return;
+	}
+
+	uint64_t size = 0;
+	for (int i = 0; i < 8; i++)
+		size |= static_cast<uint64_t>(input.Data[5 + i]) << (8 * i);
+	std::vector<uint8_t> out(static_cast<size_t>(size));
+	run_benchmark("lzma_decode", input.Name, size, [&]()
+	{
+		return lzma_decode(properties, input.Data.data() + HeaderSize, input.Data.size() - HeaderSize, out.data(), out.size());
+	});
+}
+
+void bench_lzma2(const BenchInput& input)
+{
+	size_t size;
+	if (!get_lzma2_unpacked_size(input.Data.data(), input.Data.size(), size))
+	{
+		run_benchmark("lzma2_decode", input.Name, 0, []() { return false; });
+		return;
+	}
+
+	std::vector<uint8_t> out(size);
+	Lzma2Stats total = {};
+	size_t calls = 0;
+	BenchTiming timing = run_benchmark("lzma2_decode", input.Name, size, [&]()
+	{
+		Lzma2Stats stats = {};
+		bool decoded = lzma2_decode(input.Data.data(), input.Data.size(), out.data(), out.size(), &stats);
+		total.Segments += stats.Segments;
+		total.Threads += stats.Threads;
+		total.SegmentTime += stats.SegmentTime;
+		calls++;
+		return decoded;
+	});
+	if (!timing.Failed)
+		report_lzma2_speedup(input.Name, total, calls, timing.MeanSeconds);
+
+	// The filter works in place, so every run after the first undoes a filter that was never applied,
+	// which takes the same branches
+	const std::string bcjSuffix = ".bcj.lzma2";
+	if (timing.Failed || input.Name.size() < bcjSuffix.size() || input.Name.compare(input.Name.size() - bcjSuffix.size(), bcjSuffix.size(), bcjSuffix) != 0)
+		return;
+	for_each_cpu_path([&]()
+	{
+		run_benchmark("bcj_x86_decode", input.Name, out.size(), [&]()
+		{
+			bcj_x86_decode(out.data(), out.size(), 0);
+			return true;
+		});
+	});
+}
+
+void bench_7z(const BenchInput& input)
+{
+	SevenZipArchive archive;
+	if (!open_7z(input.Data.data(), input.Data.size(), archive))
+	{
+		run_benchmark("7z_decode", input.Name, 0, []() { return false; });
+		return;
+	}
+
+	uint64_t size = 0;
+	for (auto& folder : archive.Folders)
+		size += get_7z_folder_size(folder);
+
+	std::vector<uint8_t> out;
+	Lzma2Stats total = {};
+	size_t calls = 0;
+	BenchTiming timing = run_benchmark("7z_decode", input.Name, size, [&]()
+	{
+		Lzma2Stats stats = {};
+		for (uint32_t i = 0; i < archive.Folders.size(); i++)
+		{
+			if (!decode_7z_folder(archive, i, out, &stats))
+				return false;
+		}
+		total.Segments += stats.Segments;
+		total.Threads += stats.Threads;
+		total.SegmentTime += stats.SegmentTime;
+		calls++;
+		return true;
+	});
+	if (!timing.Failed && total.Segments)
+		report_lzma2_speedup(input.Name, total, calls, timing.MeanSeconds);
+}
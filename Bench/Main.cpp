@@ -0,0 +1,241 @@
+// Benchmarks the decoders, hashes and checksums of libsilext and writes the results as JSON.
+//
+// Usage: Bench [--out=<file>] [--fixtures=<dir>] [--time=<seconds>] [<input>...]
+// Runs on the fixtures of the Tests project, which the build copies next to Bench.exe, and on every
+// input given (.cab, .lzma, .lzma2 or .7z, e.g. the payload of a real installer). The JSON goes to
+// stdout unless --out is given; a summary line per run goes to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include "Bench.h"
+#include "Cpu.h"
+
+namespace
+{
+	struct BenchResult
+	{
+		std::string Name;
+		std::string Input;
+		std::string CpuPath;
+		uint64_t Bytes;
+		size_t Runs;
+		double BestSeconds;
+		double MeanSeconds;
+		bool Failed;
+	};
+
+	struct Metric
+	{
+		std::string Name;
+		std::string Input;
+		double Value;
+	};
+
+	struct CpuPath
+	{
+		const char* Name;
+		CpuFeatures Features;
+	};
+
+	const CpuPath CpuPaths[] = {
+		{ "native", { true, true, true, true } },
+		{ "no SHA-NI", { true, true, true, false } },
+		{ "no AVX2", { true, true, false, false } },
+		{ "SSE2", { false, false, false, false } },
+	};
+
+	const size_t MinRuns = 3;
+
+	double minTime = 0.2;
+	const char* currentPath = "native";
+	std::vector<BenchResult> results;
+	std::vector<Metric> metrics;
+
+	std::string escape_json(const std::string& s)
+	{
+		std::string escaped;
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			if (static_cast<unsigned char>(c) >= 0x20)
+				escaped += c;
+		}
+		return escaped;
+	}
+
+	void write_json(std::ostream& out)
+	{
+		auto flag = [](bool value) { return value ? "true" : "false"; };
+		auto& cpu = get_cpu_features();
+		out << std::fixed << "{\n  \"cpu\": { \"sse41\": " << flag(cpu.Sse41) << ", \"pclmul\": " << flag(cpu.Pclmul) << ", \"avx2\": " << flag(cpu.Avx2)
+			<< ", \"sha\": " << flag(cpu.Sha) << " },\n  \"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			auto& r = results[i];
+			out << "    { \"name\": \"" << escape_json(r.Name) << "\", \"input\": \"" << escape_json(r.Input) << "\", \"cpu_path\": \"" << r.CpuPath
+				<< "\", \"bytes\": " << r.Bytes << ", \"runs\": " << r.Runs << std::setprecision(0) << ", \"best_ns\": " << r.BestSeconds * 1e9
+				<< ", \"mean_ns\": " << r.MeanSeconds * 1e9 << std::setprecision(1) << ", \"mb_per_s\": " << (r.BestSeconds > 0 ? r.Bytes / r.BestSeconds / 1e6 : 0.0)
+				<< ", \"failed\": " << flag(r.Failed) << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ],\n  \"metrics\": [\n" << std::setprecision(3);
+		for (size_t i = 0; i < metrics.size(); i++)
+		{
+			auto& m = metrics[i];
+			out << "    { \"name\": \"" << escape_json(m.Name) << "\", \"input\": \"" << escape_json(m.Input) << "\", \"value\": " << m.Value << " }"
+				<< (i + 1 < metrics.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+	}
+
+	bool load_input(const std::filesystem::path& path, BenchInput& input_out)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+		input_out.Name = path.filename().string();
+		input_out.Data.assign(std::istreambuf_iterator<char>(file), {});
+		return true;
+	}
+
+	bool has_suffix(const std::string& s, const std::string& suffix)
+	{
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	void bench_input(const BenchInput& input)
+	{
+		if (has_suffix(input.Name, ".cab"))
+			bench_cabinet(input);
+		else if (has_suffix(input.Name, ".lzma"))
+			bench_lzma(input);
+		else if (has_suffix(input.Name, ".lzma2"))
+			bench_lzma2(input);
+		else if (has_suffix(input.Name, ".7z"))
+			bench_7z(input);
+		else
+			fprintf(stderr, "Skipping %s: not a .cab, .lzma, .lzma2 or .7z\n", input.Name.c_str());
+	}
+}
+
+BenchTiming run_benchmark(const std::string& name, const std::string& input, uint64_t bytes, const std::function<bool()>& body)
+{
+	BenchResult result = { name, input, currentPath, bytes, 0, 0, 0, !body() };
+	double total = 0;
+	while (!result.Failed && (total < minTime || result.Runs < MinRuns))
+	{
+		auto start = std::chrono::steady_clock::now();
+		result.Failed = !body();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.BestSeconds = result.Runs ? std::min(result.BestSeconds, seconds) : seconds;
+		total += seconds;
+		result.Runs++;
+	}
+	result.MeanSeconds = result.Runs ? total / result.Runs : 0;
+
+	if (result.Failed)
+		fprintf(stderr, "%-24s %-24s %-10s FAILED\n", name.c_str(), input.c_str(), currentPath);
+	else
+		fprintf(stderr, "%-24s %-24s %-10s %10.3f ms %10.1f MB/s\n", name.c_str(), input.c_str(), currentPath, result.BestSeconds * 1e3,
+			result.BestSeconds > 0 ? bytes / result.BestSeconds / 1e6 : 0.0);
+	results.push_back(result);
+	return { result.BestSeconds, result.MeanSeconds, result.Failed };
+}
+
+void report_metric(const std::string& name, const std::string& input, double value)
+{
+	fprintf(stderr, "%-24s %-24s %10.3f\n", name.c_str(), input.c_str(), value);
+	metrics.push_back({ name, input, value });
+}
+
+void for_each_cpu_path(const std::function<void()>& body)
+{
+	for (auto& path : CpuPaths)
+	{
+		restrict_cpu_features(path.Features);
+		currentPath = path.Name;
+		body();
+	}
+	restrict_cpu_features(CpuPaths[0].Features);
+	currentPath = CpuPaths[0].Name;
+}
+
+// xorshift32, as the tests use
+std::vector<uint8_t> make_bench_data(size_t size, uint32_t seed)
+{
+	std::vector<uint8_t> data(size);
+	uint32_t state = seed | 1;
+	for (auto& byte : data)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		byte = static_cast<uint8_t>(state >> 24);
+	}
+	return data;
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path fixturesDir = std::filesystem::path(argv[0]).parent_path() / "fixtures";
+	std::string outPath;
+	std::vector<std::filesystem::path> inputs;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.rfind("--out=", 0) == 0)
+			outPath = arg.substr(6);
+		else if (arg.rfind("--fixtures=", 0) == 0)
+			fixturesDir = arg.substr(11);
+		else if (arg.rfind("--time=", 0) == 0)
+			minTime = std::stod(arg.substr(7));
+		else
+			inputs.push_back(arg);
+	}
+
+	bench_kernels();
+
+	std::error_code error;
+	std::vector<std::filesystem::path> fixtures;
+	for (auto& entry : std::filesystem::directory_iterator(fixturesDir, error))
+		fixtures.push_back(entry.path());
+	if (error)
+		fprintf(stderr, "No fixtures in %s\n", fixturesDir.string().c_str());
+	std::sort(fixtures.begin(), fixtures.end());
+	fixtures.insert(fixtures.end(), inputs.begin(), inputs.end());
+
+	int failed = 0;
+	for (auto& path : fixtures)
+	{
+		BenchInput input;
+		if (!load_input(path, input))
+		{
+			fprintf(stderr, "Cannot read %s\n", path.string().c_str());
+			failed++;
+			continue;
+		}
+		bench_input(input);
+	}
+
+	if (outPath.empty())
+		write_json(std::cout);
+	else
+	{
+		std::ofstream out(outPath);
+		write_json(out);
+		if (!out)
+		{
+			fprintf(stderr, "Cannot write %s\n", outPath.c_str());
+			return 1;
+		}
+	}
+
+	failed += static_cast<int>(std::count_if(results.begin(), results.end(), [](const BenchResult& r) { return r.Failed; }));
+	return failed;
+}
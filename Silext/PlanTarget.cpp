@@ -0,0 +1,85 @@
+#include "PlanTarget.h"
+
+#include <filesystem>
+#include <map>
+#include "Util.h"
+
+namespace fs = std::filesystem;
+
+PlanTarget::~PlanTarget()
+{
+	close();
+}
+
+bool PlanTarget::create(const ExtractionPlan& plan)
+{
+	std::map<std::wstring, size_t> lastFiles;
+	for (size_t i = 0; i < plan.Files.size(); i++)
+		lastFiles[plan.Files[i].Path] = i;
+
+	files.clear();
+	for (size_t i = 0; i < plan.Files.size(); i++)
+	{
+		auto& planFile = plan.Files[i];
+		files.push_back({ concat_path(targetPath, planFile.Path), planFile.LastWriteTime, planFile.Attributes, INVALID_HANDLE_VALUE });
+		if (lastFiles[planFile.Path] != i)
+			continue;
+
+		File& file = files.back();
+		std::error_code errorCode;
+		fs::create_directories(fs::path(file.Path).parent_path(), errorCode);
+		if (errorCode)
+			return false;
+
+		file.Handle = CreateFile(file.Path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file.Handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		size.QuadPart = planFile.Size;
+		if (!SetFilePointerEx(file.Handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(file.Handle))
+			return false;
+	}
+	return true;
+}
+
+bool PlanTarget::write(size_t file, uint64_t offset, const uint8_t* data, size_t size)
+{
+	HANDLE handle = files[file].Handle;
+	if (handle == INVALID_HANDLE_VALUE)
+		return true;
+
+	// The offset in the OVERLAPPED makes the write positional, also on a synchronous handle
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD written = 0;
+	return WriteFile(handle, data, static_cast<DWORD>(size), &written, &overlapped) && written == size;
+}
+
+bool PlanTarget::finish()
+{
+	for (auto& file : files)
+	{
+		if (file.Handle != INVALID_HANDLE_VALUE && (file.LastWriteTime.dwLowDateTime || file.LastWriteTime.dwHighDateTime))
+			SetFileTime(file.Handle, NULL, NULL, &file.LastWriteTime);
+	}
+	close();
+
+	for (auto& file : files)
+	{
+		if (file.Attributes)
+			SetFileAttributes(file.Path.c_str(), file.Attributes);
+	}
+	return true;
+}
+
+void PlanTarget::close()
+{
+	for (auto& file : files)
+	{
+		if (file.Handle != INVALID_HANDLE_VALUE)
+			CloseHandle(file.Handle);
+		file.Handle = INVALID_HANDLE_VALUE;
+	}
+}
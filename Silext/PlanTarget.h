@@ -0,0 +1,42 @@
+#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Silext.h"
+
+// Writes the files of an extraction plan below the target path. Every file is created at its final
+// size up front, so that the decoded ranges can be written at their offsets, from any thread and in
+// any order. A path that is planned twice is written by its last file, as the extraction would.
+class PlanTarget
+{
+public:
+	explicit PlanTarget(const std::wstring& targetPath) : targetPath(targetPath) {}
+	PlanTarget(const PlanTarget&) = delete;
+	PlanTarget& operator=(const PlanTarget&) = delete;
+	~PlanTarget();
+
+	bool create(const ExtractionPlan& plan);
+
+	// A PlanWriter
+	bool write(size_t file, uint64_t offset, const uint8_t* data, size_t size);
+
+	// Sets the times and attributes of the files and closes them
+	bool finish();
+
+private:
+	struct File
+	{
+		std::wstring Path;
+		FILETIME LastWriteTime;
+		DWORD Attributes;
+		HANDLE Handle;
+	};
+
+	void close();
+
+	const std::wstring targetPath;
+	std::vector<File> files;
+};
@@ -0,0 +1,290 @@
+#include "ProjectedMount.h"
+
+#include <windows.h>
+#include <objbase.h>
+#include <projectedfslib.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#pragma comment(lib, "ProjectedFSLib.lib")
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	const DWORD CancellationPollMilliseconds = 100;
+
+	// Names are compared the way ProjFS and the file system do, case-insensitively
+	struct FileNameLess
+	{
+		bool operator()(const std::wstring& a, const std::wstring& b) const
+		{
+			return PrjFileNameCompare(a.c_str(), b.c_str()) < 0;
+		}
+	};
+
+	struct GuidLess
+	{
+		bool operator()(const GUID& a, const GUID& b) const
+		{
+			return memcmp(&a, &b, sizeof(GUID)) < 0;
+		}
+	};
+
+	// A file or directory of the projected tree; File is null for directories
+	struct Entry
+	{
+		std::wstring Name;
+		const ListedFile* File;
+	};
+
+	// A directory enumeration in progress, which ProjFS may continue over several callbacks
+	struct Enumeration
+	{
+		std::wstring Path;
+		std::wstring SearchExpression;
+		size_t Next = 0;
+	};
+
+	PRJ_FILE_BASIC_INFO get_basic_info(const ListedFile* file)
+	{
+		PRJ_FILE_BASIC_INFO info = {};
+		info.IsDirectory = !file;
+		info.FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+		if (file)
+		{
+			info.FileSize = file->Size;
+			info.LastWriteTime.QuadPart = (static_cast<LONGLONG>(file->LastWriteTime.dwHighDateTime) << 32) | file->LastWriteTime.dwLowDateTime;
+			info.CreationTime = info.ChangeTime = info.LastWriteTime;
+			info.FileAttributes = file->Attributes ? file->Attributes : FILE_ATTRIBUTE_NORMAL;
+		}
+		return info;
+	}
+
+	// The tree of the payload, laid out from the listed files; directories only exist as their parents
+	class Projection
+	{
+	public:
+		explicit Projection(SetupPayload& payload)
+			: payload(payload)
+		{
+			directories[L""];
+			for (auto& file : payload.get_files())
+			{
+				if (!entries.insert({ file.Path, &file }).second)
+					continue;
+
+				// Adds the entry to its parent, and the parent to its own parent if it is new
+				std::wstring path = file.Path;
+				const ListedFile* entryFile = &file;
+				while (true)
+				{
+					size_t separator = path.rfind(L'\\');
+					std::wstring parent = separator == std::wstring::npos ? L"" : path.substr(0, separator);
+					directories[parent].push_back({ path.substr(separator + 1), entryFile });
+					if (parent.empty() || !entries.insert({ parent, nullptr }).second)
+						break;
+					path = parent;
+					entryFile = nullptr;
+				}
+			}
+
+			for (auto& directory : directories)
+			{
+				std::sort(directory.second.begin(), directory.second.end(), [](const Entry& a, const Entry& b)
+				{
+					return PrjFileNameCompare(a.Name.c_str(), b.Name.c_str()) < 0;
+				});
+			}
+		}
+
+		HRESULT start_enumeration(const std::wstring& path, const GUID& enumerationId)
+		{
+			auto directory = directories.find(path);
+			if (directory == directories.end())
+				return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			enumerations[enumerationId] = { directory->first };
+			return S_OK;
+		}
+
+		HRESULT end_enumeration(const GUID& enumerationId)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			enumerations.erase(enumerationId);
+			return S_OK;
+		}
+
+		// Fills the buffer with the entries after the previous call, as far as they fit
+		HRESULT fill_enumeration(const GUID& enumerationId, bool restart, PCWSTR searchExpression, PRJ_DIR_ENTRY_BUFFER_HANDLE buffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto enumerationIt = enumerations.find(enumerationId);
+			if (enumerationIt == enumerations.end())
+				return E_INVALIDARG;
+
+			Enumeration& enumeration = enumerationIt->second;
+			if (restart)
+				enumeration.Next = 0;
+			if (enumeration.Next == 0)
+				enumeration.SearchExpression = searchExpression ? searchExpression : L"*";
+
+			auto& directory = directories.find(enumeration.Path)->second;
+			size_t filled = 0;
+			for (; enumeration.Next < directory.size(); enumeration.Next++)
+			{
+				auto& entry = directory[enumeration.Next];
+				if (!PrjFileNameMatch(entry.Name.c_str(), enumeration.SearchExpression.c_str()))
+					continue;
+
+				PRJ_FILE_BASIC_INFO info = get_basic_info(entry.File);
+				if (FAILED(PrjFillDirEntryBuffer(entry.Name.c_str(), &info, buffer)))
+					return filled ? S_OK : HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+				filled++;
+			}
+			return S_OK;
+		}
+
+		HRESULT write_placeholder(PRJ_NAMESPACE_VIRTUALIZATION_CONTEXT context, const std::wstring& path)
+		{
+			auto entry = entries.find(path);
+			if (entry == entries.end())
+				return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+			PRJ_PLACEHOLDER_INFO info = {};
+			info.FileBasicInfo = get_basic_info(entry->second);
+			return PrjWritePlaceholderInfo(context, entry->first.c_str(), &info, sizeof(info));
+		}
+
+		// Decodes the requested range in chunks of at most MaxSinkChunk, which keeps them sector aligned
+		HRESULT write_file_data(PRJ_NAMESPACE_VIRTUALIZATION_CONTEXT context, const std::wstring& path, const GUID& dataStreamId, UINT64 offset, UINT32 length)
+		{
+			auto entry = entries.find(path);
+			if (entry == entries.end() || !entry->second)
+				return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+			size_t chunkSize = std::min<size_t>(length, MaxSinkChunk);
+			void* buffer = PrjAllocateAlignedBuffer(context, chunkSize);
+			if (!buffer)
+				return E_OUTOFMEMORY;
+
+			HRESULT result = S_OK;
+			for (UINT64 end = offset + length; offset < end && SUCCEEDED(result); offset += chunkSize)
+			{
+				UINT32 count = static_cast<UINT32>(std::min<UINT64>(chunkSize, end - offset));
+				result = payload.read_file(*entry->second, offset, static_cast<uint8_t*>(buffer), count)
+					? PrjWriteFileData(context, &dataStreamId, buffer, offset, count)
+					: HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+			}
+			PrjFreeAlignedBuffer(buffer);
+			return result;
+		}
+
+	private:
+		SetupPayload& payload;
+		std::map<std::wstring, std::vector<Entry>, FileNameLess> directories; // By relative path, the root is ""
+		std::map<std::wstring, const ListedFile*, FileNameLess> entries; // Null for directories
+		std::mutex mutex;
+		std::map<GUID, Enumeration, GuidLess> enumerations;
+	};
+
+	Projection& get_projection(const PRJ_CALLBACK_DATA* callbackData)
+	{
+		return *static_cast<Projection*>(callbackData->InstanceContext);
+	}
+
+	HRESULT CALLBACK start_enumeration(const PRJ_CALLBACK_DATA* callbackData, const GUID* enumerationId)
+	{
+		return get_projection(callbackData).start_enumeration(callbackData->FilePathName, *enumerationId);
+	}
+
+	HRESULT CALLBACK end_enumeration(const PRJ_CALLBACK_DATA* callbackData, const GUID* enumerationId)
+	{
+		return get_projection(callbackData).end_enumeration(*enumerationId);
+	}
+
+	HRESULT CALLBACK get_enumeration(const PRJ_CALLBACK_DATA* callbackData, const GUID* enumerationId, PCWSTR searchExpression, PRJ_DIR_ENTRY_BUFFER_HANDLE buffer)
+	{
+		bool restart = (callbackData->Flags & PRJ_CB_DATA_FLAG_ENUM_RESTART_SCAN) != 0;
+		return get_projection(callbackData).fill_enumeration(*enumerationId, restart, searchExpression, buffer);
+	}
+
+	HRESULT CALLBACK get_placeholder_info(const PRJ_CALLBACK_DATA* callbackData)
+	{
+		return get_projection(callbackData).write_placeholder(callbackData->NamespaceVirtualizationContext, callbackData->FilePathName);
+	}
+
+	HRESULT CALLBACK get_file_data(const PRJ_CALLBACK_DATA* callbackData, UINT64 byteOffset, UINT32 length)
+	{
+		return get_projection(callbackData).write_file_data(callbackData->NamespaceVirtualizationContext, callbackData->FilePathName, callbackData->DataStreamId, byteOffset, length);
+	}
+
+	// Denying the pre-operation notifications keeps the projected files as they are in the payload
+	HRESULT CALLBACK notify(const PRJ_CALLBACK_DATA* callbackData, BOOLEAN isDirectory, PRJ_NOTIFICATION notification, PCWSTR destinationFileName, PRJ_NOTIFICATION_PARAMETERS* operationParameters)
+	{
+		switch (notification)
+		{
+		case PRJ_NOTIFICATION_PRE_DELETE:
+		case PRJ_NOTIFICATION_PRE_RENAME:
+		case PRJ_NOTIFICATION_PRE_SET_HARDLINK:
+		case PRJ_NOTIFICATION_FILE_PRE_CONVERT_TO_FULL:
+			return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+		default:
+			return S_OK;
+		}
+	}
+
+	// ProjectedFSLib.dll is delay-loaded, as it only exists with the feature enabled; the first call
+	// into it would otherwise raise an exception instead of failing
+	bool is_projfs_available()
+	{
+		return LoadLibraryEx(L"ProjectedFSLib.dll", NULL, LOAD_LIBRARY_SEARCH_SYSTEM32) != NULL;
+	}
+}
+
+bool mount_payload(SetupPayload& payload, const std::wstring& root, const CancellationToken& cancellation)
+{
+	if (!is_projfs_available())
+		return false;
+
+	std::error_code errorCode;
+	fs::create_directories(root, errorCode);
+	if (errorCode || !fs::is_empty(root, errorCode))
+		return false;
+
+	GUID instanceId;
+	if (FAILED(CoCreateGuid(&instanceId)) || FAILED(PrjMarkDirectoryAsPlaceholder(root.c_str(), NULL, NULL, &instanceId)))
+		return false;
+
+	Projection projection(payload);
+	PRJ_CALLBACKS callbacks = {};
+	callbacks.StartDirectoryEnumerationCallback = start_enumeration;
+	callbacks.EndDirectoryEnumerationCallback = end_enumeration;
+	callbacks.GetDirectoryEnumerationCallback = get_enumeration;
+	callbacks.GetPlaceholderInfoCallback = get_placeholder_info;
+	callbacks.GetFileDataCallback = get_file_data;
+	callbacks.NotificationCallback = notify;
+
+	PRJ_NOTIFICATION_MAPPING notificationMapping = {
+		PRJ_NOTIFY_PRE_DELETE | PRJ_NOTIFY_PRE_RENAME | PRJ_NOTIFY_PRE_SET_HARDLINK | PRJ_NOTIFY_FILE_PRE_CONVERT_TO_FULL,
+		L""
+	};
+	PRJ_STARTVIRTUALIZING_OPTIONS options = {};
+	options.NotificationMappings = &notificationMapping;
+	options.NotificationMappingsCount = 1;
+
+	PRJ_NAMESPACE_VIRTUALIZATION_CONTEXT context;
+	if (FAILED(PrjStartVirtualizing(root.c_str(), &callbacks, &projection, &options, &context)))
+		return false;
+
+	while (!cancellation.is_cancelled())
+		Sleep(CancellationPollMilliseconds);
+
+	PrjStopVirtualizing(context);
+	return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include "Silext.h"
+
+// Serves the payload as a read-only directory tree below root with the Windows Projected File System
+// (ProjFS, the optional "Client-ProjFS" feature). Only the metadata is projected up front; a file is
+// decoded when it is first read, after which ProjFS keeps it in root as a hydrated placeholder. Changes
+// to the projected files are denied. Runs until cancelled; root must be a new or empty directory.
+bool mount_payload(SetupPayload& payload, const std::wstring& root, const CancellationToken& cancellation);
@@ -1,8 +1,47 @@
 /* Silext - A Silverlight installer extractor - Copyright (c) 2020 Rxcle 
 *
 * Usage: Silext <Silverlight_x64.exe> <target_path> [<options>]
+*        Silext list <Silverlight_x64.exe> [<options>]
+*        Silext mount <Silverlight_x64.exe> <mount_path> [<options>]
+*        Silext plan <Silverlight_x64.exe> <plan_file> [<options>]
+*        Silext apply <plan_file> <target_path> [<options>]
+*        Silext compare <Silverlight_x64.exe|corpus_dir> <target_path> [<options>]
+*
+*          <target_path> "-" writes the tree as a tar archive to stdout instead
+*          "list" prints the size, cabinet folder and path of every file without extracting any
+*          "mount" projects the tree read-only into a new or empty <mount_path> with ProjFS until
+*                  Ctrl+C, decoding every file when it is first read; the index is kept as with "i"
+*          "plan" writes an extraction plan: the containers leading to the payload cabinet, the codec and
+*                 segments of its folders and the range of every file in them; the index is kept as with "i"
+*          "apply" extracts the files of a plan, decoding all segments at the same time, without running
+*                  the MSI stages or parsing any container the plan does not lead through
+*          "compare" extracts the EXE, or every EXE in corpus_dir, with the reference and with the native backends
+*                    to <target_path>\<exe>\reference and \native, writes the manifest of each run next to its tree
+*                    (hashed with SHA-256) and compares them; differences and per-stage speedups go to stderr
 * 
 * Options: "s" Only extract 64-bit program files (otherwise extract everything)
+*          "t" Write per-stage timings as JSON to stderr
+*          "r" Use the reference backends (7z.dll) for all stages instead of the native decoders
+*          "i" When only some files are extracted ("s", --include, --exclude), decode just those from
+*              a random-access index of the payload cabinet, kept next to the installer as <exe>.silidx
+*          --manifest=<file> Write a manifest of the metadata, extracted tree and timings
+*          --golden=<file>   Compare the result against a previously written manifest
+*          --include=<pattern> Only extract the files whose relative path matches (repeatable)
+*          --exclude=<pattern> Do not extract the files whose relative path matches (repeatable)
+*                              A pattern is a glob (* and ? within a directory, ** across them),
+*                              or a regular expression when prefixed with "re:"
+*          --index=<file>    Keep the random-access index in file instead (e.g. in a cache); implies "i"
+*          --cache=<dir>     Cache the installer metadata in dir, keyed by a hash of the installer, so that
+*                            later runs for the same installer skip the MSI stages
+*          --hashes=<file>   Hash every extracted file with SHA-256 while it is written, and write the digests
+*                            to file; a manifest then takes them (as sha256:) instead of reading the tree back
+*                            (as fnv1a:), and a golden written the other way is reported as such
+*          --verify-hashes   Hash every extracted file with MD5 while it is written, and compare it against the
+*                            MsiFileHash table of the MSI (which covers unversioned files); mismatches are
+*                            written to stderr
+*          --no-verify       Do not check the CFDATA checksums of the cabinet blocks the native decoders decode,
+*                            for installers that are trusted (the check is reported as verify_cab by "t"); it
+*                            is independent of --verify-hashes, which checks the extracted files instead
 * 
 * Returns:  0 Success
 *          >0 Success with warning (e.g. no cleanup)
@@ -10,536 +49,644 @@
 */
 
 #include <iostream>
+#include <iomanip>
 #include <sstream>
-#include <tchar.h>
-#include <crtdbg.h>
 #include <windows.h>
-#include <objbase.h>
-#include <msiquery.h>
-#include <setupapi.h>
 #include <fstream>
 #include <vector>
-#include <functional>
-#include <shlwapi.h>
 #include <algorithm>
+#include <array>
 #include <map>
-#include <bitextractor.hpp>
 #include <filesystem>
-
-#pragma comment(lib, "msi.lib")
-#pragma comment(lib, "setupapi.lib")
-#pragma comment(lib, "Shlwapi.lib")
+#include <chrono>
+#include "HashingSink.h"
+#include "PlanTarget.h"
+#include "ProjectedMount.h"
+#include "Silext.h"
+#include "TarSink.h"
+#include "Util.h"
 
 namespace fs = std::filesystem;
 
-/*
-STEPS:
-1: Extract EXE using Z-7ip
-	RESULT:
-	- Silverlight.7z
-	- silverlight.msi
-2: Extract Silverlight.7z using 7-Zip
-	RESULT:
-	- Silverlight.msp
-3: Extract streams from Silverlight.msp
-	RESULT:
-	- #oldTocurrent.mst
-	- oldTocurrent.mst
-	- PCW_CAB_Silver.cab
-4: Apply "oldTocurrent.mst" transform to silverlight.msi from step 1 (in memory)
-5: Read File and Directory tables
-6: Create directory structure using Directory table info
-7: Reconstruct directory structure and file names
-8: Extract PCW_CAB_Silver.cab using CAB to names obtained from 6 and 7
-	RESULT: Uncompressed files in structure
-DONE
-*/
+const size_t MountCacheBytes = 64 * 1024 * 1024;
 
-const CLSID CLSID_MsiTransform = { 0xC1082, 0x0, 0x0, {0xC0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x46} };
-
-struct DirInfo
+std::wstring format_timings_json(const StageTimings& timings)
 {
-	std::wstring ParentKey;
-	std::wstring Name;
-};
+	std::wstringstream ss;
+	ss << L"{\"stages\":[";
+	for (size_t i = 0; i < timings.size(); i++)
+	{
+		auto& timing = timings[i];
+		auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(timing.Elapsed).count();
+		ss << (i ? L"," : L"")
+			<< L"{\"name\":\"" << timing.Name
+			<< L"\",\"count\":" << timing.Count
+			<< L",\"us\":" << microseconds << L"}";
+	}
+	ss << L"]}";
+	return ss.str();
+}
 
-struct FileInfo
+// Writes the extracted files below the target path, creating their directories on the way
+class DirectorySink : public FileSink
 {
-	std::wstring FileName;
-	std::wstring DirectoryKey;
-};
+public:
+	explicit DirectorySink(const std::wstring& targetPath) : targetPath(targetPath) {}
 
-struct DbInfo
-{
-	std::map<std::wstring, DirInfo> Directories;
-	std::map<std::wstring, FileInfo> Files;
-};
-
-bool make_path(LPTSTR pszDest, size_t cchDest, const std::wstring& pszDir, const std::wstring& pszName, const std::wstring& pszExt)
-{
-	// Make sure pszDest is NULL-terminated.
-	pszDest[0] = TEXT('\0');
+	~DirectorySink()
+	{
+		if (hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(hFile);
+	}
 
-	size_t len = pszDir.length();
-	if (len)
+	bool begin_file(const SinkFile& file) override
 	{
-		if (0 != _tcsncpy_s(pszDest, cchDest, pszDir.c_str(), pszDir.length()))
-		{
+		path = concat_path(targetPath, file.Path);
+		lastWriteTime = file.LastWriteTime;
+		attributes = file.Attributes;
+
+		std::error_code errorCode;
+		fs::create_directories(fs::path(path).parent_path(), errorCode);
+		if (errorCode)
 			return false;
-		}
 
-		if (len && TEXT('\\') != pszDest[len - 1])
-		{
-			// Make sure the path ends with a "\".
-			if (0 != _tcsncat_s(pszDest, cchDest, TEXT("\\"), _TRUNCATE))
-			{
-				return false;
-			}
-		}
+		hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		return hFile != INVALID_HANDLE_VALUE;
 	}
 
-	// Append the file name.
-	if (0 != _tcsncat_s(pszDest, cchDest, pszName.c_str(), _TRUNCATE))
+	bool write_chunk(const uint8_t* data, size_t size) override
 	{
-		return false;
+		DWORD written = 0;
+		return WriteFile(hFile, data, static_cast<DWORD>(size), &written, NULL) && written == size;
 	}
 
-	// Append the extension.
-	if (!pszExt.empty())
+	bool end_file() override
 	{
-		if (0 != _tcsncat_s(pszDest, cchDest, pszExt.c_str(), _TRUNCATE))
-		{
-			return false;
-		}
+		if (lastWriteTime.dwLowDateTime || lastWriteTime.dwHighDateTime)
+			SetFileTime(hFile, NULL, NULL, &lastWriteTime);
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+
+		if (attributes)
+			SetFileAttributes(path.c_str(), attributes);
+		return true;
 	}
 
-	return true;
-}
+private:
+	const std::wstring targetPath;
+	std::wstring path;
+	FILETIME lastWriteTime = {};
+	DWORD attributes = 0;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+};
 
-std::wstring get_record_string(MSIHANDLE hRecord, unsigned int iField)
+bool cleanup_workdir(const std::wstring& workdir)
 {
-	unsigned long cchProperty = 0;
-	wchar_t szValueBuf[MAX_PATH] = L"";
-
-	if (MsiRecordGetString(hRecord, iField, szValueBuf, &cchProperty) == ERROR_MORE_DATA)
+	auto tempFiles = find_files(workdir, L"*");
+	std::error_code errorCode;
+	for (auto& tempFile : tempFiles)
 	{
-		cchProperty++;
-		if (cchProperty > MAX_PATH) cchProperty = MAX_PATH;
-		MsiRecordGetString(hRecord, iField, szValueBuf, &cchProperty);
+		fs::permissions(tempFile,
+			fs::perms::owner_write,
+			fs::perm_options::add, errorCode);
+		fs::remove(tempFile, errorCode);
 	}
-
-	return std::wstring(szValueBuf, cchProperty);
-}
-
-void execute_view(PMSIHANDLE& hDatabase, std::wstring query, std::function<void(PMSIHANDLE& hRecord)> recordFunc)
-{
-	PMSIHANDLE hView, hRecord;
-	if (MsiDatabaseOpenView(hDatabase, query.c_str(), &hView) == ERROR_SUCCESS)
-		if (MsiViewExecute(hView, NULL) == ERROR_SUCCESS)
-			while (MsiViewFetch(hView, &hRecord) == ERROR_SUCCESS)
-				recordFunc(hRecord);
+	if (!errorCode)
+		fs::remove(workdir, errorCode);
+	return !errorCode;
 }
 
-void get_directories(PMSIHANDLE& hDatabase, std::map<std::wstring, DirInfo>& directories)
+uint64_t hash_file(const std::wstring& path)
 {
-	execute_view(hDatabase,
-		L"SELECT Directory, Directory_Parent, DefaultDir FROM Directory",
-		[&directories](PMSIHANDLE& hRecord)
+	// Only used to compare extracted trees between runs
+	uint64_t hash = FnvOffsetBasis;
+	std::ifstream file(path, std::ios_base::binary);
+	char buffer[65536];
+	while (file)
 	{
-		directories[get_record_string(hRecord, 1)] = {
-			get_record_string(hRecord, 2),
-			get_record_string(hRecord, 3)
-		};
-	});
+		file.read(buffer, sizeof(buffer));
+		hash = fnv1a(reinterpret_cast<const uint8_t*>(buffer), static_cast<size_t>(file.gcount()), hash);
+	}
+	return hash;
 }
 
-void get_files(PMSIHANDLE& hDatabase, std::map<std::wstring, FileInfo>& files)
+template <size_t Size>
+std::wstring format_digest(const std::array<uint8_t, Size>& digest)
 {
-	execute_view(hDatabase,
-		L"SELECT File, FileName, Directory_ FROM File, Component WHERE File.Component_ = Component.Component",
-		[&files](PMSIHANDLE& hRecord)
-	{
-		files[get_record_string(hRecord, 1)] = {
-			get_record_string(hRecord, 2),
-			get_record_string(hRecord, 3)
-		};
-	});
+	std::wstringstream ss;
+	ss << std::hex << std::setfill(L'0');
+	for (auto byte : digest)
+		ss << std::setw(2) << static_cast<unsigned int>(byte);
+	return ss.str();
 }
 
-unsigned int save_stream(MSIHANDLE hRecord, const std::wstring& directory)
+/*
+Manifest format (UTF-8, one entry per line, tab separated):
+	D <key> <parent key> <default dir>      Directory table row
+	F <key> <file name> <directory key>     File table row
+	T <relative path> <size> <alg>:<hash>   Extracted file, "fnv1a:" of the file read back from disk, or
+	                                        "sha256:" hashed while it was written (--hashes)
+	S <stage> <microseconds>                Stage timing (not compared)
+*/
+std::vector<std::wstring> build_manifest(const DbInfo& dbInfo, const std::wstring& targetPath, const std::vector<FileDigest>* digests, const StageTimings& timings)
 {
-	unsigned int uiError = NOERROR;
-	wchar_t szPath[MAX_PATH];
-	char szBuffer[256];
-	unsigned long cbBuffer = sizeof(szBuffer);
-	std::ofstream file;
-
-	std::wstring streamName = get_record_string(hRecord, 1);
-	if (!streamName.empty() && streamName[0] != 5)
-	{
-		// Create the local file with the simple CFile write-only class.
-		do
-		{
-			uiError = MsiRecordReadStream(hRecord, 2, szBuffer, &cbBuffer);
-			if (ERROR_SUCCESS == uiError)
-			{
-				if (!file.is_open())
-				{
-					if (0 == memcmp(szBuffer, "MSCF", 4))
-					{
-						if (make_path(szPath, MAX_PATH, directory.c_str(), streamName.c_str(), L".cab"))
-						{
-							// Create the local file in which data is written.
-							file.open(szPath, std::ios_base::binary);
-						}
-					}
-				}
-
-				file.write(szBuffer, cbBuffer);
-			}
-		} while (cbBuffer && ERROR_SUCCESS == uiError);
-	}
+	std::vector<std::wstring> lines;
+	for (auto& directory : dbInfo.Directories)
+		lines.push_back(L"D\t" + directory.first + L"\t" + directory.second.ParentKey + L"\t" + directory.second.Name);
 
-	file.close();
+	for (auto& file : dbInfo.Files)
+		lines.push_back(L"F\t" + file.first + L"\t" + file.second.FileName + L"\t" + file.second.DirectoryKey);
 
-	return uiError;
-}
-
-void save_streams(PMSIHANDLE& hDatabase, const std::wstring& directory)
-{
-	execute_view(hDatabase,
-		L"SELECT Name, Data FROM _Streams",
-		[&directory](PMSIHANDLE& hRecord)
+	std::vector<std::wstring> treeLines;
+	if (digests)
 	{
-		save_stream(hRecord, directory);
-	});
-}
-
-HRESULT save_storage(IStorage* const pRootStorage, const std::wstring& pszDir, const std::wstring& pszName, const std::wstring& pszExt)
-{
-	HRESULT hr = NOERROR;
-	wchar_t szPath[MAX_PATH] = { L'\0' };
-	IStorage* pStg = nullptr;
-	IStorage* pFileStg = nullptr;
-
-	_ASSERTE(pRootStorage);
-
-	hr = pRootStorage->OpenStorage(
-		pszName.c_str(),
-		NULL,
-		STGM_READ | STGM_SHARE_EXCLUSIVE,
-		NULL,
-		0,
-		&pStg);
-	if (SUCCEEDED(hr) && pStg)
+		// A path that was written twice holds the last file
+		std::map<std::wstring, const FileDigest*> lastDigests;
+		for (auto& digest : *digests)
+			lastDigests[digest.Path] = &digest;
+		for (auto& digest : lastDigests)
+			treeLines.push_back(L"T\t" + digest.first + L"\t" + std::to_wstring(digest.second->Size) + L"\t" + L"sha256:" + format_digest(digest.second->Sha256));
+	}
+	else
 	{
-		if (!make_path(szPath, MAX_PATH, pszDir, pszName, pszExt))
+		std::error_code errorCode;
+		for (auto& entry : fs::recursive_directory_iterator(targetPath, errorCode))
 		{
-			hr = E_INVALIDARG;
-		}
-		else
-		{
-			// Create the storage file.
-			hr = StgCreateDocfile(
-				szPath,
-				STGM_WRITE | STGM_SHARE_EXCLUSIVE | STGM_CREATE,
-				0,
-				&pFileStg);
-			if (SUCCEEDED(hr) && pFileStg)
-			{
-				hr = pStg->CopyTo(0, NULL, NULL, pFileStg);
-			}
+			if (!entry.is_regular_file())
+				continue;
+
+			std::wstringstream ss;
+			ss << L"T\t" << entry.path().lexically_relative(targetPath).wstring()
+				<< L"\t" << entry.file_size()
+				<< L"\tfnv1a:" << std::hex << hash_file(entry.path().wstring());
+			treeLines.push_back(ss.str());
 		}
 	}
+	std::sort(treeLines.begin(), treeLines.end());
+	lines.insert(lines.end(), treeLines.begin(), treeLines.end());
 
-	if (pFileStg) pFileStg->Release();
-	if (pStg) pStg->Release();
+	for (auto& timing : timings)
+	{
+		auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(timing.Elapsed).count();
+		lines.push_back(L"S\t" + timing.Name + L"\t" + std::to_wstring(microseconds));
+	}
+	return lines;
+}
 
-	return hr;
+bool write_manifest(const std::wstring& path, const std::vector<std::wstring>& lines)
+{
+	std::ofstream file(path, std::ios_base::binary);
+	for (auto& line : lines)
+		file << to_utf8(line) << '\n';
+	return file.good();
 }
 
-void extract_msp(const std::wstring& mspName, const std::wstring& workDir)
+bool read_manifest(const std::wstring& path, std::vector<std::wstring>& lines)
 {
-	IStorage* pRootStorage = nullptr;
+	std::ifstream file(path, std::ios_base::binary);
+	if (!file.is_open())
+		return false;
 
-	//// Open the root storage file and extract storages first. Storages cannot
-	//// be extracted using MSI APIs so we must use the compound file implementation
-	//// for IStorage.
-	HRESULT hr = StgOpenStorage(mspName.c_str(), NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pRootStorage);
-	if (SUCCEEDED(hr) && pRootStorage)
+	std::string line;
+	while (std::getline(file, line))
 	{
-		IEnumSTATSTG* pEnum = nullptr;
-		hr = pRootStorage->EnumElements(0, NULL, 0, &pEnum);
-		if (SUCCEEDED(hr))
-		{
-			STATSTG stg = { 0 };
-			while (S_OK == (hr = pEnum->Next(1, &stg, NULL)))
-			{
-				if (STGTY_STORAGE == stg.type && stg.clsid == CLSID_MsiTransform)
-					save_storage(pRootStorage, workDir, stg.pwcsName, L".mst");
-			}
-			if (pEnum) pEnum->Release();
-		}
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			lines.push_back(from_utf8(line));
 	}
-	if (pRootStorage) pRootStorage->Release();
+	return true;
+}
 
-	PMSIHANDLE hDatabase;
-	if (MsiOpenDatabase(mspName.c_str(), (LPCTSTR)(MSIDBOPEN_READONLY + MSIDBOPEN_PATCHFILE), &hDatabase) == ERROR_SUCCESS)
+std::map<std::wstring, long long> get_manifest_timings(const std::vector<std::wstring>& lines)
+{
+	std::map<std::wstring, long long> timings;
+	for (auto& line : lines)
 	{
-		save_streams(hDatabase, workDir);
+		if (line[0] != L'S')
+			continue;
+
+		auto parts = split(line, L'\t');
+		if (parts.size() == 3)
+			timings[parts[1]] = std::wcstoll(parts[2].c_str(), nullptr, 10);
 	}
-	MsiCloseHandle(hDatabase);
+	return timings;
 }
 
-void get_files_from_mst(const std::wstring& msiName, const std::wstring& mstFile, DbInfo& dbInfo)
+// Writes a line to stderr for every stage timed in both runs: both times and the speedup from the first to the second
+void report_speedups(const std::map<std::wstring, long long>& before, const std::map<std::wstring, long long>& after)
 {
-	PMSIHANDLE hDatabase = NULL;
-	PMSIHANDLE hView = NULL;
-	PMSIHANDLE hRecord = NULL;
-
-	UINT dwError = MsiOpenDatabase(msiName.c_str(), MSIDBOPEN_READONLY, &hDatabase);
-	if (ERROR_SUCCESS == dwError)
+	for (auto& timing : after)
 	{
-		MsiDatabaseApplyTransform(hDatabase, mstFile.c_str(), 0);
+		auto beforeIt = before.find(timing.first);
+		if (beforeIt == before.end() || timing.second <= 0)
+			continue;
 
-		get_directories(hDatabase, dbInfo.Directories);
-		get_files(hDatabase, dbInfo.Files);
+		std::wcerr << timing.first << L": " << beforeIt->second << L"us -> " << timing.second << L"us ("
+			<< static_cast<double>(beforeIt->second) / timing.second << L"x)" << std::endl;
 	}
 }
 
-std::vector<std::wstring> split(const std::wstring& s, wchar_t seperator)
+// The algorithm the tree lines are hashed with, the prefix of their hash; empty without tree lines
+std::wstring get_manifest_tree_hash(const std::vector<std::wstring>& lines)
 {
-	std::vector<std::wstring> output;
-	std::wstring::size_type prev_pos = 0, pos = 0;
-	while ((pos = s.find(seperator, pos)) != std::wstring::npos)
+	for (auto& line : lines)
 	{
-		auto substring(s.substr(prev_pos, pos - prev_pos));
-		output.push_back(substring);
-		prev_pos = ++pos;
-	}
+		if (line[0] != L'T')
+			continue;
 
-	output.push_back(s.substr(prev_pos, pos - prev_pos));
-	return output;
+		auto parts = split(line, L'\t');
+		auto colon = parts.size() == 4 ? parts[3].find(L':') : std::wstring::npos;
+		return colon == std::wstring::npos ? L"an untagged hash" : parts[3].substr(0, colon);
+	}
+	return L"";
 }
 
-void get_directory_parts(const std::map<std::wstring, DirInfo>& directories, const std::wstring& key, std::vector<std::wstring>& parts_out)
+bool compare_manifest(const std::vector<std::wstring>& golden, const std::vector<std::wstring>& current)
 {
-	auto dirInfoIt = directories.find(key);
-	if (dirInfoIt == directories.end()) 
-	{
-		//handle the error
-	}
-	else 
+	// Trees hashed differently would differ in every file
+	auto goldenTreeHash = get_manifest_tree_hash(golden);
+	auto currentTreeHash = get_manifest_tree_hash(current);
+	if (!goldenTreeHash.empty() && !currentTreeHash.empty() && goldenTreeHash != currentTreeHash)
 	{
-		auto& dirInfo = dirInfoIt->second;
-		auto dirNameParts = split(dirInfo.Name, '|');
-		auto targetDirName = dirNameParts.back().c_str();
-		if (!dirInfo.ParentKey.empty())
-			get_directory_parts(directories, dirInfo.ParentKey, parts_out);
-		parts_out.push_back(targetDirName);
+		std::wcerr << L"The golden tree is hashed with " << goldenTreeHash << L", this one with " << currentTreeHash
+			<< L"; compare runs with and without --hashes against separate goldens" << std::endl;
+		return false;
 	}
+
+	auto isContent = [](const std::wstring& line) { return line[0] != L'S'; };
+	std::vector<std::wstring> goldenContent, currentContent;
+	std::copy_if(golden.begin(), golden.end(), std::back_inserter(goldenContent), isContent);
+	std::copy_if(current.begin(), current.end(), std::back_inserter(currentContent), isContent);
+	std::sort(goldenContent.begin(), goldenContent.end());
+	std::sort(currentContent.begin(), currentContent.end());
+
+	std::vector<std::wstring> missing, unexpected;
+	std::set_difference(goldenContent.begin(), goldenContent.end(), currentContent.begin(), currentContent.end(), std::back_inserter(missing));
+	std::set_difference(currentContent.begin(), currentContent.end(), goldenContent.begin(), goldenContent.end(), std::back_inserter(unexpected));
+	for (auto& line : missing)
+		std::wcerr << L"- " << line << std::endl;
+	for (auto& line : unexpected)
+		std::wcerr << L"+ " << line << std::endl;
+
+	report_speedups(get_manifest_timings(golden), get_manifest_timings(current));
+	return missing.empty() && unexpected.empty();
 }
 
-std::wstring combine_directory_parts(const std::vector<std::wstring>& parts)
+// One line per file like sha256sum writes them: the digest, two spaces and the relative path in UTF-8
+bool write_hashes(const std::wstring& path, const std::vector<FileDigest>& digests)
 {
-	std::wstringstream ss;
-	std::for_each(parts.begin(), parts.end(), [&ss](const std::wstring& s) 
-	{ 
-		ss << s << L"\\";
-	});
-	return ss.str();
+	std::ofstream file(path, std::ios_base::binary);
+	for (auto& digest : digests)
+		file << to_utf8(format_digest(digest.Sha256)) << "  " << to_utf8(digest.Path) << '\n';
+	return file.good();
 }
 
-struct ExtractOptions
+// Writes a line to stderr for every file whose MD5 differs from MsiFileHash
+bool verify_hashes(const DbInfo& dbInfo, const std::vector<FileDigest>& digests)
 {
-	const bool sixtyFourBitOnly;
-};
+	auto mismatches = find_hash_mismatches(dbInfo, digests);
+	for (auto digest : mismatches)
+	{
+		std::wcerr << L"! " << digest->Path << L"\t" << format_digest(*dbInfo.Files.at(digest->NameInCabinet).Md5)
+			<< L" -> " << format_digest(digest->Md5) << std::endl;
+	}
+	return mismatches.empty();
+}
 
-struct CabExtractContext
+bool parse_named_option(const std::wstring& arg, const std::wstring& name, std::wstring& value_out)
 {
-	const std::wstring& targetPath;
-	const DbInfo& dbInfo;
-	const ExtractOptions& extractOptions;
-};
+	auto prefix = L"--" + name + L"=";
+	if (arg.compare(0, prefix.length(), prefix) != 0)
+		return false;
 
-const std::wstring SourceDirPathPart = L"SourceDir";
-const std::wstring PFiles64PathPart = L"PFiles_64";
+	value_out = arg.substr(prefix.length());
+	return true;
+}
 
-bool extract_cab(const std::wstring& cabName, const std::wstring& targetPath, const DbInfo& dbInfo, const ExtractOptions& extractOptions)
+// One line per file: size, cabinet folder and path, tab separated and UTF-8 encoded
+void print_listing(const std::vector<ListedFile>& files)
 {
+	for (auto& file : files)
+		std::cout << file.Size << '\t' << file.Folder << '\t' << to_utf8(file.Path) << '\n';
+	std::cout.flush();
+}
 
-	auto context = CabExtractContext{ targetPath, dbInfo, extractOptions };
-	return SetupIterateCabinet(cabName.c_str(), 0,
-		[](PVOID context, UINT notification, UINT_PTR param1, UINT_PTR param2) -> UINT
-	{
-		if (notification == SPFILENOTIFY_FILEINCABINET)
-		{
-			auto fileInCabinetInfo = reinterpret_cast<FILE_IN_CABINET_INFO*>(param1);
-			auto ccontext = static_cast<CabExtractContext*>(context);
-
-			auto fileInfoIt = ccontext->dbInfo.Files.find(fileInCabinetInfo->NameInCabinet);
-			const FileInfo& fileInfo = fileInfoIt->second;
-			auto fileNameParts = split(fileInfo.FileName, '|');
-			auto targetFileName = fileNameParts.back().c_str();
+CancellationToken consoleCancellation;
 
-			std::vector<std::wstring> dirParts;
-			get_directory_parts(ccontext->dbInfo.Directories, fileInfo.DirectoryKey, dirParts);
-			if (dirParts[0] == SourceDirPathPart)
-				dirParts.erase(dirParts.begin());
+// Ctrl+C stops the pipeline at the next stage, or ends a mount, instead of killing the process, so the work
+// dir is still cleaned up
+BOOL WINAPI handle_console_ctrl(DWORD ctrlType)
+{
+	if (ctrlType != CTRL_C_EVENT && ctrlType != CTRL_BREAK_EVENT)
+		return FALSE;
 
-			if (ccontext->extractOptions.sixtyFourBitOnly)
-			{
-				if (dirParts[0] == PFiles64PathPart)
-				{
-					dirParts.erase(dirParts.begin());
-				} 
-				else
-				{
-					return FILEOP_SKIP;
-				}
-			}
+	consoleCancellation.cancel();
+	return TRUE;
+}
 
-			dirParts.insert(dirParts.begin(), ccontext->targetPath);
-			auto dirPath = combine_directory_parts(dirParts);
+// Extracts an installer with the reference or the native backends to targetPath, hashing every file with
+// SHA-256 while it is written, and builds the manifest of the run
+ReturnCode run_backends(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, bool referenceBackends,
+	const std::wstring& indexPath, const std::wstring& targetPath, std::vector<std::wstring>& manifest_out)
+{
+	const ExtractOptions backendOptions = {
+		extractOptions.sixtyFourBitOnly,
+		referenceBackends,
+		extractOptions.pathFilter,
+		indexPath,
+		extractOptions.metadataCacheDir,
+		extractOptions.verifyChecksums
+	};
 
-			std::error_code errorCode;
-			std::filesystem::create_directories(dirPath, errorCode);
-			if (errorCode)
-				return FILEOP_ABORT;
+	std::error_code errorCode;
+	fs::create_directories(workDir, errorCode);
+	if (errorCode)
+		return ReturnCode::CannotInitializeWorkDir;
 
-			PathCombine(fileInCabinetInfo->FullTargetName, dirPath.c_str(), targetFileName);
-			return FILEOP_DOIT;
-		}
-		return NO_ERROR;
-	}, static_cast<void*>(&context));
-}
+	DirectorySink directorySink(targetPath);
+	HashingSink hashingSink(directorySink, true, false);
+	DbInfo dbInfo;
+	StageTimings timings;
+	ReturnCode extractResult;
+	{
+		StageTimer timer(timings, L"total");
+		extractResult = extract_setup(setupExeName, workDir, backendOptions, hashingSink, consoleCancellation, dbInfo, timings);
+	}
 
-std::wstring concat_path(const std::wstring& firstPath, const std::wstring& secondPath)
-{
-	wchar_t combinedPath[MAX_PATH];
-	PathCombine(combinedPath, firstPath.c_str(), secondPath.c_str());
-	return combinedPath;
+	// Every run starts from an empty work dir
+	cleanup_workdir(workDir);
+	if (extractResult == ReturnCode::Success)
+		manifest_out = build_manifest(dbInfo, targetPath, &hashingSink.get_digests(), timings);
+	return extractResult;
 }
 
-std::vector<std::wstring> find_files(const std::wstring& basePath, const std::wstring& filter)
+// Extracts every installer of the corpus (an EXE, or every EXE in a directory) with the reference backends and
+// with the native ones, to <target_path>\<exe>\reference and \native, writes the manifest of each run next to its
+// tree and compares them. The differences and per-stage speedups of every installer, and of the whole corpus,
+// are written to stderr. An installer that fails does not stop the others. With useIndex, the index of every
+// installer is kept next to it as with "i".
+ReturnCode compare_corpus(const std::wstring& corpusPath, const std::wstring& targetPath, const std::wstring& workDir, const ExtractOptions& extractOptions,
+	bool useIndex)
 {
-	std::vector<std::wstring> files;
+	std::error_code errorCode;
+	std::vector<std::wstring> setupExeNames = { corpusPath };
+	if (fs::is_directory(corpusPath, errorCode))
+		setupExeNames = find_files(corpusPath, L"*.exe");
+	std::sort(setupExeNames.begin(), setupExeNames.end());
+	if (setupExeNames.empty())
+		return ReturnCode::InvalidArguments;
+
+	ReturnCode compareResult = ReturnCode::Success;
+	std::map<std::wstring, long long> referenceTotals, nativeTotals;
+	for (auto& setupExeName : setupExeNames)
+	{
+		const std::wstring setupPath = concat_path(targetPath, fs::path(setupExeName).filename().wstring());
+		std::wcerr << setupExeName << std::endl;
 
-	std::wstring fullPath = concat_path(basePath, filter);
+		fs::create_directories(setupPath, errorCode);
+		if (errorCode)
+			return ReturnCode::CannotAccessManifest;
 
-	WIN32_FIND_DATA findData = { 0 };
-	HANDLE hFind = FindFirstFile(fullPath.c_str(), &findData);
-	if (INVALID_HANDLE_VALUE != hFind)
-	{
-		do
+		std::vector<std::wstring> manifests[2];
+		ReturnCode extractResult = ReturnCode::Success;
+		for (bool referenceBackends : { true, false })
 		{
-			if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-				files.push_back(concat_path(basePath, findData.cFileName));
-		} while (FindNextFile(hFind, &findData) == TRUE);
+			const std::wstring backends = referenceBackends ? L"reference" : L"native";
+			auto& manifest = manifests[referenceBackends ? 0 : 1];
+			extractResult = run_backends(setupExeName, workDir, extractOptions, referenceBackends, useIndex ? setupExeName + L".silidx" : L"",
+				concat_path(setupPath, backends), manifest);
+			if (extractResult != ReturnCode::Success)
+			{
+				std::wcerr << backends << L": failed with " << static_cast<int>(extractResult) << std::endl;
+				break;
+			}
+			if (!write_manifest(concat_path(setupPath, backends + L".manifest"), manifest))
+				return ReturnCode::CannotAccessManifest;
+		}
 
-		FindClose(hFind);
+		if (extractResult == ReturnCode::Cancelled)
+			return extractResult;
+		if (extractResult == ReturnCode::Success)
+		{
+			if (!compare_manifest(manifests[0], manifests[1]))
+				extractResult = ReturnCode::ManifestMismatch;
+			for (auto& timing : get_manifest_timings(manifests[0]))
+				referenceTotals[timing.first] += timing.second;
+			for (auto& timing : get_manifest_timings(manifests[1]))
+				nativeTotals[timing.first] += timing.second;
+		}
+		if (compareResult == ReturnCode::Success)
+			compareResult = extractResult;
 	}
-	return files;
-}
 
-bool cleanup_workdir(const std::wstring& workdir)
-{
-	auto tempFiles = find_files(workdir, L"*");
-	std::error_code errorCode;
-	for (auto& tempFile : tempFiles)
+	if (setupExeNames.size() > 1)
 	{
-		fs::permissions(tempFile,
-			fs::perms::owner_write,
-			fs::perm_options::add, errorCode);
-		fs::remove(tempFile, errorCode);
+		std::wcerr << L"corpus" << std::endl;
+		report_speedups(referenceTotals, nativeTotals);
 	}
-	if (!errorCode)
-		fs::remove(workdir, errorCode);
-	return !errorCode;
+	return compareResult;
 }
 
-enum class ReturnCode
-{
-	Success = 0,
-	SuccessNoCleanup = 1,
-
-	CannotInitializeWorkDir = -1,
-	InvalidArguments = -2,
-	UnexpectedAmountOfMsiFiles = -3,
-	UnexpectedAmountOf7zFiles = -4,
-	UnexpectedAmountOfMspFiles = -5,
-	UnexpectedAmountOfMstFiles = -6,
-	UnexpectedAmountOfPayloadFiles = -7,
-	UnexpectedAmountOfCabFiles = -8,
-	ErrorExtractingCab = -9
-};
-
-ReturnCode extract_setup(const std::wstring& setupExeName, const std::wstring& targetPath, const std::wstring& workDir, const ExtractOptions& extractOptions)
+int wmain(int argc, wchar_t* argv[])
 {
-	bit7z::Bit7zLibrary blib;
-	bit7z::BitExtractor cextractor(blib, bit7z::BitFormat::Cab);
-	cextractor.extract(setupExeName, workDir);
-
-	auto msiFiles = find_files(workDir, L"*.msi");
-	if (msiFiles.size() != 1)
-		return ReturnCode::UnexpectedAmountOfMsiFiles;
-
-	auto sevenZipFiles = find_files(workDir, L"*.7z");
-	if (sevenZipFiles.size() != 1)
-		return ReturnCode::UnexpectedAmountOf7zFiles;
-
-	bit7z::BitExtractor extractor(blib, bit7z::BitFormat::SevenZip);
-	extractor.extract(sevenZipFiles.front(), workDir);
-
-	auto mspFiles = find_files(workDir, L"*.msp");
-	if (mspFiles.size() != 1)
-		return ReturnCode::UnexpectedAmountOfMspFiles;
-
-	extract_msp(mspFiles.front(), workDir);
-
-	auto cabFiles = find_files(workDir, L"*.cab");
-	if (cabFiles.size() != 1)
-		return ReturnCode::UnexpectedAmountOfCabFiles;
-
-	auto mstFiles = find_files(workDir, L"oldToCurrent.mst");
-	if (mstFiles.size() != 1)
-		return ReturnCode::UnexpectedAmountOfMstFiles;
-
-	DbInfo dbInfo;
-	get_files_from_mst(msiFiles.front(), mstFiles.front(), dbInfo);
-	if (dbInfo.Files.empty() || dbInfo.Directories.empty())
-		return ReturnCode::UnexpectedAmountOfPayloadFiles;
+	// In list mode the EXE takes the place of the target path, in mount mode both follow the mode. A plan
+	// takes the place of the target path in plan mode, and of the EXE in apply mode. In compare mode the corpus
+	// takes the place of the EXE.
+	const bool listMode = argc > 1 && std::wstring(argv[1]) == L"list";
+	const bool mountMode = argc > 1 && std::wstring(argv[1]) == L"mount";
+	const bool planMode = argc > 1 && std::wstring(argv[1]) == L"plan";
+	const bool applyMode = argc > 1 && std::wstring(argv[1]) == L"apply";
+	const bool compareMode = argc > 1 && std::wstring(argv[1]) == L"compare";
+	const int firstOption = mountMode || planMode || applyMode || compareMode ? 4 : 3;
+	if (argc < firstOption)
+		return static_cast<int>(ReturnCode::InvalidArguments);
 
-	if (!extract_cab(cabFiles.front(), targetPath, dbInfo, extractOptions))
-		return ReturnCode::ErrorExtractingCab;
+	// The plan refers to the EXE and the index by absolute path, so that it can be applied from anywhere
+	const std::wstring setupExeName = applyMode ? L"" : planMode ? fs::absolute(argv[2]).wstring() : argv[listMode || mountMode || compareMode ? 2 : 1];
+	const std::wstring planPath = planMode ? argv[3] : applyMode ? argv[2] : L"";
+	const std::wstring targetPath = listMode || planMode ? L"" : argv[mountMode || applyMode || compareMode ? 3 : 2];
+	std::wstring options, manifestPath, goldenPath, indexPath, cacheDir, hashesPath, pattern;
+	PathFilter pathFilter;
+	bool verifyChecksums = true;
+	bool verifyHashes = false;
+	for (int i = firstOption; i < argc; i++)
+	{
+		const std::wstring arg = argv[i];
+		if (parse_named_option(arg, L"manifest", manifestPath) || parse_named_option(arg, L"golden", goldenPath) || parse_named_option(arg, L"index", indexPath)
+			|| parse_named_option(arg, L"cache", cacheDir) || parse_named_option(arg, L"hashes", hashesPath))
+			continue;
+		if (parse_named_option(arg, L"include", pattern))
+		{
+			if (!pathFilter.include(pattern))
+				return static_cast<int>(ReturnCode::InvalidArguments);
+			continue;
+		}
+		if (parse_named_option(arg, L"exclude", pattern))
+		{
+			if (!pathFilter.exclude(pattern))
+				return static_cast<int>(ReturnCode::InvalidArguments);
+			continue;
+		}
+		if (arg == L"--no-verify")
+		{
+			verifyChecksums = false;
+			continue;
+		}
+		if (arg == L"--verify-hashes")
+		{
+			verifyHashes = true;
+			continue;
+		}
+		if (arg.compare(0, 2, L"--") == 0)
+			return static_cast<int>(ReturnCode::InvalidArguments);
+		options += arg;
+	}
 
-	return ReturnCode::Success;
-}
+	// The manifest describes the extracted tree on disk, which is not there when streaming a tar,
+	// listing, mounting or planning; applying a plan does not load the tables it is built from
+	const bool tarToStdout = !mountMode && !compareMode && targetPath == L"-";
+	if ((tarToStdout || listMode || mountMode || planMode || applyMode) && (!manifestPath.empty() || !goldenPath.empty()))
+		return static_cast<int>(ReturnCode::InvalidArguments);
 
-int wmain(int argc, wchar_t* argv[])
-{
-	if (argc < 3 || argc > 4)
+	// Only an extraction passes the files through a sink, in order, where they can be hashed
+	const bool hashFiles = !hashesPath.empty();
+	if ((hashFiles || verifyHashes) && (listMode || mountMode || planMode || applyMode))
 		return static_cast<int>(ReturnCode::InvalidArguments);
 
-	const std::wstring setupExeName = argv[1];
-	const std::wstring targetPath = argv[2];
-	const std::wstring options = argc == 4 ? std::wstring(argv[3]) : std::wstring();
+	// A comparison writes its own manifests and hashes, keeps an index per installer, and both runs must go
+	// through every stage
+	if (compareMode && (targetPath == L"-" || !manifestPath.empty() || !goldenPath.empty() || hashFiles || verifyHashes || !indexPath.empty()
+		|| !cacheDir.empty()))
+		return static_cast<int>(ReturnCode::InvalidArguments);
 
+	if (indexPath.empty() && !compareMode && (mountMode || planMode || options.find('i') != std::string::npos))
+		indexPath = setupExeName + L".silidx";
+	if (planMode)
+		indexPath = fs::absolute(indexPath).wstring();
 	ExtractOptions extractOptions = {
-		options.find('s') != std::string::npos
+		options.find('s') != std::string::npos,
+		options.find('r') != std::string::npos,
+		pathFilter,
+		indexPath,
+		cacheDir,
+		verifyChecksums
 	};
+	const bool reportTimings = options.find('t') != std::string::npos;
 
 	std::error_code errorCode;
 	const std::wstring workDir = concat_path(fs::temp_directory_path(errorCode), L"rxcle-silext");
 	if (!errorCode)
 		fs::create_directories(workDir, errorCode);
+	if (!errorCode && !cacheDir.empty())
+		fs::create_directories(cacheDir, errorCode);
 	if (errorCode)
 		return static_cast<int>(ReturnCode::CannotInitializeWorkDir);
 
-	auto extractResult = extract_setup(setupExeName, targetPath, workDir, extractOptions);
+	SetConsoleCtrlHandler(handle_console_ctrl, TRUE);
+
+	if (compareMode)
+	{
+		auto compareResult = compare_corpus(setupExeName, targetPath, workDir, extractOptions, options.find('i') != std::string::npos);
+		bool cleanedUp = cleanup_workdir(workDir);
+		return static_cast<int>(compareResult == ReturnCode::Success && !cleanedUp ? ReturnCode::SuccessNoCleanup : compareResult);
+	}
+
+	DirectorySink directorySink(targetPath);
+	TarSink tarSink(GetStdHandle(STD_OUTPUT_HANDLE));
+	FileSink& targetSink = tarToStdout ? static_cast<FileSink&>(tarSink) : directorySink;
+	HashingSink hashingSink(targetSink, hashFiles, verifyHashes);
+	FileSink& sink = hashFiles || verifyHashes ? hashingSink : targetSink;
+
+	DbInfo dbInfo;
+	StageTimings timings;
+	ReturnCode extractResult;
+	std::vector<ListedFile> listedFiles;
+	SetupPayload payload;
+	ExtractionPlan plan;
+	PlanTarget planTarget(targetPath);
+	{
+		StageTimer timer(timings, L"total");
+		if (listMode)
+		{
+			extractResult = list_setup(setupExeName, workDir, extractOptions, consoleCancellation, dbInfo, listedFiles, timings);
+		}
+		else if (mountMode)
+		{
+			extractResult = payload.open(setupExeName, workDir, extractOptions, MountCacheBytes, consoleCancellation, dbInfo, timings);
+		}
+		else if (planMode)
+		{
+			extractResult = plan_setup(setupExeName, workDir, extractOptions, consoleCancellation, plan, dbInfo, timings);
+			if (extractResult == ReturnCode::Success && !write_plan(planPath, plan))
+				extractResult = ReturnCode::CannotAccessPlan;
+		}
+		else if (applyMode)
+		{
+			if (!read_plan(planPath, plan))
+			{
+				extractResult = ReturnCode::CannotAccessPlan;
+			}
+			else if (!planTarget.create(plan))
+			{
+				extractResult = ReturnCode::ErrorExtractingCab;
+			}
+			else
+			{
+				extractResult = apply_plan(plan, verifyChecksums, consoleCancellation, [&planTarget](size_t file, uint64_t offset, const uint8_t* data, size_t size)
+				{
+					return planTarget.write(file, offset, data, size);
+				}, timings);
+				planTarget.finish();
+			}
+		}
+		else
+		{
+			extractResult = extract_setup(setupExeName, workDir, extractOptions, sink, consoleCancellation, dbInfo, timings);
+			if (extractResult == ReturnCode::Success && tarToStdout && !tarSink.finish())
+				extractResult = ReturnCode::ErrorExtractingCab;
+		}
+	}
+
+	if (extractResult == ReturnCode::Success && mountMode)
+	{
+		if (!mount_payload(payload, targetPath, consoleCancellation))
+			extractResult = ReturnCode::CannotMount;
+		payload.close();
+	}
 
 	bool cleanedUp = cleanup_workdir(workDir);
 
+	// The hashing overlaps extract_cab, as the files are hashed while they are written
+	if (hashFiles || verifyHashes)
+		add_stage_timing(timings, L"hash", hashingSink.get_hash_time());
+	if (extractResult == ReturnCode::Success && hashFiles && !write_hashes(hashesPath, hashingSink.get_digests()))
+		extractResult = ReturnCode::CannotAccessHashes;
+	if (extractResult == ReturnCode::Success && verifyHashes && !verify_hashes(dbInfo, hashingSink.get_digests()))
+		extractResult = ReturnCode::HashMismatch;
+
+	if (reportTimings)
+		std::wcerr << format_timings_json(timings) << std::endl;
+
+	if (extractResult == ReturnCode::Success && listMode)
+		print_listing(listedFiles);
+
+	if (extractResult == ReturnCode::Success && (!manifestPath.empty() || !goldenPath.empty()))
+	{
+		auto manifest = build_manifest(dbInfo, targetPath, hashFiles ? &hashingSink.get_digests() : nullptr, timings);
+		if (!manifestPath.empty() && !write_manifest(manifestPath, manifest))
+			return static_cast<int>(ReturnCode::CannotAccessManifest);
+
+		std::vector<std::wstring> golden;
+		if (!goldenPath.empty())
+		{
+			if (!read_manifest(goldenPath, golden))
+				return static_cast<int>(ReturnCode::CannotAccessManifest);
+			if (!compare_manifest(golden, manifest))
+				return static_cast<int>(ReturnCode::ManifestMismatch);
+		}
+	}
+
 	return static_cast<int>(
 		extractResult == ReturnCode::Success && !cleanedUp 
 		? ReturnCode::SuccessNoCleanup 
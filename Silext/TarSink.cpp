@@ -0,0 +1,184 @@
+#include "TarSink.h"
+
+#include <algorithm>
+#include <cstring>
+#include "Util.h"
+
+namespace
+{
+	const size_t BlockSize = 512;
+	const size_t OutputBufferSize = 1024 * 1024;
+	const uint64_t MaxOctalSize = 077777777777ULL; // 11 octal digits
+	const uint64_t UnixEpoch = 116444736000000000ULL; // 1970-01-01 as FILETIME
+
+	const uint32_t DirectoryMode = 0755;
+	const uint32_t FileMode = 0644;
+	const uint32_t ReadOnlyFileMode = 0444;
+
+	// Writes value as zero padded octal digits, followed by a NUL at the end of the field
+	void write_octal(char* field, size_t width, uint64_t value)
+	{
+		field[width - 1] = '\0';
+		for (size_t i = width - 1; i > 0; i--)
+		{
+			field[i - 1] = static_cast<char>('0' + (value & 7));
+			value >>= 3;
+		}
+	}
+
+	uint64_t to_unix_time(const FILETIME& fileTime)
+	{
+		uint64_t ticks = (static_cast<uint64_t>(fileTime.dwHighDateTime) << 32) | fileTime.dwLowDateTime;
+		return ticks > UnixEpoch ? (ticks - UnixEpoch) / 10000000 : 0;
+	}
+
+	// A pax extended header record, "<length> <key>=<value>\n" where the length includes itself
+	std::string pax_record(const std::string& key, const std::string& value)
+	{
+		size_t length = key.size() + value.size() + 3;
+		size_t total = length + 1;
+		while (total != length + std::to_string(total).size())
+			total = length + std::to_string(total).size();
+		return std::to_string(total) + " " + key + "=" + value + "\n";
+	}
+
+	// Splits a path over the ustar prefix (155) and name (100) fields; false if it does not fit
+	// or is not plain ASCII, in which case it goes into a pax header instead
+	bool split_ustar_path(const std::string& path, std::string& prefix_out, std::string& name_out)
+	{
+		if (std::any_of(path.begin(), path.end(), [](char c) { return static_cast<unsigned char>(c) >= 0x80; }))
+			return false;
+
+		if (path.size() <= 100)
+		{
+			prefix_out.clear();
+			name_out = path;
+			return true;
+		}
+
+		// Directories end in '/', which must stay in the name field
+		for (size_t pos = path.find('/'); pos != std::string::npos && pos < path.size() - 1; pos = path.find('/', pos + 1))
+		{
+			if (pos <= 155 && path.size() - pos - 1 <= 100)
+			{
+				prefix_out = path.substr(0, pos);
+				name_out = path.substr(pos + 1);
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+TarSink::TarSink(HANDLE hOutput)
+	: hOutput(hOutput)
+{
+	buffer.reserve(OutputBufferSize);
+}
+
+bool TarSink::begin_file(const SinkFile& file)
+{
+	std::string path = to_utf8(file.Path);
+	std::replace(path.begin(), path.end(), '\\', '/');
+	uint64_t mtime = to_unix_time(file.LastWriteTime);
+
+	for (size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1))
+	{
+		auto directory = path.substr(0, pos + 1);
+		if (directories.insert(directory).second && !write_header(directory, '5', 0, DirectoryMode, mtime))
+			return false;
+	}
+
+	fileSize = remaining = file.Size;
+	uint32_t mode = (file.Attributes & FILE_ATTRIBUTE_READONLY) ? ReadOnlyFileMode : FileMode;
+	return write_header(path, '0', file.Size, mode, mtime);
+}
+
+bool TarSink::write_chunk(const uint8_t* data, size_t size)
+{
+	if (size > remaining)
+		return false;
+
+	remaining -= size;
+	return write(data, size);
+}
+
+// The header already holds the size from the cabinet, so the data has to match it exactly
+bool TarSink::end_file()
+{
+	return remaining == 0 && write_padding(fileSize);
+}
+
+bool TarSink::finish()
+{
+	const uint8_t endOfArchive[2 * BlockSize] = {};
+	return write(endOfArchive, sizeof(endOfArchive)) && flush();
+}
+
+bool TarSink::write_header(const std::string& path, char type, uint64_t size, uint32_t mode, uint64_t mtime)
+{
+	std::string prefix, name, pax;
+	if (!split_ustar_path(path, prefix, name))
+	{
+		pax += pax_record("path", path);
+		name = path.substr(0, 100);
+		prefix.clear();
+	}
+	if (size > MaxOctalSize)
+		pax += pax_record("size", std::to_string(size));
+
+	if (!pax.empty())
+	{
+		if (!write_header("PaxHeader", 'x', pax.size(), FileMode, mtime) || !write(pax.data(), pax.size()) || !write_padding(pax.size()))
+			return false;
+	}
+
+	char header[BlockSize] = {};
+	memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+	write_octal(header + 100, 8, mode);
+	write_octal(header + 108, 8, 0);
+	write_octal(header + 116, 8, 0);
+	write_octal(header + 124, 12, size > MaxOctalSize ? 0 : size);
+	write_octal(header + 136, 12, mtime);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memcpy(header + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+	// The checksum is taken with the checksum field itself filled with spaces
+	memset(header + 148, ' ', 8);
+	unsigned int checksum = 0;
+	for (char c : header)
+		checksum += static_cast<unsigned char>(c);
+	write_octal(header + 148, 7, checksum);
+
+	return write(header, sizeof(header));
+}
+
+bool TarSink::write(const void* data, size_t size)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+	buffer.insert(buffer.end(), bytes, bytes + size);
+	return buffer.size() < OutputBufferSize || flush();
+}
+
+bool TarSink::write_padding(uint64_t size)
+{
+	const uint8_t zeros[BlockSize] = {};
+	return write(zeros, static_cast<size_t>((BlockSize - size % BlockSize) % BlockSize));
+}
+
+bool TarSink::flush()
+{
+	size_t pos = 0;
+	while (pos < buffer.size())
+	{
+		DWORD written = 0;
+		DWORD toWrite = static_cast<DWORD>(std::min<size_t>(buffer.size() - pos, OutputBufferSize));
+		if (!WriteFile(hOutput, buffer.data() + pos, toWrite, &written, NULL) || !written)
+			return false;
+		pos += written;
+	}
+	buffer.clear();
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "Silext.h"
+
+// Streams the extracted tree as a POSIX tar archive to a handle (e.g. stdout). Entries follow the
+// order of the sink calls, which is the cabinet order, and every directory precedes its first file.
+// Headers only depend on the paths, sizes and dates from the cabinet, so the archive is reproducible.
+class TarSink : public FileSink
+{
+public:
+	explicit TarSink(HANDLE hOutput);
+
+	bool begin_file(const SinkFile& file) override;
+	bool write_chunk(const uint8_t* data, size_t size) override;
+	bool end_file() override;
+
+	// Writes the end of archive marker and flushes the output
+	bool finish();
+
+private:
+	bool write_header(const std::string& path, char type, uint64_t size, uint32_t mode, uint64_t mtime);
+	bool write(const void* data, size_t size);
+	bool write_padding(uint64_t size);
+	bool flush();
+
+	HANDLE hOutput;
+	std::vector<uint8_t> buffer;
+	std::set<std::string> directories;
+	uint64_t fileSize = 0;
+	uint64_t remaining = 0;
+};
@@ -0,0 +1,73 @@
+#include "Bcj.h"
+#include "Lzma.h"
+#include "Sha256.h"
+#include "Test.h"
+
+namespace
+{
+	size_t find_x86_branch_reference(const uint8_t* data, size_t pos, size_t end, bool includeJumps)
+	{
+		for (; pos < end; pos++)
+		{
+			if (data[pos] == 0xE8 || (includeJumps && data[pos] == 0xE9))
+				return pos;
+		}
+		return end;
+	}
+}
+
+// The AVX2 and SSE2 scans against a byte loop, from every start position and up to every end
+TEST(bcj_find_branch_paths_match)
+{
+	auto data = make_test_data(4096, 11);
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		// Sparse branches, so that the scans cross whole vectors without one
+		if (data[i] == 0xE8 || data[i] == 0xE9)
+			data[i] = 0;
+		if (i % 97 == 5)
+			data[i] = 0xE8;
+		else if (i % 131 == 7)
+			data[i] = 0xE9;
+	}
+
+	for_each_cpu_path([&]()
+	{
+		for (bool includeJumps : { false, true })
+		{
+			for (size_t pos = 0; pos < 200; pos++)
+			{
+				for (size_t end : { pos, pos + 1, pos + 31, pos + 32, pos + 33, data.size() - 1, data.size() })
+				{
+					CHECK(find_x86_branch(data.data(), pos, end, includeJumps) == find_x86_branch_reference(data.data(), pos, end, includeJumps));
+				}
+			}
+
+			// Every branch in turn
+			size_t count = 0;
+			for (size_t pos = 0; (pos = find_x86_branch(data.data(), pos, data.size(), includeJumps)) < data.size(); pos++)
+			{
+				CHECK(pos == find_x86_branch_reference(data.data(), pos, data.size(), includeJumps));
+				count++;
+			}
+			CHECK(count > 10);
+		}
+	});
+}
+
+// x86.bcj.lzma2 is x86-like code through the BCJ x86 filter and then LZMA2, as in a 7z folder
+TEST(bcj_x86_known_answer)
+{
+	auto file = load_fixture("x86.bcj.lzma2");
+	std::vector<uint8_t> filtered(65573);
+	CHECK(lzma2_decode(file.data(), file.size(), filtered.data(), filtered.size()));
+
+	for_each_cpu_path([&]()
+	{
+		std::vector<uint8_t> data = filtered;
+		bcj_x86_decode(data.data(), data.size(), 0);
+		Sha256 hash;
+		hash.update(data.data(), data.size());
+		CHECK(format_hex(hash.finish()) == "0025292154060df030c0a71eb10332fc1c347e237c2a181fafb7573a001c09eb");
+	});
+}
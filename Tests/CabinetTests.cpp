@@ -0,0 +1,181 @@
+#include "Cabinet.h"
+#include "CabinetIndex.h"
+#include "Sha256.h"
+#include "Test.h"
+
+namespace
+{
+	struct ExpectedFile
+	{
+		const wchar_t* Name;
+		size_t Size;
+		const char* Sha256;
+	};
+
+	// Both cabinets hold a.txt and b.dll in one folder and c.bin and empty.txt in another. The LZX one
+	// mixes verbatim, aligned and uncompressed blocks and translates E8 calls; the MSZIP one has a
+	// reserved area in every CFDATA block, which its checksums include.
+	const ExpectedFile ExpectedFiles[] = {
+		{ L"a.txt", 70000, "906e22e8d012854037a54ff0890b5eb835aa0546f08923b561ed1ef060abd359" },
+		{ L"b.dll", 40001, "b0aa8013de752f6efe940a9533ed11e4ed7af272e6d1bd69d7f13382e5b21e5a" },
+		{ L"c.bin", 25600, "22c27b021752596140145a93194d9cdf33b0b1b454f50fd1b430491eb3eb3cb9" },
+		{ L"empty.txt", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	};
+
+	const char* const Cabinets[] = { "lzx.cab", "mszip.cab" };
+
+	std::string hash_data(const std::vector<uint8_t>& data)
+	{
+		Sha256 hash;
+		hash.update(data.data(), data.size());
+		return format_hex(hash.finish());
+	}
+
+	void check_files(const std::vector<CabinetFile>& files, const std::vector<std::wstring>& names)
+	{
+		CHECK(files.size() == names.size());
+		for (size_t i = 0; i < files.size() && i < names.size(); i++)
+		{
+			CHECK(files[i].Name == names[i]);
+			for (auto& expected : ExpectedFiles)
+			{
+				if (files[i].Name == expected.Name)
+					CHECK(files[i].Data.size() == expected.Size && hash_data(files[i].Data) == expected.Sha256);
+			}
+		}
+	}
+
+	// Decodes every block of a folder in order; states_out holds the state of the decoder before each
+	bool decode_folder(const std::vector<uint8_t>& cab, const CabinetListing& listing, const CabinetFolder& folder, std::vector<std::vector<uint8_t>>& blocks_out, std::vector<std::vector<uint8_t>>& states_out)
+	{
+		auto decoder = create_folder_decoder(folder.CompressionType);
+		if (!decoder)
+			return false;
+
+		size_t offset = folder.DataOffset;
+		for (uint16_t i = 0; i < folder.DataBlocks; i++)
+		{
+			CabinetDataBlock block;
+			if (!read_cab_data_block(cab.data(), cab.size(), listing.DataReserve, offset, block))
+				return false;
+			states_out.emplace_back();
+			decoder->save_state(states_out.back());
+			blocks_out.emplace_back(block.UncompressedSize);
+			if (!decoder->decode_block(block.Data, block.Size, blocks_out.back().data(), blocks_out.back().size()))
+				return false;
+		}
+		return true;
+	}
+}
+
+TEST(cabinet_native_known_answer)
+{
+	for (auto name : Cabinets)
+	{
+		auto cab = load_fixture(name);
+		for_each_cpu_path([&]()
+		{
+			BlockVerifier verifier;
+			std::vector<CabinetFile> files;
+			CHECK(extract_cab_native(cab.data(), cab.size(), &verifier, [](const std::wstring&) { return true; }, [&](CabinetFile&& file)
+			{
+				files.push_back(std::move(file));
+				return true;
+			}));
+			check_files(files, { L"a.txt", L"b.dll", L"c.bin", L"empty.txt" });
+		});
+	}
+}
+
+// Decoding resumes from the state saved before any block, in a new decoder, with the same output
+TEST(cabinet_decoder_checkpoints)
+{
+	for (auto name : Cabinets)
+	{
+		auto cab = load_fixture(name);
+		CabinetListing listing;
+		CHECK(list_cab_from_memory(cab.data(), cab.size(), listing));
+		CHECK(listing.Folders.size() == 2);
+		for (auto& folder : listing.Folders)
+		{
+			std::vector<std::vector<uint8_t>> blocks, states;
+			CHECK(decode_folder(cab, listing, folder, blocks, states));
+			CHECK(blocks.size() == folder.DataBlocks);
+			for (size_t start = 1; start < blocks.size(); start++)
+			{
+				auto decoder = create_folder_decoder(folder.CompressionType);
+				CHECK(decoder->restore_state(states[start].data(), states[start].size()));
+
+				size_t offset = folder.DataOffset;
+				for (size_t i = 0; i < blocks.size(); i++)
+				{
+					CabinetDataBlock block;
+					CHECK(read_cab_data_block(cab.data(), cab.size(), listing.DataReserve, offset, block));
+					if (i < start)
+						continue;
+					std::vector<uint8_t> out(block.UncompressedSize);
+					CHECK(decoder->decode_block(block.Data, block.Size, out.data(), out.size()));
+					CHECK(out == blocks[i]);
+
+					// Saving the state does not change it
+					std::vector<uint8_t> state;
+					decoder->save_state(state);
+					CHECK(i + 1 == blocks.size() || state == states[i + 1]);
+				}
+			}
+		}
+	}
+}
+
+TEST(cabinet_indexed_extraction)
+{
+	for (auto name : Cabinets)
+	{
+		auto cab = load_fixture(name);
+		CabinetIndex index;
+		CHECK(build_cabinet_index(cab.data(), cab.size(), 1, nullptr, index));
+		CHECK(index.Folders.size() == 2);
+
+		for (auto wanted : { L"b.dll", L"a.txt", L"c.bin" })
+		{
+			std::vector<CabinetFile> files;
+			CHECK(extract_cab_indexed(cab.data(), cab.size(), index, nullptr, [&](const std::wstring& file) { return file == wanted; }, [&](CabinetFile&& file)
+			{
+				files.push_back(std::move(file));
+				return true;
+			}));
+			check_files(files, { wanted });
+		}
+	}
+}
+
+TEST(cabinet_block_checksums)
+{
+	auto cab = load_fixture("mszip.cab");
+	CabinetListing listing;
+	CHECK(list_cab_from_memory(cab.data(), cab.size(), listing));
+	CHECK(listing.DataReserve == 4);
+
+	// The checksums of this cabinet include the reserved area, and only that variant matches
+	size_t offset = listing.Folders.empty() ? 0 : listing.Folders[0].DataOffset;
+	CabinetDataBlock block;
+	CHECK(read_cab_data_block(cab.data(), cab.size(), listing.DataReserve, offset, block));
+	CHECK(verify_cab_data_block(block, true));
+	CHECK(!verify_cab_data_block(block, false));
+
+	// A flipped bit in the data of the second block fails both the extraction and building the index
+	offset = listing.Folders[0].DataOffset;
+	CHECK(read_cab_data_block(cab.data(), cab.size(), listing.DataReserve, offset, block));
+	CHECK(read_cab_data_block(cab.data(), cab.size(), listing.DataReserve, offset, block));
+	std::vector<uint8_t> corrupt = cab;
+	corrupt[block.Data - cab.data() + block.Size - 1] ^= 1;
+
+	BlockVerifier verifier;
+	auto all = [](const std::wstring&) { return true; };
+	auto ignore = [](CabinetFile&&) { return true; };
+	CHECK(extract_cab_native(cab.data(), cab.size(), &verifier, all, ignore));
+	BlockVerifier corruptVerifier;
+	CHECK(!extract_cab_native(corrupt.data(), corrupt.size(), &corruptVerifier, all, ignore));
+	CabinetIndex index;
+	CHECK(!build_cabinet_index(corrupt.data(), corrupt.size(), DefaultCheckpointInterval, &corruptVerifier, index));
+}
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include "Crc32.h"
+#include "Test.h"
+
+TEST(crc32_known_answer)
+{
+	for_each_cpu_path([]()
+	{
+		CHECK(crc32(reinterpret_cast<const uint8_t*>("123456789"), 9) == 0xCBF43926);
+		CHECK(crc32(nullptr, 0) == 0);
+
+		// Long enough for the folding loop
+		std::vector<uint8_t> zeros(4096, 0);
+		CHECK(crc32(zeros.data(), zeros.size()) == 0xC71C0011);
+	});
+}
+
+// PCLMULQDQ folding against slicing-by-8 for every size around the 64 byte runs, at every alignment
+TEST(crc32_paths_match)
+{
+	auto data = make_test_data(70000, 32);
+	const size_t sizes[] = { 0, 1, 7, 8, 15, 63, 64, 65, 127, 128, 129, 191, 255, 256, 1000, 4099, 65536 };
+	std::vector<uint32_t> expected;
+	with_fallback_paths([&]()
+	{
+		for (size_t offset = 0; offset < 4; offset++)
+		{
+			for (size_t size : sizes)
+				expected.push_back(crc32(data.data() + offset, size, 0x12345678));
+		}
+	});
+
+	for_each_cpu_path([&]()
+	{
+		size_t i = 0;
+		for (size_t offset = 0; offset < 4; offset++)
+		{
+			for (size_t size : sizes)
+				CHECK(crc32(data.data() + offset, size, 0x12345678) == expected[i++]);
+		}
+
+		// Continuing from the CRC of the data before gives the CRC of the whole
+		uint32_t whole = crc32(data.data(), data.size());
+		for (size_t split : { 0, 1, 63, 64, 100, 4096, 69999 })
+			CHECK(crc32(data.data() + split, data.size() - split, crc32(data.data(), split)) == whole);
+	});
+}
+
+TEST(crc32_combine_matches_whole)
+{
+	auto data = make_test_data(200000, 7);
+	uint32_t whole = crc32(data.data(), data.size());
+	for (size_t split : { 0, 1, 2, 64, 1000, 65536, 131071, 199999, 200000 })
+	{
+		uint32_t first = crc32(data.data(), split);
+		uint32_t second = crc32(data.data() + split, data.size() - split);
+		CHECK(crc32_combine(first, second, data.size() - split) == whole);
+	}
+
+	// Many ranges in order, as they are put together after being checksummed on different threads
+	uint32_t combined = 0;
+	for (size_t pos = 0; pos < data.size(); pos += 12345)
+	{
+		size_t size = std::min<size_t>(12345, data.size() - pos);
+		combined = crc32_combine(combined, crc32(data.data() + pos, size), size);
+	}
+	CHECK(combined == whole);
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cstring>
+#include "Md5.h"
+#include "Sha256.h"
+#include "Test.h"
+
+namespace
+{
+	struct KnownAnswer
+	{
+		const char* Message;
+		const char* Digest;
+	};
+
+	// FIPS 180-2 appendix B
+	const KnownAnswer Sha256Answers[] = {
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	};
+
+	// RFC 1321 appendix A.5
+	const KnownAnswer Md5Answers[] = {
+		{ "", "d41d8cd98f00b204e9800998ecf8427e" },
+		{ "a", "0cc175b9c0f1b6a831c399e269772661" },
+		{ "abc", "900150983cd24fb0d6963f7d28e17f72" },
+		{ "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+		{ "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+		{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f" },
+		{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890", "57edf4a22be3c955ac49da2e2107b67a" },
+	};
+
+	// Messages of every size around the block and padding boundaries, and some of several blocks
+	std::vector<std::vector<uint8_t>> make_messages()
+	{
+		std::vector<std::vector<uint8_t>> messages;
+		for (size_t size = 0; size <= 130; size++)
+			messages.push_back(make_test_data(size, static_cast<uint32_t>(size) + 1));
+		for (size_t size : { 1000, 4095, 16384, 100001 })
+			messages.push_back(make_test_data(size, static_cast<uint32_t>(size)));
+		return messages;
+	}
+
+	template <typename Hash>
+	auto hash_in_pieces(const std::vector<uint8_t>& message, size_t pieceSize)
+	{
+		Hash hash;
+		for (size_t pos = 0; pos < message.size(); pos += pieceSize)
+			hash.update(message.data() + pos, std::min(pieceSize, message.size() - pos));
+		return hash.finish();
+	}
+
+	// hashMany over all messages at once must give what the incremental hash gives on the fallback path
+	template <typename Hash, typename Digest, typename HashMany>
+	void check_many(HashMany hashMany)
+	{
+		auto messages = make_messages();
+		std::vector<const uint8_t*> data;
+		std::vector<size_t> sizes;
+		for (auto& message : messages)
+		{
+			data.push_back(message.data());
+			sizes.push_back(message.size());
+		}
+
+		std::vector<Digest> expected(messages.size());
+		with_fallback_paths([&]()
+		{
+			for (size_t i = 0; i < messages.size(); i++)
+				expected[i] = hash_in_pieces<Hash>(messages[i], messages[i].size() + 1);
+		});
+
+		for_each_cpu_path([&]()
+		{
+			std::vector<Digest> digests(messages.size());
+			hashMany(data.data(), sizes.data(), messages.size(), digests.data());
+			CHECK(digests == expected);
+			for (size_t i = 0; i < messages.size(); i++)
+				CHECK(hash_in_pieces<Hash>(messages[i], 61) == expected[i]);
+		});
+	}
+}
+
+TEST(sha256_known_answers)
+{
+	for_each_cpu_path([]()
+	{
+		for (auto& answer : Sha256Answers)
+		{
+			Sha256 hash;
+			hash.update(reinterpret_cast<const uint8_t*>(answer.Message), strlen(answer.Message));
+			CHECK(format_hex(hash.finish()) == answer.Digest);
+
+			const uint8_t* data = reinterpret_cast<const uint8_t*>(answer.Message);
+			size_t size = strlen(answer.Message);
+			Sha256Digest digest;
+			sha256_many(&data, &size, 1, &digest);
+			CHECK(format_hex(digest) == answer.Digest);
+		}
+
+		std::vector<uint8_t> million(1000000, 'a');
+		CHECK(format_hex(hash_in_pieces<Sha256>(million, 997)) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+	});
+}
+
+TEST(sha256_many_matches_single)
+{
+	check_many<Sha256, Sha256Digest>(sha256_many);
+}
+
+TEST(md5_known_answers)
+{
+	for_each_cpu_path([]()
+	{
+		std::vector<const uint8_t*> data;
+		std::vector<size_t> sizes;
+		for (auto& answer : Md5Answers)
+		{
+			Md5 hash;
+			hash.update(reinterpret_cast<const uint8_t*>(answer.Message), strlen(answer.Message));
+			CHECK(format_hex(hash.finish()) == answer.Digest);
+			data.push_back(reinterpret_cast<const uint8_t*>(answer.Message));
+			sizes.push_back(strlen(answer.Message));
+		}
+
+		std::vector<Md5Digest> digests(data.size());
+		md5_many(data.data(), sizes.data(), data.size(), digests.data());
+		for (size_t i = 0; i < digests.size(); i++)
+			CHECK(format_hex(digests[i]) == Md5Answers[i].Digest);
+	});
+}
+
+TEST(md5_many_matches_single)
+{
+	check_many<Md5, Md5Digest>(md5_many);
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <mutex>
+#include "Lzma.h"
+#include "Sha256.h"
+#include "Test.h"
+
+namespace
+{
+	std::string hash_output(const std::vector<uint8_t>& out)
+	{
+		Sha256 hash;
+		hash.update(out.data(), out.size());
+		return format_hex(hash.finish());
+	}
+
+	// Counts how often every byte of the output is passed to the observer
+	class CoverageObserver
+	{
+	public:
+		explicit CoverageObserver(size_t size) : counts(size, 0) {}
+
+		LzmaOutputObserver get_observer()
+		{
+			return [this](size_t offset, size_t size)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t i = offset; i < offset + size && i < counts.size(); i++)
+					counts[i]++;
+				overrun |= offset + size > counts.size();
+			};
+		}
+
+		bool is_each_byte_once() const
+		{
+			return !overrun && std::all_of(counts.begin(), counts.end(), [](uint8_t count) { return count == 1; });
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<uint8_t> counts;
+		bool overrun = false;
+	};
+}
+
+// text.lzma is an .lzma file: the 5 property bytes, the unpacked size as 64 bits, the raw stream
+TEST(lzma_known_answer)
+{
+	auto file = load_fixture("text.lzma");
+	if (file.size() < 13)
+		return;
+
+	LzmaProperties properties;
+	CHECK(parse_lzma_properties(file.data(), 5, properties));
+	CHECK(properties.LiteralContextBits == 3 && properties.LiteralPosBits == 0 && properties.PosBits == 2);
+	CHECK(properties.DictionarySize == 65536);
+
+	uint64_t size = 0;
+	for (int i = 0; i < 8; i++)
+		size |= static_cast<uint64_t>(file[5 + i]) << (8 * i);
+	CHECK(size == 80000);
+
+	std::vector<uint8_t> out(static_cast<size_t>(size));
+	CoverageObserver coverage(out.size());
+	LzmaOutputObserver observer = coverage.get_observer();
+	CHECK(lzma_decode(properties, file.data() + 13, file.size() - 13, out.data(), out.size(), &observer));
+	CHECK(hash_output(out) == "aa7391f3eec96dc9c4b2b60357308af193cce24e6b574fe3fba1c282121a86fc");
+	CHECK(coverage.is_each_byte_once());
+
+	// A truncated stream must fail rather than produce short output
+	CHECK(!lzma_decode(properties, file.data() + 13, (file.size() - 13) / 2, out.data(), out.size()));
+}
+
+// segments.lzma2 holds four segments, each starting with a dictionary reset: LZMA, LZMA, uncompressed, LZMA
+TEST(lzma2_parallel_segments)
+{
+	auto file = load_fixture("segments.lzma2");
+	const size_t size = 170004;
+	const char* expected = "990f3ff30785cc639b9abd0ba32874770c3e9dda8c74e201e94528f16483b293";
+
+	std::vector<uint8_t> out(size);
+	Lzma2Stats stats = {};
+	CoverageObserver coverage(out.size());
+	LzmaOutputObserver observer = coverage.get_observer();
+	CHECK(lzma2_decode(file.data(), file.size(), out.data(), out.size(), &stats, &observer));
+	CHECK(hash_output(out) == expected);
+	CHECK(stats.Segments == 4);
+	CHECK(stats.Threads >= 1 && stats.Threads <= stats.Segments);
+	CHECK(coverage.is_each_byte_once());
+
+	// The same output in one go again, so that no segment depends on how the threads took them
+	std::vector<uint8_t> again(size);
+	CHECK(lzma2_decode(file.data(), file.size(), again.data(), again.size()));
+	CHECK(again == out);
+
+	// A wrong unpacked size or a truncated stream must fail
+	std::vector<uint8_t> shorter(size - 1);
+	CHECK(!lzma2_decode(file.data(), file.size(), shorter.data(), shorter.size()));
+	CHECK(!lzma2_decode(file.data(), file.size() - 100, out.data(), out.size()));
+}
+
+TEST(lzma2_empty)
+{
+	const uint8_t end = 0;
+	CHECK(lzma2_decode(&end, 1, nullptr, 0));
+}
@@ -0,0 +1,139 @@
+// Runs every test against the fixtures and returns the number of failed checks.
+//
+// Usage: Tests [<fixtures dir>]
+// The fixtures dir defaults to the one the build copies next to Tests.exe.
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "Cpu.h"
+#include "Test.h"
+
+namespace
+{
+	struct RegisteredTest
+	{
+		const char* Name;
+		TestFunction Function;
+	};
+
+	struct CpuPath
+	{
+		const char* Name;
+		CpuFeatures Features;
+	};
+
+	// SHA-NI, then the AVX2 multi-buffer and vector loops, then SSE4.1 and PCLMUL, then SSE2 only
+	const CpuPath CpuPaths[] = {
+		{ "native", { true, true, true, true } },
+		{ "no SHA-NI", { true, true, true, false } },
+		{ "no AVX2", { true, true, false, false } },
+		{ "SSE2", { false, false, false, false } },
+	};
+
+	const CpuFeatures AllFeatures = { true, true, true, true };
+
+	std::vector<RegisteredTest>& get_tests()
+	{
+		static std::vector<RegisteredTest> tests;
+		return tests;
+	}
+
+	std::filesystem::path fixturesDir;
+	const char* currentTest = "";
+	const char* currentPath = "native";
+	size_t failures = 0;
+}
+
+bool register_test(const char* name, TestFunction function)
+{
+	get_tests().push_back({ name, function });
+	return true;
+}
+
+void report_failure(const char* file, int line, const char* expression)
+{
+	printf("%s(%d): %s [%s]: %s\n", std::filesystem::path(file).filename().string().c_str(), line, currentTest, currentPath, expression);
+	failures++;
+}
+
+std::vector<uint8_t> load_fixture(const char* name)
+{
+	std::ifstream file(fixturesDir / name, std::ios::binary);
+	if (!file)
+	{
+		printf("%s: missing fixture %s\n", currentTest, name);
+		failures++;
+		return {};
+	}
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+void for_each_cpu_path(const std::function<void()>& check)
+{
+	for (auto& path : CpuPaths)
+	{
+		restrict_cpu_features(path.Features);
+		currentPath = path.Name;
+		check();
+	}
+	restrict_cpu_features(AllFeatures);
+	currentPath = CpuPaths[0].Name;
+}
+
+void with_fallback_paths(const std::function<void()>& check)
+{
+	restrict_cpu_features({});
+	check();
+	restrict_cpu_features(AllFeatures);
+}
+
+std::string format_hex(const uint8_t* data, size_t size)
+{
+	static const char Digits[] = "0123456789abcdef";
+	std::string hex;
+	for (size_t i = 0; i < size; i++)
+	{
+		hex += Digits[data[i] >> 4];
+		hex += Digits[data[i] & 15];
+	}
+	return hex;
+}
+
+// xorshift32, which never yields 0 for a seed other than 0
+std::vector<uint8_t> make_test_data(size_t size, uint32_t seed)
+{
+	std::vector<uint8_t> data(size);
+	uint32_t state = seed | 1;
+	for (auto& byte : data)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		byte = static_cast<uint8_t>(state >> 24);
+	}
+	return data;
+}
+
+int main(int argc, char** argv)
+{
+	fixturesDir = argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::path(argv[0]).parent_path() / "fixtures";
+
+	auto& cpu = get_cpu_features();
+	printf("CPU: SSE4.1 %d, PCLMUL %d, AVX2 %d, SHA %d\n", cpu.Sse41, cpu.Pclmul, cpu.Avx2, cpu.Sha);
+
+	size_t failedTests = 0;
+	for (auto& test : get_tests())
+	{
+		size_t failuresBefore = failures;
+		currentTest = test.Name;
+		test.Function();
+		bool passed = failures == failuresBefore;
+		printf("%s %s\n", passed ? "ok    " : "FAILED", test.Name);
+		failedTests += passed ? 0 : 1;
+	}
+
+	printf("%zu tests, %zu failed, %zu failed checks\n", get_tests().size(), failedTests, failures);
+	return static_cast<int>(failures);
+}
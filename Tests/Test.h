@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef void (*TestFunction)();
+
+// Registers a test for main to run, in the order of registration; used through TEST
+bool register_test(const char* name, TestFunction function);
+
+// Counts a failed check and reports it with the test and the CPU path it failed on; used through CHECK
+void report_failure(const char* file, int line, const char* expression);
+
+// The contents of a file in the fixtures directory; a missing fixture fails the test
+std::vector<uint8_t> load_fixture(const char* name);
+
+// Runs check once for every set of CPU features, from all those detected down to SSE2 only, so that
+// every vector path is checked against its fallback. A path the CPU lacks runs as the next lower one.
+void for_each_cpu_path(const std::function<void()>& check);
+
+// Runs check with SSE2 only, i.e. on the fallback paths, e.g. to compute the expected results
+void with_fallback_paths(const std::function<void()>& check);
+
+// Lowercase, two digits per byte
+std::string format_hex(const uint8_t* data, size_t size);
+
+template <size_t N>
+std::string format_hex(const std::array<uint8_t, N>& bytes)
+{
+	return format_hex(bytes.data(), bytes.size());
+}
+
+// The same bytes for the same seed, to build inputs larger than the fixtures
+std::vector<uint8_t> make_test_data(size_t size, uint32_t seed);
+
+#define TEST(name) \
+	static void name(); \
+	static const bool name##Registered = register_test(#name, name); \
+	static void name()
+
+#define CHECK(expression) ((expression) ? static_cast<void>(0) : report_failure(__FILE__, __LINE__, #expression))
@@ -0,0 +1,100 @@
+#include <cstring>
+#include "Test.h"
+#include "Transcode.h"
+
+namespace
+{
+	std::string to_utf8(const std::vector<wchar_t>& in)
+	{
+		std::string out(3 * in.size(), '\0');
+		out.resize(utf16_to_utf8(in.data(), in.size(), &out[0]));
+		return out;
+	}
+
+	std::vector<wchar_t> to_utf16(const std::string& in)
+	{
+		std::vector<wchar_t> out(in.size());
+		out.resize(utf8_to_utf16(in.data(), in.size(), out.data()));
+		return out;
+	}
+
+	std::vector<wchar_t> make_utf16(std::initializer_list<unsigned int> units)
+	{
+		std::vector<wchar_t> out;
+		for (unsigned int unit : units)
+			out.push_back(static_cast<wchar_t>(unit));
+		return out;
+	}
+
+	// Names as an installer has them: long ASCII runs, so that the vector loops run, and some others
+	std::vector<wchar_t> make_name(size_t asciiRun, const std::vector<wchar_t>& other)
+	{
+		std::vector<wchar_t> name;
+		for (size_t i = 0; i < asciiRun; i++)
+			name.push_back(static_cast<wchar_t>('a' + i % 26));
+		name.insert(name.end(), other.begin(), other.end());
+		for (size_t i = 0; i < asciiRun; i++)
+			name.push_back(static_cast<wchar_t>('A' + i % 26));
+		return name;
+	}
+}
+
+TEST(transcode_known_answers)
+{
+	for_each_cpu_path([]()
+	{
+		// U+00E9, U+20AC and U+1F600 as a surrogate pair
+		auto text = make_utf16({ 'R', 0xE9, 's', 0x20AC, 0xD83D, 0xDE00, '.' });
+		const std::string utf8 = "R\xC3\xA9s\xE2\x82\xAC\xF0\x9F\x98\x80.";
+		CHECK(to_utf8(text) == utf8);
+		CHECK(to_utf16(utf8) == text);
+
+		// Unpaired surrogates become U+FFFD
+		CHECK(to_utf8(make_utf16({ 'a', 0xD83D, 'b', 0xDE00 })) == "a\xEF\xBF\xBD" "b\xEF\xBF\xBD");
+
+		// One U+FFFD for every maximal invalid subsequence: a truncated sequence, a stray continuation
+		// byte, an overlong encoding and an encoded surrogate
+		CHECK(to_utf16("\xE2\x82" "a") == make_utf16({ 0xFFFD, 'a' }));
+		CHECK(to_utf16("\x80\xBF") == make_utf16({ 0xFFFD, 0xFFFD }));
+		CHECK(to_utf16("\xC0\xAF") == make_utf16({ 0xFFFD, 0xFFFD }));
+		CHECK(to_utf16("\xED\xA0\x80") == make_utf16({ 0xFFFD, 0xFFFD, 0xFFFD }));
+		CHECK(to_utf16("\xF0\x9F\x98") == make_utf16({ 0xFFFD }));
+	});
+}
+
+// The vector loops stop at the first block with other characters; every position of it must convert the same
+TEST(transcode_paths_match)
+{
+	std::vector<std::vector<wchar_t>> names;
+	for (size_t run : { 0, 1, 7, 8, 15, 16, 17, 31, 32, 33, 64, 100 })
+	{
+		names.push_back(make_name(run, {}));
+		names.push_back(make_name(run, make_utf16({ 0xE9 })));
+		names.push_back(make_name(run, make_utf16({ 0xD83D, 0xDE00, 0x4E2D })));
+		names.push_back(make_name(run, make_utf16({ 0xDC00 })));
+	}
+
+	std::vector<std::string> expected;
+	with_fallback_paths([&]()
+	{
+		for (auto& name : names)
+			expected.push_back(to_utf8(name));
+	});
+
+	for_each_cpu_path([&]()
+	{
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			CHECK(to_utf8(names[i]) == expected[i]);
+			std::vector<wchar_t> back = to_utf16(expected[i]);
+			CHECK(back == to_utf16(to_utf8(back)));
+			if (i % 4 != 3)
+				CHECK(back == names[i]);
+
+			// UTF-8 as a code page (CP_UTF8) takes the same path
+			std::vector<wchar_t> decoded(expected[i].size());
+			decoded.resize(decode_code_page(expected[i].data(), expected[i].size(), 65001, decoded.data()));
+			CHECK(decoded == back);
+		}
+	});
+}
@@ -0,0 +1,32 @@
+#include "Async.h"
+
+EventLoop::EventLoop()
+	: port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1))
+{
+}
+
+EventLoop::~EventLoop()
+{
+	if (port)
+		CloseHandle(port);
+}
+
+void EventLoop::post(AsyncOperation* operation)
+{
+	PostQueuedCompletionStatus(port, 0, 0, operation);
+}
+
+void EventLoop::run_one()
+{
+	DWORD bytes = 0;
+	ULONG_PTR key = 0;
+	OVERLAPPED* overlapped = nullptr;
+	BOOL succeeded = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE);
+	if (!overlapped)
+		return;
+
+	auto operation = static_cast<AsyncOperation*>(overlapped);
+	operation->Bytes = bytes;
+	operation->Error = succeeded ? ERROR_SUCCESS : GetLastError();
+	operation->Handle.resume();
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Cancellation is cooperative: the pipeline checks the token between its awaits and stops there
+class CancellationToken
+{
+public:
+	void cancel() { cancelled = true; }
+	bool is_cancelled() const { return cancelled; }
+
+private:
+	std::atomic<bool> cancelled{ false };
+};
+
+// An overlapped operation of the event loop; completions resume Handle on the loop thread
+struct AsyncOperation : OVERLAPPED
+{
+	std::coroutine_handle<> Handle;
+	DWORD Error;
+	DWORD Bytes;
+};
+
+// A single threaded event loop on an I/O completion port. Coroutines run on the loop thread;
+// blocking work is moved to the Windows thread pool and completes through the port, so no
+// thread waits on a blocking call on behalf of a coroutine.
+class EventLoop
+{
+public:
+	EventLoop();
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+	~EventLoop();
+
+	// Resumes the operation's coroutine on the loop thread (callable from any thread)
+	void post(AsyncOperation* operation);
+
+	// Processes one completion
+	void run_one();
+
+private:
+	HANDLE port;
+};
+
+// A lazily started coroutine producing a T. Awaiting it starts it and resumes the awaiter
+// when it completes; exceptions are rethrown in the awaiter.
+template<typename T>
+class Task
+{
+public:
+	struct promise_type
+	{
+		std::optional<T> Value;
+		std::exception_ptr Exception;
+		std::coroutine_handle<> Continuation;
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				auto continuation = handle.promise().Continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_value(T value) { Value = std::move(value); }
+		void unhandled_exception() { Exception = std::current_exception(); }
+	};
+
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task()
+	{
+		if (handle)
+			handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return handle.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+	{
+		handle.promise().Continuation = continuation;
+		return handle;
+	}
+
+	T await_resume()
+	{
+		if (handle.promise().Exception)
+			std::rethrow_exception(handle.promise().Exception);
+		return std::move(*handle.promise().Value);
+	}
+
+	// Runs the task to completion on the event loop of the calling thread
+	T run(EventLoop& loop)
+	{
+		handle.resume();
+		while (!handle.done())
+			loop.run_one();
+		return await_resume();
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Awaitable that runs a blocking function on the Windows thread pool and resumes the awaiting
+// coroutine on the loop thread with its result
+template<typename F>
+class BlockingAwaiter
+{
+public:
+	typedef std::invoke_result_t<F> Result;
+
+	BlockingAwaiter(EventLoop& loop, F&& work) : loop(loop), work(std::move(work)) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		operation = {};
+		operation.Handle = handle;
+		if (TrySubmitThreadpoolCallback(&BlockingAwaiter::callback, this, NULL))
+			return true;
+
+		// Without the thread pool the work runs inline
+		run_work();
+		return false;
+	}
+
+	Result await_resume()
+	{
+		if (exception)
+			std::rethrow_exception(exception);
+		return std::move(*result);
+	}
+
+private:
+	static VOID CALLBACK callback(PTP_CALLBACK_INSTANCE, PVOID context)
+	{
+		auto awaiter = static_cast<BlockingAwaiter*>(context);
+		awaiter->run_work();
+		awaiter->loop.post(&awaiter->operation);
+	}
+
+	void run_work()
+	{
+		try
+		{
+			result.emplace(work());
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+	}
+
+	EventLoop& loop;
+	F work;
+	AsyncOperation operation = {};
+	std::optional<Result> result;
+	std::exception_ptr exception;
+};
+
+template<typename F>
+BlockingAwaiter<F> run_blocking(EventLoop& loop, F work)
+{
+	return BlockingAwaiter<F>(loop, std::move(work));
+}
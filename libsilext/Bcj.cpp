@@ -0,0 +1,127 @@
+#include "Bcj.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+#include "Cpu.h"
+
+namespace
+{
+	const bool MaskToAllowed[8] = { true, true, true, false, true, false, false, false };
+	const unsigned int MaskToBitNumber[8] = { 0, 1, 2, 2, 3, 3, 3, 3 };
+
+	// The most significant byte of a near call target is almost always 0x00 or 0xFF
+	inline bool is_ms_byte(uint8_t b)
+	{
+		return b == 0x00 || b == 0xFF;
+	}
+
+	size_t find_x86_branch_avx2(const uint8_t* data, size_t pos, size_t end, uint8_t opcodeMask)
+	{
+		const __m256i mask = _mm256_set1_epi8(static_cast<char>(opcodeMask));
+		const __m256i opcode = _mm256_set1_epi8(static_cast<char>(0xE8));
+		for (; end - pos >= 32; pos += 32)
+		{
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+			unsigned long matches = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(block, mask), opcode)));
+			unsigned long index;
+			if (_BitScanForward(&index, matches))
+				return pos + index;
+		}
+		return pos;
+	}
+
+	size_t find_x86_branch_sse2(const uint8_t* data, size_t pos, size_t end, uint8_t opcodeMask)
+	{
+		const __m128i mask = _mm_set1_epi8(static_cast<char>(opcodeMask));
+		const __m128i opcode = _mm_set1_epi8(static_cast<char>(0xE8));
+		for (; end - pos >= 16; pos += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+			unsigned long matches = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(block, mask), opcode)));
+			unsigned long index;
+			if (_BitScanForward(&index, matches))
+				return pos + index;
+		}
+		return pos;
+	}
+}
+
+size_t find_x86_branch(const uint8_t* data, size_t pos, size_t end, bool includeJumps)
+{
+	// E8 and E9 only differ in the lowest bit
+	uint8_t opcodeMask = includeJumps ? 0xFE : 0xFF;
+	if (pos >= end)
+		return end;
+
+	// The vector loops stop at the first match or when less than a full block is left
+	pos = get_cpu_features().Avx2 ? find_x86_branch_avx2(data, pos, end, opcodeMask) : find_x86_branch_sse2(data, pos, end, opcodeMask);
+	for (; pos < end; pos++)
+	{
+		if ((data[pos] & opcodeMask) == 0xE8)
+			return pos;
+	}
+	return end;
+}
+
+void bcj_x86_decode(uint8_t* data, size_t size, uint32_t startOffset)
+{
+	if (size < 5)
+		return;
+
+	// A branch needs its 4 operand bytes; the last 4 bytes are never converted
+	const size_t limit = size - 4;
+	size_t pos = 0;
+	size_t prevPos = static_cast<size_t>(0) - 5; // Treated as if the last branch was 5 bytes before the start
+	uint32_t prevMask = 0;
+	while ((pos = find_x86_branch(data, pos, limit, true)) < limit)
+	{
+		// prevMask records which of the preceding 3 bytes were E8/E9 bytes that were left alone
+		size_t distance = pos - prevPos;
+		prevPos = pos;
+		if (distance > 5)
+		{
+			prevMask = 0;
+		}
+		else
+		{
+			for (size_t i = 0; i < distance; i++)
+			{
+				prevMask &= 0x77;
+				prevMask <<= 1;
+			}
+		}
+
+		uint8_t b = data[pos + 4];
+		if (is_ms_byte(b) && MaskToAllowed[(prevMask >> 1) & 7] && (prevMask >> 1) < 0x10)
+		{
+			uint32_t src = (static_cast<uint32_t>(b) << 24) | (data[pos + 3] << 16) | (data[pos + 2] << 8) | data[pos + 1];
+			uint32_t position = startOffset + static_cast<uint32_t>(pos) + 5;
+			uint32_t dest;
+			for (;;)
+			{
+				dest = src - position;
+				if (prevMask == 0)
+					break;
+
+				unsigned int shift = MaskToBitNumber[prevMask >> 1] * 8;
+				if (!is_ms_byte(static_cast<uint8_t>(dest >> (24 - shift))))
+					break;
+				src = dest ^ ((1u << (32 - shift)) - 1);
+			}
+
+			data[pos + 4] = static_cast<uint8_t>(~(((dest >> 24) & 1) - 1));
+			data[pos + 3] = static_cast<uint8_t>(dest >> 16);
+			data[pos + 2] = static_cast<uint8_t>(dest >> 8);
+			data[pos + 1] = static_cast<uint8_t>(dest);
+			pos += 5;
+			prevMask = 0;
+		}
+		else
+		{
+			pos++;
+			prevMask |= 1;
+			if (is_ms_byte(b))
+				prevMask |= 0x10;
+		}
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Returns the position of the first E8 (call) byte in data[pos, end), also matching E9 (jmp)
+// when includeJumps is set, or end if there is none. The scan runs 32 or 16 bytes at a time,
+// so it serves both the BCJ filter and the E8 translation of LZX.
+size_t find_x86_branch(const uint8_t* data, size_t pos, size_t end, bool includeJumps);
+
+// Reverses the 7z BCJ x86 filter in place, which turned relative call/jmp targets into absolute
+// ones. startOffset is the optional start position property of the filter.
+void bcj_x86_decode(uint8_t* data, size_t size, uint32_t startOffset);
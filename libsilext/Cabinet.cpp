@@ -0,0 +1,403 @@
+#include "Cabinet.h"
+
+#include <windows.h>
+#include <fdi.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include "Cpu.h"
+#include "Lzx.h"
+#include "Mszip.h"
+#include "Transcode.h"
+
+#pragma comment(lib, "cabinet.lib")
+
+namespace
+{
+	const size_t DataHeaderSize = 8; // Of a CFDATA entry, without the reserved area
+
+	// An FDI file handle: either the cabinet in memory, or a file being extracted into Output
+	struct FdiStream
+	{
+		const uint8_t* Data;
+		size_t Size;
+		size_t Pos;
+		std::vector<uint8_t>* Output;
+	};
+
+	FNALLOC(fdi_alloc)
+	{
+		return malloc(cb);
+	}
+
+	FNFREE(fdi_free)
+	{
+		free(pv);
+	}
+
+	// FDI opens the cabinet by name, so the name carries the address of the source stream
+	FNOPEN(fdi_open)
+	{
+		auto source = reinterpret_cast<const FdiStream*>(static_cast<uintptr_t>(std::strtoull(pszFile, nullptr, 16)));
+		if (!source || (oflag & (_O_WRONLY | _O_RDWR)))
+			return -1;
+		return reinterpret_cast<INT_PTR>(new FdiStream{ source->Data, source->Size, 0, nullptr });
+	}
+
+	FNREAD(fdi_read)
+	{
+		auto stream = reinterpret_cast<FdiStream*>(hf);
+		size_t count = std::min<size_t>(cb, stream->Size - std::min(stream->Pos, stream->Size));
+		memcpy(pv, stream->Data + stream->Pos, count);
+		stream->Pos += count;
+		return static_cast<UINT>(count);
+	}
+
+	FNWRITE(fdi_write)
+	{
+		auto stream = reinterpret_cast<FdiStream*>(hf);
+		if (!stream->Output)
+			return static_cast<UINT>(-1);
+		auto bytes = static_cast<const uint8_t*>(pv);
+		stream->Output->insert(stream->Output->end(), bytes, bytes + cb);
+		return cb;
+	}
+
+	FNCLOSE(fdi_close)
+	{
+		delete reinterpret_cast<FdiStream*>(hf);
+		return 0;
+	}
+
+	FNSEEK(fdi_seek)
+	{
+		auto stream = reinterpret_cast<FdiStream*>(hf);
+		long long base = seektype == SEEK_CUR ? static_cast<long long>(stream->Pos) : seektype == SEEK_END ? static_cast<long long>(stream->Size) : 0;
+		if (base + dist < 0)
+			return -1;
+		stream->Pos = static_cast<size_t>(base + dist);
+		return static_cast<long>(stream->Pos);
+	}
+
+	std::wstring decode_cabinet_name(const char* name, USHORT attribs)
+	{
+		UINT codePage = (attribs & _A_NAME_IS_UTF) ? CP_UTF8 : CP_ACP;
+		std::wstring result(strlen(name), L'\0');
+		result.resize(decode_code_page(name, result.size(), codePage, &result[0]));
+		return result;
+	}
+
+	inline uint16_t read_uint16(const uint8_t* p)
+	{
+		return static_cast<uint16_t>(p[0] | (p[1] << 8));
+	}
+
+	inline uint32_t read_uint32(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+	// Counts the files that pass the filter. Returns false if the header is truncated.
+	bool count_cabinet_files(const uint8_t* data, size_t size, const CabinetFilter& filter, size_t& count_out)
+	{
+		CabinetListing listing;
+		if (!list_cab_from_memory(data, size, listing))
+			return false;
+
+		count_out = std::count_if(listing.Files.begin(), listing.Files.end(), [&filter](const CabinetEntry& entry)
+		{
+			return filter(entry.Name);
+		});
+		return true;
+	}
+
+	// Skips a NUL terminated string of the header; false if it runs past the end
+	bool skip_header_string(const uint8_t* data, size_t size, size_t& pos)
+	{
+		if (pos >= size)
+			return false;
+		size_t length = strnlen(reinterpret_cast<const char*>(data + pos), size - pos);
+		if (length == size - pos)
+			return false;
+		pos += length + 1;
+		return true;
+	}
+
+	// The CFDATA checksum XORs the data as little-endian 32-bit words, so whole blocks of words are
+	// folded into one vector and then into a single word. Each returns how many bytes it consumed.
+	size_t xor_words_avx2(const uint8_t* data, size_t size, uint32_t& sum)
+	{
+		__m256i folded = _mm256_setzero_si256();
+		size_t pos = 0;
+		for (; size - pos >= 32; pos += 32)
+			folded = _mm256_xor_si256(folded, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos)));
+
+		__m128i half = _mm_xor_si128(_mm256_castsi256_si128(folded), _mm256_extracti128_si256(folded, 1));
+		half = _mm_xor_si128(half, _mm_srli_si128(half, 8));
+		half = _mm_xor_si128(half, _mm_srli_si128(half, 4));
+		sum ^= static_cast<uint32_t>(_mm_cvtsi128_si32(half));
+		return pos;
+	}
+
+	size_t xor_words_sse2(const uint8_t* data, size_t size, uint32_t& sum)
+	{
+		__m128i folded = _mm_setzero_si128();
+		size_t pos = 0;
+		for (; size - pos >= 16; pos += 16)
+			folded = _mm_xor_si128(folded, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos)));
+
+		folded = _mm_xor_si128(folded, _mm_srli_si128(folded, 8));
+		folded = _mm_xor_si128(folded, _mm_srli_si128(folded, 4));
+		sum ^= static_cast<uint32_t>(_mm_cvtsi128_si32(folded));
+		return pos;
+	}
+
+	// The trailing bytes that do not fill a word are taken most significant first
+	uint32_t cab_checksum(const uint8_t* data, size_t size, uint32_t sum)
+	{
+		size_t pos = get_cpu_features().Avx2 ? xor_words_avx2(data, size, sum) : 0;
+		pos += xor_words_sse2(data + pos, size - pos, sum);
+		for (; size - pos >= 4; pos += 4)
+			sum ^= read_uint32(data + pos);
+
+		uint32_t tail = 0;
+		for (; pos < size; pos++)
+			tail = (tail << 8) | data[pos];
+		return sum ^ tail;
+	}
+
+	// tcompTYPE_NONE, the blocks hold the data as is
+	class StoredDecoder : public FolderDecoder
+	{
+	public:
+		bool decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) override
+		{
+			if (inSize != outSize)
+				return false;
+			memcpy(out, in, outSize);
+			return true;
+		}
+
+		void save_state(std::vector<uint8_t>& state_out) const override
+		{
+			state_out.clear();
+		}
+
+		bool restore_state(const uint8_t*, size_t size) override
+		{
+			return size == 0;
+		}
+	};
+
+	struct FdiContext
+	{
+		const CabinetFilter& Filter;
+		const CabinetSink& Sink;
+		CabinetFile Current;
+		size_t Remaining;
+	};
+
+	FNFDINOTIFY(fdi_notify)
+	{
+		auto context = static_cast<FdiContext*>(pfdin->pv);
+		switch (fdint)
+		{
+		case fdintCOPY_FILE:
+		{
+			// Files that are not needed are skipped; once nothing is left the rest of the cabinet
+			// is not decoded at all
+			if (context->Remaining == 0)
+				return -1;
+
+			auto name = decode_cabinet_name(pfdin->psz1, pfdin->attribs);
+			if (!context->Filter(name))
+				return 0;
+
+			// FDI extracts one file at a time, so there is only ever one file being written
+			context->Current = { name, {}, pfdin->date, pfdin->time, pfdin->attribs };
+			context->Current.Data.reserve(static_cast<size_t>(pfdin->cb));
+			return reinterpret_cast<INT_PTR>(new FdiStream{ nullptr, 0, 0, &context->Current.Data });
+		}
+		case fdintCLOSE_FILE_INFO:
+			fdi_close(pfdin->hf);
+			if (!context->Sink(std::move(context->Current)))
+				return FALSE;
+			context->Remaining--;
+			return TRUE;
+		case fdintNEXT_CABINET:
+			return -1;
+		default:
+			return 0;
+		}
+	}
+}
+
+bool list_cab_from_memory(const uint8_t* data, size_t size, CabinetListing& listing_out)
+{
+	const size_t CabinetHeaderSize = 36;
+	const size_t FolderEntrySize = 8;
+	const size_t FileEntrySize = 16;
+	const uint16_t FlagPrevCabinet = 0x0001;
+	const uint16_t FlagNextCabinet = 0x0002;
+	const uint16_t FlagReservePresent = 0x0004;
+	if (size < CabinetHeaderSize || memcmp(data, "MSCF", 4) != 0)
+		return false;
+
+	uint16_t numFolders = read_uint16(data + 26);
+	uint16_t numFiles = read_uint16(data + 28);
+	uint16_t flags = read_uint16(data + 30);
+
+	// The optional reserved areas and the names of the neighbouring cabinets precede the folders
+	size_t pos = CabinetHeaderSize;
+	size_t folderReserve = 0;
+	listing_out.DataReserve = 0;
+	if (flags & FlagReservePresent)
+	{
+		if (size - pos < 4)
+			return false;
+		size_t headerReserve = read_uint16(data + pos);
+		folderReserve = data[pos + 2];
+		listing_out.DataReserve = data[pos + 3];
+		pos += 4 + headerReserve;
+	}
+	for (int i = 0; i < ((flags & FlagPrevCabinet) ? 2 : 0) + ((flags & FlagNextCabinet) ? 2 : 0); i++)
+	{
+		if (!skip_header_string(data, size, pos))
+			return false;
+	}
+
+	listing_out.Folders.clear();
+	for (uint16_t i = 0; i < numFolders; i++)
+	{
+		if (pos > size || size - pos < FolderEntrySize + folderReserve)
+			return false;
+		listing_out.Folders.push_back({ read_uint32(data + pos), read_uint16(data + pos + 4), read_uint16(data + pos + 6) });
+		pos += FolderEntrySize + folderReserve;
+	}
+
+	listing_out.Files.clear();
+	pos = read_uint32(data + 16);
+	for (uint16_t i = 0; i < numFiles; i++)
+	{
+		if (pos > size || size - pos <= FileEntrySize)
+			return false;
+
+		const uint8_t* entry = data + pos;
+		const char* name = reinterpret_cast<const char*>(entry + FileEntrySize);
+		size_t nameLength = strnlen(name, size - pos - FileEntrySize);
+		if (nameLength == size - pos - FileEntrySize)
+			return false;
+
+		uint16_t attributes = read_uint16(entry + 14);
+		listing_out.Files.push_back({ decode_cabinet_name(name, attributes), read_uint32(entry), read_uint32(entry + 4),
+			read_uint16(entry + 8), read_uint16(entry + 10), read_uint16(entry + 12), attributes });
+		pos += FileEntrySize + nameLength + 1;
+	}
+	return true;
+}
+
+bool read_cab_data_block(const uint8_t* data, size_t size, size_t dataReserve, size_t& offset, CabinetDataBlock& block_out)
+{
+	if (offset > size || size - offset < DataHeaderSize + dataReserve)
+		return false;
+
+	const uint8_t* header = data + offset;
+	block_out = { header, header + DataHeaderSize + dataReserve, read_uint16(header + 4), read_uint16(header + 6) };
+	if (size - offset - DataHeaderSize - dataReserve < block_out.Size)
+		return false;
+
+	offset += DataHeaderSize + dataReserve + block_out.Size;
+	return true;
+}
+
+bool verify_cab_data_block(const CabinetDataBlock& block, bool includeReserve)
+{
+	uint32_t checksum = read_uint32(block.Header);
+	if (!checksum)
+		return true;
+
+	// The sizes are checksummed last, after the reserved area and the data
+	const uint8_t* start = includeReserve ? block.Header + DataHeaderSize : block.Data;
+	return cab_checksum(block.Header + 4, 4, cab_checksum(start, block.Data + block.Size - start, 0)) == checksum;
+}
+
+bool BlockVerifier::verify(const CabinetDataBlock& block)
+{
+	auto start = std::chrono::steady_clock::now();
+	int settled = reserveChecksum.load();
+	bool verified;
+	if (settled != Unknown)
+		verified = verify_cab_data_block(block, settled == Included);
+	else if (!read_uint32(block.Header) || block.Data == block.Header + DataHeaderSize)
+		verified = verify_cab_data_block(block, true); // Either way alike, so this block does not tell
+	else
+	{
+		// Another thread may settle it first, in which case this block must match that
+		int found = verify_cab_data_block(block, true) ? Included : verify_cab_data_block(block, false) ? Excluded : Unknown;
+		if (found != Unknown && !reserveChecksum.compare_exchange_strong(settled, found))
+			found = verify_cab_data_block(block, settled == Included) ? settled : Unknown;
+		verified = found != Unknown;
+	}
+	time += (std::chrono::steady_clock::now() - start).count();
+	return verified;
+}
+
+std::chrono::steady_clock::duration BlockVerifier::get_time() const
+{
+	return std::chrono::steady_clock::duration(time.load());
+}
+
+std::unique_ptr<FolderDecoder> create_folder_decoder(uint16_t compressionType)
+{
+	switch (compressionType & tcompMASK_TYPE)
+	{
+	case tcompTYPE_NONE:
+		return std::make_unique<StoredDecoder>();
+	case tcompTYPE_MSZIP:
+		return std::make_unique<MszipDecoder>();
+	case tcompTYPE_LZX:
+	{
+		unsigned int window = compressionType & tcompMASK_LZX_WINDOW;
+		if (window < tcompLZX_WINDOW_LO || window > tcompLZX_WINDOW_HI)
+			return nullptr;
+		return std::make_unique<LzxDecoder>(window >> tcompSHIFT_LZX_WINDOW);
+	}
+	default:
+		return nullptr;
+	}
+}
+
+bool extract_cab_from_memory(const uint8_t* data, size_t size, const CabinetFilter& filter, const CabinetSink& sink)
+{
+	FdiContext context = { filter, sink, {}, 0 };
+	if (!count_cabinet_files(data, size, filter, context.Remaining))
+		return false;
+
+	ERF erf = {};
+	HFDI hfdi = FDICreate(fdi_alloc, fdi_free, fdi_open, fdi_read, fdi_write, fdi_close, fdi_seek, cpu80386, &erf);
+	if (!hfdi)
+		return false;
+
+	FdiStream source = { data, size, 0, nullptr };
+	char cabinetName[2 * sizeof(uintptr_t) + 1];
+	snprintf(cabinetName, sizeof(cabinetName), "%llx", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(&source)));
+	char cabinetPath[] = "";
+
+	bool result = FDICopy(hfdi, cabinetName, cabinetPath, 0, fdi_notify, nullptr, &context) == TRUE;
+	FDIDestroy(hfdi);
+
+	// Stopping early is reported as a user abort
+	return result || (erf.erfOper == FDIERROR_USER_ABORT && context.Remaining == 0);
+}
+
+bool extract_cab_from_memory(const uint8_t* data, size_t size, const CabinetFilter& filter, std::vector<CabinetFile>& files_out)
+{
+	return extract_cab_from_memory(data, size, filter, [&files_out](CabinetFile&& file)
+	{
+		files_out.push_back(std::move(file));
+		return true;
+	});
+}
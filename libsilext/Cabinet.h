@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct CabinetFile
+{
+	std::wstring Name;
+	std::vector<uint8_t> Data;
+	uint16_t Date; // MS-DOS date and time, local time
+	uint16_t Time;
+	uint16_t Attributes;
+};
+
+struct CabinetFolder
+{
+	uint32_t DataOffset; // Of the first CFDATA block
+	uint16_t DataBlocks;
+	uint16_t CompressionType; // tcompTYPE_*, with the window size in the high byte for LZX/Quantum
+};
+
+struct CabinetEntry
+{
+	std::wstring Name;
+	uint32_t Size;
+	uint32_t FolderOffset; // In the uncompressed data of the folder
+	uint16_t Folder; // Index into Folders, or one of the ifoldCONTINUED_* values
+	uint16_t Date;
+	uint16_t Time;
+	uint16_t Attributes;
+};
+
+struct CabinetListing
+{
+	std::vector<CabinetFolder> Folders;
+	std::vector<CabinetEntry> Files;
+	size_t DataReserve = 0; // Of every CFDATA block
+};
+
+struct CabinetDataBlock
+{
+	const uint8_t* Header; // The CFDATA entry, starting with its checksum
+	const uint8_t* Data;
+	uint16_t Size;
+	uint16_t UncompressedSize;
+};
+
+// Reads the CFFOLDER and CFFILE entries of a cabinet held in memory, without decoding any data.
+// Returns false if the header is invalid or truncated.
+bool list_cab_from_memory(const uint8_t* data, size_t size, CabinetListing& listing_out);
+
+// Reads the CFDATA block at offset and advances offset to the next one; false if it is truncated
+bool read_cab_data_block(const uint8_t* data, size_t size, size_t dataReserve, size_t& offset, CabinetDataBlock& block_out);
+
+// Whether the checksum of a block matches its sizes and data, with the reserved area in front of the
+// data if includeReserve; a block with a checksum of 0 has none. The format checksums the reserved
+// area, but some writers leave it out, so which one a cabinet uses is only known from its blocks.
+bool verify_cab_data_block(const CabinetDataBlock& block, bool includeReserve);
+
+// Verifies the blocks the native decoders decode, each right before decoding it while it is in cache.
+// One verifier is shared by all threads of an extraction of one cabinet and sums up the time the checks
+// take. The first block with a checksum and a reserved area settles whether the reserved area is
+// checksummed, and every other block of the cabinet must then match the same way.
+class BlockVerifier
+{
+public:
+	bool verify(const CabinetDataBlock& block);
+
+	std::chrono::steady_clock::duration get_time() const;
+
+private:
+	enum ReserveChecksum { Unknown, Included, Excluded };
+
+	std::atomic<std::chrono::steady_clock::rep> time{ 0 };
+	std::atomic<int> reserveChecksum{ Unknown };
+};
+
+// Decodes the CFDATA blocks of one folder in order, each into exactly its uncompressed size. The
+// state between two blocks can be saved and restored, so that decoding can resume at any block.
+class FolderDecoder
+{
+public:
+	virtual ~FolderDecoder() = default;
+
+	virtual bool decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) = 0;
+	virtual void save_state(std::vector<uint8_t>& state_out) const = 0;
+	virtual bool restore_state(const uint8_t* state, size_t size) = 0;
+};
+
+// A decoder at the start of a folder with the given compression type (CabinetFolder), or nullptr
+// for Quantum and unknown types
+std::unique_ptr<FolderDecoder> create_folder_decoder(uint16_t compressionType);
+
+typedef std::function<bool(const std::wstring& name)> CabinetFilter;
+
+// Receives every file as soon as it is complete; returning false aborts the extraction
+typedef std::function<bool(CabinetFile&& file)> CabinetSink;
+
+// Extracts the files of a cabinet held in memory (e.g. a range of a mapped setup EXE) for which
+// filter returns true into memory. FDI is driven through memory-backed I/O callbacks, so the
+// cabinet is read in place. FDI only decompresses a folder up to the last matching file in it and
+// skips folders without matching files entirely; decoding stops once the last matching file is complete.
+bool extract_cab_from_memory(const uint8_t* data, size_t size, const CabinetFilter& filter, const CabinetSink& sink);
+
+bool extract_cab_from_memory(const uint8_t* data, size_t size, const CabinetFilter& filter, std::vector<CabinetFile>& files_out);
@@ -0,0 +1,263 @@
+#include "CabinetIndex.h"
+
+#include <windows.h>
+#include <fdi.h>
+#include <algorithm>
+#include <cstring>
+#include "Util.h"
+
+namespace
+{
+	const char IndexMagic[4] = { 'S', 'L', 'X', 'I' };
+	const uint32_t IndexVersion = 1;
+	const size_t DataHeaderSize = 8;
+
+	// The header up to the first CFDATA block, and the CFDATA headers with their checksums and
+	// sizes; the compressed data itself is not read
+	bool hash_cabinet(const uint8_t* data, size_t size, const CabinetListing& listing, uint64_t& hash_out)
+	{
+		size_t headerEnd = size;
+		for (auto& folder : listing.Folders)
+			headerEnd = std::min<size_t>(headerEnd, folder.DataOffset);
+
+		uint64_t hash = fnv1a(data, headerEnd);
+		for (auto& folder : listing.Folders)
+		{
+			size_t offset = folder.DataOffset;
+			for (uint16_t i = 0; i < folder.DataBlocks; i++)
+			{
+				const uint8_t* header = data + offset;
+				CabinetDataBlock block;
+				if (!read_cab_data_block(data, size, listing.DataReserve, offset, block))
+					return false;
+				hash = fnv1a(header, DataHeaderSize, hash);
+			}
+		}
+		hash_out = hash;
+		return true;
+	}
+
+	size_t get_window_size(uint16_t compressionType)
+	{
+		switch (compressionType & tcompMASK_TYPE)
+		{
+		case tcompTYPE_MSZIP:
+			return 32768;
+		case tcompTYPE_LZX:
+			return static_cast<size_t>(1) << ((compressionType & tcompMASK_LZX_WINDOW) >> tcompSHIFT_LZX_WINDOW);
+		default:
+			return 0;
+		}
+	}
+
+	// Where decoding stands inside a folder, with the output of the last decoded block
+	struct FolderCursor
+	{
+		size_t Folder = SIZE_MAX;
+		std::unique_ptr<FolderDecoder> Decoder;
+		uint16_t NextBlock = 0;
+		size_t NextDataOffset = 0;
+		uint64_t NextOffset = 0;
+		std::vector<uint8_t> Output;
+		uint64_t OutputOffset = 0;
+	};
+}
+
+bool build_cabinet_index(const uint8_t* data, size_t size, uint32_t interval, BlockVerifier* verifier, CabinetIndex& index_out)
+{
+	CabinetListing listing;
+	if (!list_cab_from_memory(data, size, listing) || !hash_cabinet(data, size, listing, index_out.CabinetHash))
+		return false;
+
+	index_out.CabinetSize = size;
+	index_out.Folders.assign(listing.Folders.size(), {});
+	std::vector<uint8_t> output;
+	for (size_t i = 0; i < listing.Folders.size(); i++)
+	{
+		const CabinetFolder& folder = listing.Folders[i];
+		auto decoder = create_folder_decoder(folder.CompressionType);
+		if (!decoder)
+			return false;
+
+		const uint64_t spacing = std::max<uint64_t>(interval, 2 * get_window_size(folder.CompressionType));
+		size_t dataOffset = folder.DataOffset;
+		uint64_t offset = 0;
+		uint64_t lastCheckpoint = 0;
+		for (uint16_t block = 0; block < folder.DataBlocks; block++)
+		{
+			if (offset - lastCheckpoint >= spacing)
+			{
+				CabinetCheckpoint checkpoint = { static_cast<uint32_t>(offset), static_cast<uint32_t>(dataOffset), block, {} };
+				decoder->save_state(checkpoint.State);
+				index_out.Folders[i].push_back(std::move(checkpoint));
+				lastCheckpoint = offset;
+			}
+
+			CabinetDataBlock dataBlock;
+			if (!read_cab_data_block(data, size, listing.DataReserve, dataOffset, dataBlock) || (verifier && !verifier->verify(dataBlock)))
+				return false;
+			output.resize(dataBlock.UncompressedSize);
+			if (!decoder->decode_block(dataBlock.Data, dataBlock.Size, output.data(), output.size()))
+				return false;
+			offset += dataBlock.UncompressedSize;
+		}
+	}
+	return true;
+}
+
+bool save_cabinet_index(const std::wstring& path, const CabinetIndex& index)
+{
+	std::vector<uint8_t> out;
+	append_value(out, IndexMagic);
+	append_value(out, IndexVersion);
+	append_value(out, index.CabinetSize);
+	append_value(out, index.CabinetHash);
+	append_value(out, static_cast<uint32_t>(index.Folders.size()));
+	for (auto& checkpoints : index.Folders)
+	{
+		append_value(out, static_cast<uint32_t>(checkpoints.size()));
+		for (auto& checkpoint : checkpoints)
+		{
+			append_value(out, checkpoint.Offset);
+			append_value(out, checkpoint.DataOffset);
+			append_value(out, checkpoint.Block);
+			append_value(out, static_cast<uint32_t>(checkpoint.State.size()));
+			out.insert(out.end(), checkpoint.State.begin(), checkpoint.State.end());
+		}
+	}
+	return write_file(path, out.data(), out.size());
+}
+
+bool load_cabinet_index(const std::wstring& path, const uint8_t* data, size_t size, CabinetIndex& index_out)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	const uint8_t* p = file.get_data();
+	const uint8_t* end = p + file.get_size();
+	char magic[4];
+	uint32_t version;
+	uint32_t numFolders;
+	if (!read_value(p, end, magic) || memcmp(magic, IndexMagic, sizeof(magic)) != 0 || !read_value(p, end, version) || version != IndexVersion
+		|| !read_value(p, end, index_out.CabinetSize) || !read_value(p, end, index_out.CabinetHash) || !read_value(p, end, numFolders))
+		return false;
+
+	CabinetListing listing;
+	uint64_t hash;
+	if (index_out.CabinetSize != size || !list_cab_from_memory(data, size, listing) || !hash_cabinet(data, size, listing, hash)
+		|| hash != index_out.CabinetHash || numFolders != listing.Folders.size())
+		return false;
+
+	index_out.Folders.assign(numFolders, {});
+	for (auto& checkpoints : index_out.Folders)
+	{
+		uint32_t numCheckpoints;
+		if (!read_value(p, end, numCheckpoints))
+			return false;
+
+		for (uint32_t i = 0; i < numCheckpoints; i++)
+		{
+			CabinetCheckpoint checkpoint;
+			uint32_t stateSize;
+			if (!read_value(p, end, checkpoint.Offset) || !read_value(p, end, checkpoint.DataOffset) || !read_value(p, end, checkpoint.Block)
+				|| !read_value(p, end, stateSize) || static_cast<size_t>(end - p) < stateSize)
+				return false;
+			checkpoint.State.assign(p, p + stateSize);
+			p += stateSize;
+			checkpoints.push_back(std::move(checkpoint));
+		}
+	}
+	return p == end;
+}
+
+bool extract_cab_indexed(const uint8_t* data, size_t size, const CabinetIndex& index, BlockVerifier* verifier, const CabinetFilter& filter, const CabinetSink& sink)
+{
+	CabinetListing listing;
+	if (!list_cab_from_memory(data, size, listing) || index.Folders.size() != listing.Folders.size())
+		return false;
+
+	FolderCursor cursor;
+	for (auto& entry : listing.Files)
+	{
+		if (!filter(entry.Name))
+			continue;
+		if (entry.Folder >= listing.Folders.size())
+			return false;
+
+		const CabinetFolder& folder = listing.Folders[entry.Folder];
+		const uint64_t begin = entry.FolderOffset;
+		const uint64_t end = begin + entry.Size;
+		CabinetFile file = { entry.Name, {}, entry.Date, entry.Time, entry.Attributes };
+		file.Data.reserve(entry.Size);
+
+		if (entry.Size)
+		{
+			// The last checkpoint at or before the file, unless the cursor is already past it
+			auto& checkpoints = index.Folders[entry.Folder];
+			auto next = std::upper_bound(checkpoints.begin(), checkpoints.end(), begin, [](uint64_t offset, const CabinetCheckpoint& checkpoint)
+			{
+				return offset < checkpoint.Offset;
+			});
+			const CabinetCheckpoint* checkpoint = next == checkpoints.begin() ? nullptr : &*(next - 1);
+			uint64_t start = checkpoint ? checkpoint->Offset : 0;
+
+			if (cursor.Folder != entry.Folder || cursor.OutputOffset > begin || cursor.NextOffset < start)
+			{
+				cursor.Folder = entry.Folder;
+				cursor.Decoder = create_folder_decoder(folder.CompressionType);
+				if (!cursor.Decoder || (checkpoint && !cursor.Decoder->restore_state(checkpoint->State.data(), checkpoint->State.size())))
+					return false;
+				cursor.NextBlock = checkpoint ? checkpoint->Block : 0;
+				cursor.NextDataOffset = checkpoint ? checkpoint->DataOffset : folder.DataOffset;
+				cursor.NextOffset = cursor.OutputOffset = start;
+				cursor.Output.clear();
+			}
+
+			while (file.Data.size() < entry.Size)
+			{
+				uint64_t pos = begin + file.Data.size();
+				uint64_t outputEnd = cursor.OutputOffset + cursor.Output.size();
+				if (pos >= cursor.OutputOffset && pos < outputEnd)
+				{
+					auto first = cursor.Output.begin() + static_cast<size_t>(pos - cursor.OutputOffset);
+					file.Data.insert(file.Data.end(), first, first + static_cast<size_t>(std::min(end, outputEnd) - pos));
+					continue;
+				}
+
+				CabinetDataBlock dataBlock;
+				if (cursor.NextBlock >= folder.DataBlocks || !read_cab_data_block(data, size, listing.DataReserve, cursor.NextDataOffset, dataBlock)
+					|| (verifier && !verifier->verify(dataBlock)))
+					return false;
+				cursor.Output.resize(dataBlock.UncompressedSize);
+				if (!cursor.Decoder->decode_block(dataBlock.Data, dataBlock.Size, cursor.Output.data(), cursor.Output.size()))
+					return false;
+				cursor.OutputOffset = cursor.NextOffset;
+				cursor.NextOffset += dataBlock.UncompressedSize;
+				cursor.NextBlock++;
+			}
+		}
+
+		if (!sink(std::move(file)))
+			return false;
+	}
+	return true;
+}
+
+bool extract_cab_native(const uint8_t* data, size_t size, BlockVerifier* verifier, const CabinetFilter& filter, const CabinetSink& sink)
+{
+	CabinetListing listing;
+	if (!list_cab_from_memory(data, size, listing))
+		return false;
+
+	bool native = std::all_of(listing.Folders.begin(), listing.Folders.end(), [](const CabinetFolder& folder)
+	{
+		return create_folder_decoder(folder.CompressionType) != nullptr;
+	});
+	if (!native)
+		return extract_cab_from_memory(data, size, filter, sink);
+
+	// An index without checkpoints
+	CabinetIndex index = { size, 0, std::vector<std::vector<CabinetCheckpoint>>(listing.Folders.size()) };
+	return extract_cab_indexed(data, size, index, verifier, filter, sink);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Cabinet.h"
+
+// The decoder state at the start of a CFDATA block inside a folder
+struct CabinetCheckpoint
+{
+	uint32_t Offset; // In the uncompressed data of the folder
+	uint32_t DataOffset; // Of the CFDATA block in the cabinet
+	uint16_t Block;
+	std::vector<uint8_t> State;
+};
+
+// A random-access index of a cabinet: checkpoints at intervals inside every folder, so that a single
+// file is decoded from the nearest checkpoint before it instead of from the start of its folder.
+struct CabinetIndex
+{
+	uint64_t CabinetSize;
+	uint64_t CabinetHash; // Of the header and the CFDATA headers, to detect a different cabinet
+	std::vector<std::vector<CabinetCheckpoint>> Folders;
+};
+
+const uint32_t DefaultCheckpointInterval = 1024 * 1024;
+
+// Decodes every folder once with the native decoders (MSZIP and LZX). A checkpoint is taken at the
+// first block after every interval bytes, and no closer than twice the window, which is most of the
+// state. Every block is checked with verifier first, unless it is null. Returns false for Quantum and
+// for invalid data.
+bool build_cabinet_index(const uint8_t* data, size_t size, uint32_t interval, BlockVerifier* verifier, CabinetIndex& index_out);
+
+bool save_cabinet_index(const std::wstring& path, const CabinetIndex& index);
+
+// Returns false if the index is missing, invalid or was built for another cabinet
+bool load_cabinet_index(const std::wstring& path, const uint8_t* data, size_t size, CabinetIndex& index_out);
+
+// Extracts the files for which filter returns true, in cabinet order. Every file is decoded from the
+// nearest checkpoint before it, or from where the previous file ended if that is closer. The blocks are
+// checked with verifier before they are decoded, unless it is null.
+bool extract_cab_indexed(const uint8_t* data, size_t size, const CabinetIndex& index, BlockVerifier* verifier, const CabinetFilter& filter, const CabinetSink& sink);
+
+// Extracts like extract_cab_indexed without an index: every folder is decoded from its start, and only
+// up to the last file taken from it. A cabinet with a folder the native decoders do not decode (Quantum)
+// is extracted by FDI instead, whose blocks are not checked with verifier.
+bool extract_cab_native(const uint8_t* data, size_t size, BlockVerifier* verifier, const CabinetFilter& filter, const CabinetSink& sink);
@@ -0,0 +1,145 @@
+#include "CabinetReader.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	uint32_t get_block_key(uint16_t folder, uint16_t block)
+	{
+		return (static_cast<uint32_t>(folder) << 16) | block;
+	}
+}
+
+bool CabinetReader::open(const uint8_t* data, size_t size, CabinetIndex&& index, size_t cacheBytes, BlockVerifier* verifier)
+{
+	this->data = data;
+	this->size = size;
+	this->index = std::move(index);
+	this->cacheBytes = cacheBytes;
+	this->verifier = verifier;
+	if (!list_cab_from_memory(data, size, listing) || this->index.Folders.size() != listing.Folders.size())
+		return false;
+
+	folders = std::vector<FolderState>(listing.Folders.size());
+	for (size_t i = 0; i < listing.Folders.size(); i++)
+	{
+		auto& blocks = folders[i].Blocks;
+		size_t dataOffset = listing.Folders[i].DataOffset;
+		uint64_t offset = 0;
+		for (uint16_t block = 0; block < listing.Folders[i].DataBlocks; block++)
+		{
+			blocks.push_back({ offset, dataOffset });
+			CabinetDataBlock dataBlock;
+			if (!read_cab_data_block(data, size, listing.DataReserve, dataOffset, dataBlock))
+				return false;
+			offset += dataBlock.UncompressedSize;
+		}
+		blocks.push_back({ offset, dataOffset });
+	}
+	return true;
+}
+
+bool CabinetReader::read(uint16_t folder, uint64_t offset, uint8_t* out, size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (folder >= folders.size() || offset + size > folders[folder].Blocks.back().Offset)
+		return false;
+
+	auto& blocks = folders[folder].Blocks;
+	auto next = std::upper_bound(blocks.begin(), blocks.end(), offset, [](uint64_t offset, const BlockInfo& block)
+	{
+		return offset < block.Offset;
+	});
+	auto block = static_cast<uint16_t>(next - blocks.begin() - 1);
+	while (size)
+	{
+		const std::vector<uint8_t>* output = get_block(folder, block);
+		if (!output)
+			return false;
+
+		size_t start = static_cast<size_t>(offset - blocks[block].Offset);
+		size_t count = std::min(size, output->size() - start);
+		memcpy(out, output->data() + start, count);
+		out += count;
+		offset += count;
+		size -= count;
+		block++;
+	}
+	return true;
+}
+
+// The returned block stays valid until the next call, which may evict it
+const std::vector<uint8_t>* CabinetReader::get_block(uint16_t folder, uint16_t block)
+{
+	auto cached = cache.find(get_block_key(folder, block));
+	if (cached != cache.end())
+	{
+		lru.splice(lru.begin(), lru, cached->second.Position);
+		return &cached->second.Data;
+	}
+
+	// Restart from the last checkpoint at or before the block, unless the decoder is between the two
+	FolderState& state = folders[folder];
+	auto& checkpoints = index.Folders[folder];
+	auto next = std::upper_bound(checkpoints.begin(), checkpoints.end(), block, [](uint16_t block, const CabinetCheckpoint& checkpoint)
+	{
+		return block < checkpoint.Block;
+	});
+	const CabinetCheckpoint* checkpoint = next == checkpoints.begin() ? nullptr : &*(next - 1);
+	uint16_t start = checkpoint ? checkpoint->Block : 0;
+
+	if (!state.Decoder || state.NextBlock > block || state.NextBlock < start)
+	{
+		state.Decoder = create_folder_decoder(listing.Folders[folder].CompressionType);
+		if (!state.Decoder || (checkpoint && !state.Decoder->restore_state(checkpoint->State.data(), checkpoint->State.size())))
+		{
+			state.Decoder.reset();
+			return nullptr;
+		}
+		state.NextBlock = start;
+	}
+
+	// The blocks decoded on the way are cached as well, as reads tend to be sequential
+	for (; state.NextBlock <= block; state.NextBlock++)
+	{
+		size_t dataOffset = state.Blocks[state.NextBlock].DataOffset;
+		CabinetDataBlock dataBlock;
+		std::vector<uint8_t> output;
+		if (read_cab_data_block(data, size, listing.DataReserve, dataOffset, dataBlock) && (!verifier || verifier->verify(dataBlock)))
+		{
+			output.resize(dataBlock.UncompressedSize);
+			if (state.Decoder->decode_block(dataBlock.Data, dataBlock.Size, output.data(), output.size()))
+			{
+				insert_block(get_block_key(folder, state.NextBlock), std::move(output));
+				continue;
+			}
+		}
+		state.Decoder.reset();
+		return nullptr;
+	}
+	return &cache[get_block_key(folder, block)].Data;
+}
+
+void CabinetReader::insert_block(uint32_t key, std::vector<uint8_t>&& data)
+{
+	auto cached = cache.find(key);
+	if (cached != cache.end())
+	{
+		lru.splice(lru.begin(), lru, cached->second.Position);
+		return;
+	}
+
+	cachedBytes += data.size();
+	lru.push_front(key);
+	cache[key] = { std::move(data), lru.begin() };
+
+	// The block just inserted always stays, even if it is larger than the cache
+	while (cachedBytes > cacheBytes && lru.size() > 1)
+	{
+		auto evicted = cache.find(lru.back());
+		cachedBytes -= evicted->second.Data.size();
+		cache.erase(evicted);
+		lru.pop_back();
+	}
+}
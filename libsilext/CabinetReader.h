@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "Cabinet.h"
+#include "CabinetIndex.h"
+
+// Random-access reads from the folders of an indexed cabinet, e.g. to serve its files on demand.
+// Decoded CFDATA blocks are kept in an LRU cache shared by all files, so reads close together decode
+// every block once. A block that is not cached is decoded from the nearest checkpoint before it, or
+// from where its folder was last decoded if that is closer. Reads from several threads are serialized.
+class CabinetReader
+{
+public:
+	// Only walks the CFDATA headers; the cabinet data must outlive the reader. Blocks are checked with
+	// verifier before they are decoded, unless it is null, which must then outlive the reader as well.
+	bool open(const uint8_t* data, size_t size, CabinetIndex&& index, size_t cacheBytes, BlockVerifier* verifier);
+
+	const CabinetListing& get_listing() const { return listing; }
+
+	// Reads size bytes at offset in the uncompressed data of folder; false if out of range or invalid
+	bool read(uint16_t folder, uint64_t offset, uint8_t* out, size_t size);
+
+private:
+	struct BlockInfo
+	{
+		uint64_t Offset; // In the uncompressed data of the folder
+		size_t DataOffset; // Of the CFDATA block in the cabinet
+	};
+
+	// The blocks end with one past the last, at the size of the folder
+	struct FolderState
+	{
+		std::vector<BlockInfo> Blocks;
+		std::unique_ptr<FolderDecoder> Decoder;
+		uint16_t NextBlock = 0;
+	};
+
+	typedef std::list<uint32_t> LruList;
+
+	struct CachedBlock
+	{
+		std::vector<uint8_t> Data;
+		LruList::iterator Position;
+	};
+
+	const std::vector<uint8_t>* get_block(uint16_t folder, uint16_t block);
+	void insert_block(uint32_t key, std::vector<uint8_t>&& data);
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	CabinetListing listing;
+	CabinetIndex index;
+	std::vector<FolderState> folders;
+	BlockVerifier* verifier = nullptr;
+
+	size_t cacheBytes = 0;
+	size_t cachedBytes = 0;
+	LruList lru; // Most recently used first
+	std::unordered_map<uint32_t, CachedBlock> cache;
+	std::mutex mutex;
+};
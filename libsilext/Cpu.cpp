@@ -0,0 +1,55 @@
+#include "Cpu.h"
+
+#include <intrin.h>
+
+namespace
+{
+	CpuFeatures detect_cpu_features()
+	{
+		CpuFeatures features = {};
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		features.Sse41 = (info[2] & (1 << 19)) != 0;
+		features.Pclmul = (info[2] & (1 << 1)) != 0;
+
+		// AVX2 also needs the OS to save the YMM registers (OSXSAVE and XCR0 bits 1-2)
+		bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		if (maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			features.Avx2 = osAvx && (info[1] & (1 << 5)) != 0;
+			features.Sha = (info[1] & (1 << 29)) != 0;
+		}
+		return features;
+	}
+
+	const CpuFeatures& get_detected_features()
+	{
+		static const CpuFeatures features = detect_cpu_features();
+		return features;
+	}
+
+	CpuFeatures& get_enabled_features()
+	{
+		static CpuFeatures features = get_detected_features();
+		return features;
+	}
+}
+
+const CpuFeatures& get_cpu_features()
+{
+	return get_enabled_features();
+}
+
+void restrict_cpu_features(const CpuFeatures& allowed)
+{
+	const CpuFeatures& detected = get_detected_features();
+	CpuFeatures& enabled = get_enabled_features();
+	enabled.Sse41 = detected.Sse41 && allowed.Sse41;
+	enabled.Pclmul = detected.Pclmul && allowed.Pclmul;
+	enabled.Avx2 = detected.Avx2 && allowed.Avx2;
+	enabled.Sha = detected.Sha && allowed.Sha;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+struct CpuFeatures
+{
+	bool Sse41;
+	bool Pclmul;
+	bool Avx2;
+	bool Sha;
+};
+
+// Detected once on first use; SSE2 is part of the x64 baseline and is not listed.
+const CpuFeatures& get_cpu_features();
+
+// Turns off the detected features that allowed does not have, and back on those it has, so that the
+// tests and benchmarks can run the fallback paths on any CPU. Not to be called while decoding.
+void restrict_cpu_features(const CpuFeatures& allowed);
@@ -0,0 +1,142 @@
+#include "Crc32.h"
+
+#include <cstring>
+#include <immintrin.h>
+#include "Cpu.h"
+
+namespace
+{
+	const uint32_t Polynomial = 0xEDB88320; // Reflected
+
+	// Table[k][b] is the CRC of byte b followed by k zero bytes
+	struct SlicingTables
+	{
+		uint32_t Table[8][256];
+
+		SlicingTables()
+		{
+			for (uint32_t b = 0; b < 256; b++)
+			{
+				uint32_t crc = b;
+				for (int bit = 0; bit < 8; bit++)
+					crc = crc & 1 ? (crc >> 1) ^ Polynomial : crc >> 1;
+				Table[0][b] = crc;
+			}
+			for (uint32_t b = 0; b < 256; b++)
+			{
+				for (int k = 1; k < 8; k++)
+					Table[k][b] = (Table[k - 1][b] >> 8) ^ Table[0][Table[k - 1][b] & 0xFF];
+			}
+		}
+	};
+
+	const SlicingTables& get_slicing_tables()
+	{
+		static const SlicingTables tables;
+		return tables;
+	}
+
+	// crc is the running register, without the final inversion
+	uint32_t crc32_slicing(const uint8_t* data, size_t size, uint32_t crc)
+	{
+		auto& table = get_slicing_tables().Table;
+		for (; size >= 8; data += 8, size -= 8)
+		{
+			uint32_t low, high;
+			memcpy(&low, data, 4);
+			memcpy(&high, data + 4, 4);
+			low ^= crc;
+			crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+				^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+		}
+		for (; size; data++, size--)
+			crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xFF];
+		return crc;
+	}
+
+	inline __m128i fold(__m128i value, __m128i constants, __m128i next)
+	{
+		return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(value, constants, 0x00), _mm_clmulepi64_si128(value, constants, 0x11)), next);
+	}
+
+	// Folds four 128-bit lanes across the data, then into one lane and reduces it to 32 bits with a
+	// Barrett reduction (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ").
+	// size is at least 64 and a multiple of 16.
+	uint32_t crc32_pclmul(const uint8_t* data, size_t size, uint32_t crc)
+	{
+		const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4); // Folding over 512 bits
+		const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0); // Folding over 128 bits
+		const __m128i k5 = _mm_set_epi64x(0, 0x0163CD6124);
+		const __m128i barrett = _mm_set_epi64x(0x01F7011641, 0x01DB710641); // The quotient constant and P
+		const __m128i low32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+		auto load = [](const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+		__m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+		__m128i x2 = load(data + 16);
+		__m128i x3 = load(data + 32);
+		__m128i x4 = load(data + 48);
+		for (data += 64, size -= 64; size >= 64; data += 64, size -= 64)
+		{
+			x1 = fold(x1, k1k2, load(data));
+			x2 = fold(x2, k1k2, load(data + 16));
+			x3 = fold(x3, k1k2, load(data + 32));
+			x4 = fold(x4, k1k2, load(data + 48));
+		}
+
+		x1 = fold(x1, k3k4, x2);
+		x1 = fold(x1, k3k4, x3);
+		x1 = fold(x1, k3k4, x4);
+		for (; size >= 16; data += 16, size -= 16)
+			x1 = fold(x1, k3k4, load(data));
+
+		// 128 to 64 bits, and 64 to 32 bits
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), _mm_srli_si128(x1, 4));
+
+		__m128i quotient = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), barrett, 0x10);
+		__m128i product = _mm_clmulepi64_si128(_mm_and_si128(quotient, low32), barrett, 0x00);
+		return static_cast<uint32_t>(_mm_extract_epi32(_mm_xor_si128(x1, product), 1));
+	}
+
+	// The product of two polynomials modulo P, where bit 31 is x^0
+	uint32_t multiply_mod_p(uint32_t a, uint32_t b)
+	{
+		uint32_t product = 0;
+		for (uint32_t m = 1u << 31; m; m >>= 1)
+		{
+			if (a & m)
+				product ^= b;
+			b = b & 1 ? (b >> 1) ^ Polynomial : b >> 1;
+		}
+		return product;
+	}
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+	auto& cpu = get_cpu_features();
+	if (size >= 64 && cpu.Pclmul && cpu.Sse41)
+	{
+		size_t folded = size & ~static_cast<size_t>(15);
+		crc = crc32_pclmul(data, folded, crc);
+		data += folded;
+		size -= folded;
+	}
+	return ~crc32_slicing(data, size, crc);
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+	// crc1 is shifted over size2 zero bytes, i.e. multiplied by x^(8 * size2); the power is built
+	// from x^(2^k) by squaring
+	uint32_t shift = 1u << 31;
+	uint32_t power = 1u << 23; // x^8
+	for (uint64_t n = size2; n; n >>= 1)
+	{
+		if (n & 1)
+			shift = multiply_mod_p(power, shift);
+		power = multiply_mod_p(power, power);
+	}
+	return multiply_mod_p(shift, crc1) ^ crc2;
+}
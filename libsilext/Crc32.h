@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The CRC-32 of 7z (and zip), continuing from the CRC of the data before it, like zlib's crc32.
+// Runs of 64 bytes and more are folded 64 bytes at a time with PCLMULQDQ where it is available;
+// the rest, and everything on other CPUs, is looked up 8 bytes at a time (slicing-by-8).
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// The CRC of two consecutive ranges from their CRCs and the size of the second one, so that ranges
+// checksummed on different threads can be put together
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
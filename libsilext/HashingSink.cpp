@@ -0,0 +1,115 @@
+#include "HashingSink.h"
+
+namespace
+{
+	// Enough files to keep the lanes of sha256_many and md5_many busy, while the batch still fits in the cache
+	const size_t MaxBatchFiles = 256;
+	const size_t MaxBatchBytes = 1024 * 1024;
+}
+
+bool HashingSink::begin_file(const SinkFile& file)
+{
+	digests.push_back({ file.Path, file.NameInCabinet, file.Size, {}, {} });
+	inBatch = file.Size <= SmallFileSize;
+	if (inBatch)
+	{
+		batchFiles.push_back(digests.size() - 1);
+		batchOffsets.push_back(batchData.size());
+	}
+	else
+	{
+		sha256 = Sha256();
+		md5 = Md5();
+	}
+	return sink.begin_file(file);
+}
+
+bool HashingSink::write_chunk(const uint8_t* data, size_t size)
+{
+	auto start = std::chrono::steady_clock::now();
+	if (inBatch)
+		batchData.insert(batchData.end(), data, data + size);
+	else
+	{
+		if (hashSha256)
+			sha256.update(data, size);
+		if (hashMd5)
+			md5.update(data, size);
+	}
+	hashTime += std::chrono::steady_clock::now() - start;
+	return sink.write_chunk(data, size);
+}
+
+bool HashingSink::end_file()
+{
+	if (!inBatch)
+	{
+		auto start = std::chrono::steady_clock::now();
+		if (hashSha256)
+			digests.back().Sha256 = sha256.finish();
+		if (hashMd5)
+			digests.back().Md5 = md5.finish();
+		hashTime += std::chrono::steady_clock::now() - start;
+	}
+	else if (batchFiles.size() >= MaxBatchFiles || batchData.size() >= MaxBatchBytes)
+	{
+		hash_batch();
+	}
+	return sink.end_file();
+}
+
+const std::vector<FileDigest>& HashingSink::get_digests()
+{
+	hash_batch();
+	return digests;
+}
+
+// The files of the batch are stored back to back
+void HashingSink::hash_batch()
+{
+	if (batchFiles.empty())
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<const uint8_t*> data;
+	std::vector<size_t> sizes;
+	for (size_t i = 0; i < batchFiles.size(); i++)
+	{
+		size_t end = i + 1 < batchOffsets.size() ? batchOffsets[i + 1] : batchData.size();
+		data.push_back(batchData.data() + batchOffsets[i]);
+		sizes.push_back(end - batchOffsets[i]);
+	}
+
+	if (hashSha256)
+	{
+		std::vector<Sha256Digest> batchDigests(batchFiles.size());
+		sha256_many(data.data(), sizes.data(), batchFiles.size(), batchDigests.data());
+		for (size_t i = 0; i < batchFiles.size(); i++)
+			digests[batchFiles[i]].Sha256 = batchDigests[i];
+	}
+	if (hashMd5)
+	{
+		std::vector<Md5Digest> batchDigests(batchFiles.size());
+		md5_many(data.data(), sizes.data(), batchFiles.size(), batchDigests.data());
+		for (size_t i = 0; i < batchFiles.size(); i++)
+			digests[batchFiles[i]].Md5 = batchDigests[i];
+	}
+
+	batchData.clear();
+	batchFiles.clear();
+	batchOffsets.clear();
+	hashTime += std::chrono::steady_clock::now() - start;
+}
+
+// Files the table holds no hash for, e.g. versioned ones, are not checked
+std::vector<const FileDigest*> find_hash_mismatches(const DbInfo& dbInfo, const std::vector<FileDigest>& digests)
+{
+	std::vector<const FileDigest*> mismatches;
+	for (auto& digest : digests)
+	{
+		auto file = dbInfo.Files.find(digest.NameInCabinet);
+		if (file != dbInfo.Files.end() && file->second.Md5 && *file->second.Md5 != digest.Md5)
+			mismatches.push_back(&digest);
+	}
+	return mismatches;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Md5.h"
+#include "Sha256.h"
+#include "Silext.h"
+
+struct FileDigest
+{
+	std::wstring Path; // Relative to the root of the extracted tree
+	std::wstring NameInCabinet;
+	uint64_t Size;
+	Sha256Digest Sha256; // Zero unless hashed with SHA-256
+	Md5Digest Md5; // Zero unless hashed with MD5
+};
+
+// Passes the payload on to another sink and hashes every file with SHA-256, MD5 or both on the way, so
+// that the extracted tree does not have to be read back to be verified. Larger files are hashed chunk
+// by chunk as they pass. Files of up to SmallFileSize are copied into a batch while they are in cache,
+// and the batch is hashed through sha256_many and md5_many, which take many small files at the same time.
+class HashingSink : public FileSink
+{
+public:
+	static const size_t SmallFileSize = 16 * 1024;
+
+	HashingSink(FileSink& sink, bool hashSha256, bool hashMd5) : sink(sink), hashSha256(hashSha256), hashMd5(hashMd5) {}
+
+	bool begin_file(const SinkFile& file) override;
+	bool write_chunk(const uint8_t* data, size_t size) override;
+	bool end_file() override;
+
+	// Of every file, in the order they were passed; the pending batch is hashed first
+	const std::vector<FileDigest>& get_digests();
+
+	std::chrono::steady_clock::duration get_hash_time() const { return hashTime; }
+
+private:
+	void hash_batch();
+
+	FileSink& sink;
+	const bool hashSha256;
+	const bool hashMd5;
+	std::vector<FileDigest> digests;
+	bool inBatch = false;
+	Sha256 sha256;
+	Md5 md5;
+	std::vector<uint8_t> batchData;
+	std::vector<size_t> batchFiles; // Indices into digests
+	std::vector<size_t> batchOffsets; // Where each file starts in batchData
+	std::chrono::steady_clock::duration hashTime = std::chrono::steady_clock::duration::zero();
+};
+
+// The digests, hashed with MD5, of the files whose hash in the MsiFileHash table of dbInfo differs
+std::vector<const FileDigest*> find_hash_mismatches(const DbInfo& dbInfo, const std::vector<FileDigest>& digests);
@@ -0,0 +1,225 @@
+#include "Locator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <intrin.h>
+#include <immintrin.h>
+#include "Cpu.h"
+
+namespace
+{
+	const uint8_t CabinetSignature[] = { 'M', 'S', 'C', 'F', 0, 0, 0, 0 };
+	const uint8_t SevenZipSignature[] = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+	const uint8_t CompoundFileSignature[] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+
+	const size_t CabinetHeaderSize = 36;
+	const size_t SevenZipHeaderSize = 32;
+	const size_t CompoundFileHeaderSize = 512;
+
+	const uint16_t ImageSectionCount = 96;
+	const uint32_t ResourceDirectory = 2;
+	const uint32_t SecurityDirectory = 4;
+
+	struct ScanRange
+	{
+		size_t Begin;
+		size_t End;
+	};
+
+	inline uint16_t read_uint16(const uint8_t* p)
+	{
+		return static_cast<uint16_t>(p[0] | (p[1] << 8));
+	}
+
+	inline uint32_t read_uint32(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+	inline uint64_t read_uint64(const uint8_t* p)
+	{
+		return read_uint32(p) | (static_cast<uint64_t>(read_uint32(p + 4)) << 32);
+	}
+
+	// Both loads read one byte ahead, so the loops stop a block plus one byte before the end
+	size_t find_payload_signature_avx2(const uint8_t* data, size_t pos, size_t end)
+	{
+		const __m256i cab0 = _mm256_set1_epi8('M'), cab1 = _mm256_set1_epi8('S');
+		const __m256i sz0 = _mm256_set1_epi8('7'), sz1 = _mm256_set1_epi8('z');
+		const __m256i cfb0 = _mm256_set1_epi8(static_cast<char>(0xD0)), cfb1 = _mm256_set1_epi8(static_cast<char>(0xCF));
+		for (; end - pos > 32; pos += 32)
+		{
+			__m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+			__m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos + 1));
+			__m256i hits = _mm256_and_si256(_mm256_cmpeq_epi8(first, cab0), _mm256_cmpeq_epi8(second, cab1));
+			hits = _mm256_or_si256(hits, _mm256_and_si256(_mm256_cmpeq_epi8(first, sz0), _mm256_cmpeq_epi8(second, sz1)));
+			hits = _mm256_or_si256(hits, _mm256_and_si256(_mm256_cmpeq_epi8(first, cfb0), _mm256_cmpeq_epi8(second, cfb1)));
+			unsigned long index;
+			if (_BitScanForward(&index, static_cast<unsigned int>(_mm256_movemask_epi8(hits))))
+				return pos + index;
+		}
+		return pos;
+	}
+
+	size_t find_payload_signature_sse2(const uint8_t* data, size_t pos, size_t end)
+	{
+		const __m128i cab0 = _mm_set1_epi8('M'), cab1 = _mm_set1_epi8('S');
+		const __m128i sz0 = _mm_set1_epi8('7'), sz1 = _mm_set1_epi8('z');
+		const __m128i cfb0 = _mm_set1_epi8(static_cast<char>(0xD0)), cfb1 = _mm_set1_epi8(static_cast<char>(0xCF));
+		for (; end - pos > 16; pos += 16)
+		{
+			__m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+			__m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + 1));
+			__m128i hits = _mm_and_si128(_mm_cmpeq_epi8(first, cab0), _mm_cmpeq_epi8(second, cab1));
+			hits = _mm_or_si128(hits, _mm_and_si128(_mm_cmpeq_epi8(first, sz0), _mm_cmpeq_epi8(second, sz1)));
+			hits = _mm_or_si128(hits, _mm_and_si128(_mm_cmpeq_epi8(first, cfb0), _mm_cmpeq_epi8(second, cfb1)));
+			unsigned long index;
+			if (_BitScanForward(&index, static_cast<unsigned int>(_mm_movemask_epi8(hits))))
+				return pos + index;
+		}
+		return pos;
+	}
+
+	// Returns the size of a valid payload at data[pos], or 0 if the signature is a false positive
+	size_t validate_payload(const uint8_t* data, size_t pos, size_t end, PayloadType& type_out)
+	{
+		const uint8_t* p = data + pos;
+		size_t available = end - pos;
+		if (available >= CabinetHeaderSize && memcmp(p, CabinetSignature, sizeof(CabinetSignature)) == 0)
+		{
+			// cbCabinet covers the whole cabinet; only format version 1.3 exists
+			uint32_t cabinetSize = read_uint32(p + 8);
+			if (p[24] != 3 || p[25] != 1 || cabinetSize < CabinetHeaderSize || cabinetSize > available)
+				return 0;
+			type_out = PayloadType::Cabinet;
+			return cabinetSize;
+		}
+
+		if (available >= SevenZipHeaderSize && memcmp(p, SevenZipSignature, sizeof(SevenZipSignature)) == 0)
+		{
+			// The start header points at the header which is stored last
+			uint64_t nextHeaderOffset = read_uint64(p + 12);
+			uint64_t nextHeaderSize = read_uint64(p + 20);
+			if (p[6] != 0 || nextHeaderOffset > available - SevenZipHeaderSize || nextHeaderSize > available - SevenZipHeaderSize - nextHeaderOffset)
+				return 0;
+			type_out = PayloadType::SevenZip;
+			return static_cast<size_t>(SevenZipHeaderSize + nextHeaderOffset + nextHeaderSize);
+		}
+
+		if (available >= CompoundFileHeaderSize && memcmp(p, CompoundFileSignature, sizeof(CompoundFileSignature)) == 0)
+		{
+			// Byte order mark and a sector size of 512 (v3) or 4096 (v4); the size is not recorded
+			uint16_t sectorShift = read_uint16(p + 30);
+			if (read_uint16(p + 28) != 0xFFFE || (sectorShift != 9 && sectorShift != 12))
+				return 0;
+			type_out = PayloadType::CompoundFile;
+			return available;
+		}
+		return 0;
+	}
+
+	// Determines the resource section and the overlay (minus a trailing Authenticode signature) of
+	// a PE image. Returns false if the data is not a PE image.
+	bool get_pe_scan_ranges(const uint8_t* data, size_t size, std::vector<ScanRange>& ranges_out)
+	{
+		if (size < 0x40 || data[0] != 'M' || data[1] != 'Z')
+			return false;
+
+		uint32_t peOffset = read_uint32(data + 0x3C);
+		if (peOffset > size - 24 || memcmp(data + peOffset, "PE\0\0", 4) != 0)
+			return false;
+
+		const uint8_t* fileHeader = data + peOffset + 4;
+		uint16_t numSections = read_uint16(fileHeader + 2);
+		uint16_t optionalHeaderSize = read_uint16(fileHeader + 16);
+		size_t optionalHeaderOffset = peOffset + 24;
+		size_t sectionTableOffset = optionalHeaderOffset + optionalHeaderSize;
+		if (numSections > ImageSectionCount || sectionTableOffset + numSections * 40 > size || optionalHeaderSize < 2)
+			return false;
+
+		// The data directories follow the PE32 or PE32+ specific part of the optional header
+		const uint8_t* optionalHeader = data + optionalHeaderOffset;
+		size_t directoriesOffset = read_uint16(optionalHeader) == 0x20B ? 112 : 96;
+		uint32_t numDirectories = optionalHeaderSize >= directoriesOffset + 4 ? read_uint32(optionalHeader + directoriesOffset - 4) : 0;
+		numDirectories = std::min<uint32_t>(numDirectories, static_cast<uint32_t>((optionalHeaderSize - std::min<size_t>(directoriesOffset, optionalHeaderSize)) / 8));
+
+		uint32_t resourceRva = numDirectories > ResourceDirectory ? read_uint32(optionalHeader + directoriesOffset + ResourceDirectory * 8) : 0;
+		size_t overlayBegin = sectionTableOffset + numSections * 40;
+		for (uint16_t i = 0; i < numSections; i++)
+		{
+			const uint8_t* section = data + sectionTableOffset + i * 40;
+			uint32_t virtualAddress = read_uint32(section + 12);
+			uint32_t rawSize = read_uint32(section + 16);
+			uint32_t rawOffset = read_uint32(section + 20);
+			if (rawOffset >= size)
+				continue;
+
+			size_t rawEnd = rawOffset + std::min<size_t>(rawSize, size - rawOffset);
+			overlayBegin = std::max(overlayBegin, rawEnd);
+			if (resourceRva != 0 && resourceRva >= virtualAddress && resourceRva < virtualAddress + std::max(rawSize, read_uint32(section + 8)))
+				ranges_out.push_back({ rawOffset, rawEnd });
+		}
+
+		// The security directory holds a file offset rather than an RVA
+		size_t overlayEnd = size;
+		if (numDirectories > SecurityDirectory)
+		{
+			uint32_t certificateOffset = read_uint32(optionalHeader + directoriesOffset + SecurityDirectory * 8);
+			if (certificateOffset >= overlayBegin && certificateOffset < size)
+				overlayEnd = certificateOffset;
+		}
+		if (overlayBegin < overlayEnd)
+			ranges_out.push_back({ overlayBegin, overlayEnd });
+		return true;
+	}
+
+	void scan_range(const uint8_t* data, const ScanRange& range, std::vector<PayloadRange>& payloads_out)
+	{
+		size_t pos = range.Begin;
+		while ((pos = find_payload_signature(data, pos, range.End)) < range.End)
+		{
+			PayloadType type;
+			size_t size = validate_payload(data, pos, range.End, type);
+			if (size == 0)
+			{
+				pos++;
+				continue;
+			}
+
+			// Whatever is inside a payload belongs to it
+			payloads_out.push_back({ type, pos, size });
+			pos += size;
+		}
+	}
+}
+
+size_t find_payload_signature(const uint8_t* data, size_t pos, size_t end)
+{
+	if (pos >= end)
+		return end;
+
+	pos = get_cpu_features().Avx2 ? find_payload_signature_avx2(data, pos, end) : find_payload_signature_sse2(data, pos, end);
+	for (; pos + 1 < end; pos++)
+	{
+		uint8_t first = data[pos];
+		uint8_t second = data[pos + 1];
+		if ((first == 'M' && second == 'S') || (first == '7' && second == 'z') || (first == 0xD0 && second == 0xCF))
+			return pos;
+	}
+	return end;
+}
+
+std::vector<PayloadRange> locate_payloads(const uint8_t* data, size_t size)
+{
+	std::vector<PayloadRange> payloads;
+	std::vector<ScanRange> ranges;
+	if (get_pe_scan_ranges(data, size, ranges))
+	{
+		for (auto& range : ranges)
+			scan_range(data, range, payloads);
+	}
+
+	if (payloads.empty())
+		scan_range(data, { 0, size }, payloads);
+	return payloads;
+}
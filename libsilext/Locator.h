@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class PayloadType
+{
+	Cabinet,
+	SevenZip,
+	CompoundFile
+};
+
+struct PayloadRange
+{
+	PayloadType Type;
+	size_t Offset;
+	size_t Size;
+};
+
+// Returns the position of the first byte in data[pos, end) that starts one of the payload
+// signatures (MSCF, 7z\xBC\xAF or the CFB magic) by its first two bytes, or end if there is none.
+size_t find_payload_signature(const uint8_t* data, size_t pos, size_t end);
+
+// Finds the cabinets, 7z archives and compound files (MSI/MSP) embedded in a setup EXE. For a PE
+// image only the resource section and the overlay are searched, anything else is searched as a
+// whole. Every candidate is validated against its header before it is reported.
+std::vector<PayloadRange> locate_payloads(const uint8_t* data, size_t size);
@@ -0,0 +1,591 @@
+#include "Lzma.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const unsigned int NumStates = 12;
+	const unsigned int NumPosBitsMax = 4;
+	const unsigned int NumLenToPosStates = 4;
+	const unsigned int NumAlignBits = 4;
+	const unsigned int StartPosModelIndex = 4;
+	const unsigned int EndPosModelIndex = 14;
+	const unsigned int NumFullDistances = 1 << (EndPosModelIndex >> 1);
+	const unsigned int MatchMinLen = 2;
+
+	const uint32_t TopValue = 1 << 24;
+	const unsigned int NumBitModelTotalBits = 11;
+	const uint16_t BitModelTotal = 1 << NumBitModelTotalBits;
+	const unsigned int NumMoveBits = 5;
+
+	struct RangeDecoder
+	{
+		const uint8_t* In;
+		const uint8_t* InEnd;
+		uint32_t Range;
+		uint32_t Code;
+
+		bool init(const uint8_t* in, size_t inSize)
+		{
+			if (inSize < 5 || in[0] != 0)
+				return false;
+
+			In = in + 5;
+			InEnd = in + inSize;
+			Range = 0xFFFFFFFF;
+			Code = (static_cast<uint32_t>(in[1]) << 24) | (in[2] << 16) | (in[3] << 8) | in[4];
+			return Code != Range;
+		}
+
+		// Reading past the end yields zeros; callers check overrun() once per chunk
+		// instead of bounds checking every byte.
+		inline void normalize()
+		{
+			if (Range < TopValue)
+			{
+				Range <<= 8;
+				Code = (Code << 8) | (In < InEnd ? *In : 0);
+				In++;
+			}
+		}
+
+		bool overrun() const
+		{
+			return In > InEnd;
+		}
+
+		// Branch free bit decode: the outcome selects the new range, code and probability
+		// through a mask, so that mispredictions are limited to the callers that actually
+		// branch on the decoded bit.
+		inline unsigned int decode_bit(uint16_t& prob)
+		{
+			normalize();
+			uint32_t bound = (Range >> NumBitModelTotalBits) * prob;
+			uint32_t mask = 0u - static_cast<uint32_t>(Code >= bound);
+			Range = (bound & ~mask) | ((Range - bound) & mask);
+			Code -= bound & mask;
+			prob = static_cast<uint16_t>(prob
+				+ (((BitModelTotal - prob) >> NumMoveBits) & ~mask)
+				- ((prob >> NumMoveBits) & mask));
+			return mask & 1;
+		}
+
+		inline uint32_t decode_direct_bits(unsigned int count)
+		{
+			uint32_t result = 0;
+			do
+			{
+				normalize();
+				Range >>= 1;
+				uint32_t mask = 0u - static_cast<uint32_t>(Code >= Range);
+				Code -= Range & mask;
+				result = (result << 1) | (mask & 1);
+			} while (--count);
+			return result;
+		}
+
+		inline unsigned int decode_tree(uint16_t* probs, unsigned int numBits)
+		{
+			unsigned int m = 1;
+			for (unsigned int i = 0; i < numBits; i++)
+				m = (m << 1) | decode_bit(probs[m]);
+			return m - (1u << numBits);
+		}
+
+		inline unsigned int decode_reverse_tree(uint16_t* probs, unsigned int numBits)
+		{
+			unsigned int m = 1;
+			unsigned int symbol = 0;
+			for (unsigned int i = 0; i < numBits; i++)
+			{
+				unsigned int bit = decode_bit(probs[m]);
+				m = (m << 1) | bit;
+				symbol |= bit << i;
+			}
+			return symbol;
+		}
+	};
+
+	struct LenDecoder
+	{
+		uint16_t Choice;
+		uint16_t Choice2;
+		uint16_t Low[1 << NumPosBitsMax][1 << 3];
+		uint16_t Mid[1 << NumPosBitsMax][1 << 3];
+		uint16_t High[1 << 8];
+
+		void reset()
+		{
+			Choice = Choice2 = BitModelTotal >> 1;
+			std::fill(&Low[0][0], &Low[0][0] + sizeof(Low) / sizeof(uint16_t), BitModelTotal >> 1);
+			std::fill(&Mid[0][0], &Mid[0][0] + sizeof(Mid) / sizeof(uint16_t), BitModelTotal >> 1);
+			std::fill(High, High + sizeof(High) / sizeof(uint16_t), BitModelTotal >> 1);
+		}
+
+		inline unsigned int decode(RangeDecoder& rc, unsigned int posState)
+		{
+			if (!rc.decode_bit(Choice))
+				return rc.decode_tree(Low[posState], 3);
+			if (!rc.decode_bit(Choice2))
+				return 8 + rc.decode_tree(Mid[posState], 3);
+			return 16 + rc.decode_tree(High, 8);
+		}
+	};
+
+	struct LzmaDecoder
+	{
+		uint16_t IsMatch[NumStates << NumPosBitsMax];
+		uint16_t IsRep[NumStates];
+		uint16_t IsRepG0[NumStates];
+		uint16_t IsRepG1[NumStates];
+		uint16_t IsRepG2[NumStates];
+		uint16_t IsRep0Long[NumStates << NumPosBitsMax];
+		uint16_t PosSlot[NumLenToPosStates][1 << 6];
+		uint16_t SpecPos[NumFullDistances - EndPosModelIndex];
+		uint16_t Align[1 << NumAlignBits];
+		LenDecoder LenCoder;
+		LenDecoder RepLenCoder;
+		std::vector<uint16_t> Literal;
+
+		unsigned int LiteralContextBits = 0;
+		unsigned int LiteralPosMask = 0;
+		unsigned int PosMask = 0;
+
+		unsigned int State = 0;
+		uint32_t Reps[4] = { 0, 0, 0, 0 };
+
+		void set_properties(unsigned int lc, unsigned int lp, unsigned int pb)
+		{
+			LiteralContextBits = lc;
+			LiteralPosMask = (1u << lp) - 1;
+			PosMask = (1u << pb) - 1;
+			Literal.resize(static_cast<size_t>(0x300) << (lc + lp));
+		}
+
+		void reset_state()
+		{
+			auto reset = [](uint16_t* probs, size_t count) { std::fill(probs, probs + count, BitModelTotal >> 1); };
+			reset(IsMatch, sizeof(IsMatch) / sizeof(uint16_t));
+			reset(IsRep, NumStates);
+			reset(IsRepG0, NumStates);
+			reset(IsRepG1, NumStates);
+			reset(IsRepG2, NumStates);
+			reset(IsRep0Long, sizeof(IsRep0Long) / sizeof(uint16_t));
+			reset(&PosSlot[0][0], sizeof(PosSlot) / sizeof(uint16_t));
+			reset(SpecPos, sizeof(SpecPos) / sizeof(uint16_t));
+			reset(Align, sizeof(Align) / sizeof(uint16_t));
+			reset(Literal.data(), Literal.size());
+			LenCoder.reset();
+			RepLenCoder.reset();
+			State = 0;
+			Reps[0] = Reps[1] = Reps[2] = Reps[3] = 0;
+		}
+
+		// Decodes one range coded stream into out[pos, limit). Everything from dictStart
+		// up to the current position is available as dictionary.
+		bool decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t dictStart, size_t pos, size_t limit, const LzmaOutputObserver* observer);
+	};
+
+	inline void copy_match(uint8_t* out, size_t pos, size_t distance, size_t len)
+	{
+		uint8_t* dest = out + pos;
+		const uint8_t* src = dest - distance;
+		if (distance >= 8)
+		{
+			// Source and destination never overlap within an 8 byte step, so whole words can be moved
+			while (len >= 8)
+			{
+				uint64_t word;
+				memcpy(&word, src, 8);
+				memcpy(dest, &word, 8);
+				src += 8;
+				dest += 8;
+				len -= 8;
+			}
+		}
+		else if (distance == 1)
+		{
+			memset(dest, *src, len);
+			return;
+		}
+		while (len--)
+			*dest++ = *src++;
+	}
+
+	bool LzmaDecoder::decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t dictStart, size_t pos, size_t limit, const LzmaOutputObserver* observer)
+	{
+		RangeDecoder rc;
+		if (!rc.init(in, inSize))
+			return false;
+
+		unsigned int state = State;
+		uint32_t rep0 = Reps[0], rep1 = Reps[1], rep2 = Reps[2], rep3 = Reps[3];
+
+		// Matches only write ahead of pos, so everything before it is final
+		size_t observed = pos;
+		while (pos < limit)
+		{
+			if (observer && pos - observed >= LzmaObserverStep)
+			{
+				(*observer)(observed, pos - observed);
+				observed = pos;
+			}
+
+			size_t processed = pos - dictStart;
+			unsigned int posState = static_cast<unsigned int>(processed) & PosMask;
+
+			if (!rc.decode_bit(IsMatch[(state << NumPosBitsMax) + posState]))
+			{
+				unsigned int prevByte = processed ? out[pos - 1] : 0;
+				uint16_t* probs = Literal.data() + 0x300 * (((processed & LiteralPosMask) << LiteralContextBits)
+					+ (prevByte >> (8 - LiteralContextBits)));
+
+				unsigned int symbol = 1;
+				if (state < 7)
+				{
+					do
+						symbol = (symbol << 1) | rc.decode_bit(probs[symbol]);
+					while (symbol < 0x100);
+				}
+				else
+				{
+					if (rep0 >= processed)
+						return false;
+
+					unsigned int matchByte = out[pos - rep0 - 1];
+					unsigned int offs = 0x100;
+					do
+					{
+						matchByte <<= 1;
+						unsigned int bit = matchByte & offs;
+						unsigned int decoded = rc.decode_bit(probs[offs + bit + symbol]);
+						symbol = (symbol << 1) | decoded;
+						offs &= ~(bit ^ (0u - decoded));
+					} while (symbol < 0x100);
+				}
+				out[pos++] = static_cast<uint8_t>(symbol);
+				state = state < 4 ? 0 : (state < 10 ? state - 3 : state - 6);
+				continue;
+			}
+
+			unsigned int len;
+			if (!rc.decode_bit(IsRep[state]))
+			{
+				rep3 = rep2;
+				rep2 = rep1;
+				rep1 = rep0;
+				len = LenCoder.decode(rc, posState);
+				state = state < 7 ? 7 : 10;
+
+				unsigned int lenState = len < NumLenToPosStates - 1 ? len : NumLenToPosStates - 1;
+				unsigned int posSlot = rc.decode_tree(PosSlot[lenState], 6);
+				if (posSlot < StartPosModelIndex)
+				{
+					rep0 = posSlot;
+				}
+				else
+				{
+					unsigned int numDirectBits = (posSlot >> 1) - 1;
+					rep0 = (2 | (posSlot & 1)) << numDirectBits;
+					if (posSlot < EndPosModelIndex)
+					{
+						rep0 += rc.decode_reverse_tree(SpecPos + rep0 - posSlot - 1, numDirectBits);
+					}
+					else
+					{
+						rep0 += rc.decode_direct_bits(numDirectBits - NumAlignBits) << NumAlignBits;
+						rep0 += rc.decode_reverse_tree(Align, NumAlignBits);
+						if (rep0 == 0xFFFFFFFF)
+							break; // End marker
+					}
+				}
+			}
+			else
+			{
+				if (!rc.decode_bit(IsRepG0[state]))
+				{
+					if (!rc.decode_bit(IsRep0Long[(state << NumPosBitsMax) + posState]))
+					{
+						if (rep0 >= processed)
+							return false;
+
+						state = state < 7 ? 9 : 11;
+						out[pos] = out[pos - rep0 - 1];
+						pos++;
+						continue;
+					}
+				}
+				else
+				{
+					uint32_t distance;
+					if (!rc.decode_bit(IsRepG1[state]))
+					{
+						distance = rep1;
+					}
+					else
+					{
+						if (!rc.decode_bit(IsRepG2[state]))
+						{
+							distance = rep2;
+						}
+						else
+						{
+							distance = rep3;
+							rep3 = rep2;
+						}
+						rep2 = rep1;
+					}
+					rep1 = rep0;
+					rep0 = distance;
+				}
+				len = RepLenCoder.decode(rc, posState);
+				state = state < 7 ? 8 : 11;
+			}
+
+			len += MatchMinLen;
+			if (rep0 >= processed || len > limit - pos)
+				return false;
+
+			copy_match(out, pos, static_cast<size_t>(rep0) + 1, len);
+			pos += len;
+		}
+
+		if (observer && pos > observed)
+			(*observer)(observed, pos - observed);
+
+		State = state;
+		Reps[0] = rep0;
+		Reps[1] = rep1;
+		Reps[2] = rep2;
+		Reps[3] = rep3;
+		return pos == limit && !rc.overrun();
+	}
+
+	bool decode_properties_byte(uint8_t d, unsigned int& lc, unsigned int& lp, unsigned int& pb)
+	{
+		if (d >= 9 * 5 * 5)
+			return false;
+
+		lc = d % 9;
+		d /= 9;
+		lp = d % 5;
+		pb = d / 5;
+		return true;
+	}
+
+	// Decodes the chunks starting at in[inPos] into out[outPos, outEnd). The range must start
+	// with a chunk that resets the dictionary.
+	bool decode_lzma2_chunks(const uint8_t* in, size_t inSize, size_t inPos, uint8_t* out, size_t outPos, size_t outEnd, const LzmaOutputObserver* observer)
+	{
+		LzmaDecoder decoder;
+		bool needDictReset = true;
+		bool needProperties = true;
+		bool needState = true;
+		size_t dictStart = outPos;
+
+		while (outPos < outEnd && inPos < inSize)
+		{
+			uint8_t control = in[inPos++];
+			if (control == 0x00)
+				return false;
+
+			if (control < 0x80)
+			{
+				// Uncompressed chunk, 0x01 resets the dictionary
+				if (control > 0x02 || inSize - inPos < 2)
+					return false;
+
+				size_t size = ((in[inPos] << 8) | in[inPos + 1]) + 1;
+				inPos += 2;
+				if (control == 0x01)
+				{
+					dictStart = outPos;
+					needDictReset = false;
+					needState = true;
+				}
+				else if (needDictReset)
+				{
+					return false;
+				}
+
+				if (size > inSize - inPos || size > outEnd - outPos)
+					return false;
+
+				memcpy(out + outPos, in + inPos, size);
+				if (observer)
+					(*observer)(outPos, size);
+				inPos += size;
+				outPos += size;
+				continue;
+			}
+
+			// LZMA chunk, bits 5-6 select what is reset before decoding it
+			if (inSize - inPos < 4)
+				return false;
+
+			size_t unpackSize = (static_cast<size_t>(control & 0x1F) << 16) + (in[inPos] << 8) + in[inPos + 1] + 1;
+			size_t packSize = (in[inPos + 2] << 8) + in[inPos + 3] + 1;
+			inPos += 4;
+
+			unsigned int reset = (control >> 5) & 3;
+			if (reset == 3)
+			{
+				dictStart = outPos;
+				needDictReset = false;
+			}
+			else if (needDictReset)
+			{
+				return false;
+			}
+
+			if (reset >= 2)
+			{
+				unsigned int lc, lp, pb;
+				if (inPos >= inSize || !decode_properties_byte(in[inPos++], lc, lp, pb) || lc + lp > 4)
+					return false;
+
+				decoder.set_properties(lc, lp, pb);
+				needProperties = false;
+			}
+			else if (needProperties)
+			{
+				return false;
+			}
+
+			if (reset >= 1)
+				decoder.reset_state();
+			else if (needState)
+				return false;
+			needState = false;
+
+			if (packSize > inSize - inPos || unpackSize > outEnd - outPos)
+				return false;
+
+			if (!decoder.decode(in + inPos, packSize, out, dictStart, outPos, outPos + unpackSize, observer))
+				return false;
+
+			inPos += packSize;
+			outPos += unpackSize;
+		}
+
+		return outPos == outEnd;
+	}
+
+	struct Lzma2Segment
+	{
+		size_t InOffset;
+		size_t OutOffset;
+	};
+
+	// Walks the chunk headers only; every chunk that resets the dictionary starts a new segment
+	bool index_lzma2_segments(const uint8_t* in, size_t inSize, size_t outSize, std::vector<Lzma2Segment>& segments_out)
+	{
+		size_t inPos = 0;
+		size_t outPos = 0;
+		while (inPos < inSize)
+		{
+			size_t chunkStart = inPos;
+			uint8_t control = in[inPos++];
+			if (control == 0x00)
+				break;
+
+			size_t unpackSize;
+			size_t packSize;
+			if (control < 0x80)
+			{
+				if (control > 0x02 || inSize - inPos < 2)
+					return false;
+				unpackSize = packSize = ((in[inPos] << 8) | in[inPos + 1]) + 1;
+				inPos += 2;
+			}
+			else
+			{
+				if (inSize - inPos < 4)
+					return false;
+				unpackSize = (static_cast<size_t>(control & 0x1F) << 16) + (in[inPos] << 8) + in[inPos + 1] + 1;
+				packSize = (in[inPos + 2] << 8) + in[inPos + 3] + 1;
+				inPos += ((control >> 5) & 3) >= 2 ? 5 : 4;
+			}
+
+			if (control == 0x01 || control >= 0xE0 || segments_out.empty())
+				segments_out.push_back({ chunkStart, outPos });
+
+			if (inPos > inSize || packSize > inSize - inPos || unpackSize > outSize - outPos)
+				return false;
+			inPos += packSize;
+			outPos += unpackSize;
+		}
+		return outPos == outSize;
+	}
+}
+
+bool parse_lzma_properties(const uint8_t* props, size_t propsSize, LzmaProperties& properties_out)
+{
+	if (propsSize < 5)
+		return false;
+
+	if (!decode_properties_byte(props[0], properties_out.LiteralContextBits, properties_out.LiteralPosBits, properties_out.PosBits))
+		return false;
+
+	properties_out.DictionarySize = props[1] | (props[2] << 8) | (props[3] << 16) | (static_cast<uint32_t>(props[4]) << 24);
+	return true;
+}
+
+bool lzma_decode(const LzmaProperties& properties, const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize, const LzmaOutputObserver* observer)
+{
+	LzmaDecoder decoder;
+	decoder.set_properties(properties.LiteralContextBits, properties.LiteralPosBits, properties.PosBits);
+	decoder.reset_state();
+	return decoder.decode(in, inSize, out, 0, 0, outSize, observer);
+}
+
+bool lzma2_decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize, Lzma2Stats* stats, const LzmaOutputObserver* observer)
+{
+	std::vector<Lzma2Segment> segments;
+	if (!index_lzma2_segments(in, inSize, outSize, segments))
+		return false;
+	if (segments.empty())
+		return outSize == 0;
+	segments.push_back({ inSize, outSize });
+
+	size_t numSegments = segments.size() - 1;
+	unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+	if (numThreads > numSegments)
+		numThreads = static_cast<unsigned int>(numSegments);
+
+	std::vector<std::chrono::steady_clock::duration> segmentTimes(numSegments);
+	std::atomic<size_t> nextSegment(0);
+	std::atomic<bool> failed(false);
+	auto decodeSegments = [&]()
+	{
+		size_t i;
+		while (!failed && (i = nextSegment++) < numSegments)
+		{
+			auto start = std::chrono::steady_clock::now();
+			if (!decode_lzma2_chunks(in, inSize, segments[i].InOffset, out, segments[i].OutOffset, segments[i + 1].OutOffset, observer))
+				failed = true;
+			segmentTimes[i] = std::chrono::steady_clock::now() - start;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.emplace_back(decodeSegments);
+	decodeSegments();
+	for (auto& thread : threads)
+		thread.join();
+
+	if (stats)
+	{
+		stats->Segments = numSegments;
+		stats->Threads = numThreads;
+		stats->SegmentTime = std::chrono::steady_clock::duration::zero();
+		for (auto& segmentTime : segmentTimes)
+			stats->SegmentTime += segmentTime;
+	}
+	return !failed;
+}
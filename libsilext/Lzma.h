@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+struct LzmaProperties
+{
+	unsigned int LiteralContextBits;
+	unsigned int LiteralPosBits;
+	unsigned int PosBits;
+	uint32_t DictionarySize;
+};
+
+// Parses the 5 byte LZMA coder properties (lc/lp/pb byte followed by the dictionary size)
+bool parse_lzma_properties(const uint8_t* props, size_t propsSize, LzmaProperties& properties_out);
+
+// Receives every range of the output once it is final, at most LzmaObserverStep bytes (or one LZMA2
+// chunk) after it was decoded, so that it is still in cache, e.g. to checksum it. Ranges of the same
+// LZMA2 segment are passed in order, those of different segments concurrently by their threads.
+typedef std::function<void(size_t offset, size_t size)> LzmaOutputObserver;
+
+const size_t LzmaObserverStep = 64 * 1024;
+
+// Decodes a raw LZMA stream of which the unpacked size is known up front. The whole
+// output buffer doubles as the dictionary, so no separate window is maintained.
+bool lzma_decode(const LzmaProperties& properties, const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize, const LzmaOutputObserver* observer = nullptr);
+
+struct Lzma2Stats
+{
+	size_t Segments;
+	unsigned int Threads;
+	std::chrono::steady_clock::duration SegmentTime; // Sum over all segments, i.e. the serial decode time
+};
+
+// Decodes a raw LZMA2 stream (a sequence of LZMA and uncompressed chunks) of known unpacked size.
+// Chunks that reset the dictionary split the stream into independent segments (as written by
+// multithreaded 7-Zip), which are decoded in parallel straight into their place in the output.
+bool lzma2_decode(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize, Lzma2Stats* stats = nullptr, const LzmaOutputObserver* observer = nullptr);
@@ -0,0 +1,541 @@
+#include "Lzx.h"
+
+#include <algorithm>
+#include <cstring>
+#include "Bcj.h"
+#include "Util.h"
+
+namespace
+{
+	const size_t FrameSize = 32768;
+	const uint64_t MaxIntelFrames = 32768;
+	const unsigned int MinMatch = 2;
+	const unsigned int NumPrimaryLengths = 7;
+	const unsigned int NumChars = 256;
+	const unsigned int MaxMainSymbols = NumChars + 50 * 8;
+	const unsigned int NumLengthSymbols = 249;
+	const unsigned int NumAlignedSymbols = 8;
+	const unsigned int NumPretreeSymbols = 20;
+	const unsigned int MaxCodeBits = 16;
+	const unsigned int FastBits = 10;
+
+	const uint8_t BlockVerbatim = 1;
+	const uint8_t BlockAligned = 2;
+	const uint8_t BlockUncompressed = 3;
+
+	struct PositionSlots
+	{
+		uint8_t ExtraBits[50];
+		uint32_t Base[50];
+
+		PositionSlots()
+		{
+			for (unsigned int i = 0; i < 50; i++)
+				ExtraBits[i] = static_cast<uint8_t>(i < 4 ? 0 : std::min(i / 2 - 1, 17u));
+			Base[0] = 0;
+			for (unsigned int i = 1; i < 50; i++)
+				Base[i] = Base[i - 1] + (1u << ExtraBits[i - 1]);
+		}
+	};
+
+	const PositionSlots Slots;
+
+	unsigned int get_position_slots(unsigned int windowBits)
+	{
+		return windowBits == 21 ? 50 : windowBits == 20 ? 42 : windowBits * 2;
+	}
+
+	// LZX reads 16-bit little endian words, starting at their most significant bit. The buffer
+	// keeps the unread bits at its top.
+	struct BitReader
+	{
+		const uint8_t* In;
+		const uint8_t* InEnd;
+		uint64_t Buffer = 0;
+		unsigned int Count = 0;
+
+		// Past the end zeros are shifted in; overrun() tells whether any of them were used
+		inline void fill()
+		{
+			while (Count <= 48)
+			{
+				uint64_t word = InEnd - In >= 2 ? In[0] | (In[1] << 8) : (In < InEnd ? In[0] : 0);
+				Buffer |= word << (48 - Count);
+				In += 2;
+				Count += 16;
+			}
+		}
+
+		inline uint32_t peek(unsigned int bits)
+		{
+			if (Count < bits)
+				fill();
+			return static_cast<uint32_t>(Buffer >> (64 - bits));
+		}
+
+		inline void drop(unsigned int bits)
+		{
+			Buffer <<= bits;
+			Count -= bits;
+		}
+
+		inline uint32_t read(unsigned int bits)
+		{
+			if (!bits)
+				return 0;
+			uint32_t value = peek(bits);
+			drop(bits);
+			return value;
+		}
+
+		bool overrun() const
+		{
+			return In - Count / 16 * 2 > InEnd;
+		}
+
+		// Uncompressed blocks start on the next 16-bit boundary, after 1 to 16 bits of padding.
+		// The unread words go back to the input, which is then read bytewise.
+		void align()
+		{
+			if (Count % 16)
+				drop(Count % 16);
+			else if (Count)
+				drop(16);
+			else
+				In += 2;
+			In -= Count / 8;
+			Buffer = 0;
+			Count = 0;
+		}
+	};
+
+	// A canonical Huffman code: codes of up to FastBits are decoded with one table lookup, longer
+	// ones by walking the code lengths. An empty code is valid as long as it is not used.
+	struct HuffmanCode
+	{
+		uint16_t Fast[1 << FastBits]; // Symbol << 5 | length, 0 if the code is longer
+		uint16_t Counts[MaxCodeBits + 1];
+		uint16_t Symbols[MaxMainSymbols];
+
+		bool build(const uint8_t* lengths, unsigned int numSymbols)
+		{
+			std::fill(Counts, Counts + MaxCodeBits + 1, 0);
+			for (unsigned int i = 0; i < numSymbols; i++)
+				Counts[lengths[i]]++;
+			Counts[0] = 0;
+
+			int left = 1;
+			uint16_t offsets[MaxCodeBits + 2] = {};
+			for (unsigned int len = 1; len <= MaxCodeBits; len++)
+			{
+				left = (left << 1) - Counts[len];
+				if (left < 0)
+					return false;
+				offsets[len + 1] = offsets[len] + Counts[len];
+			}
+			for (unsigned int i = 0; i < numSymbols; i++)
+			{
+				if (lengths[i])
+					Symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+			}
+
+			std::fill(Fast, Fast + (1 << FastBits), 0);
+			unsigned int code = 0;
+			unsigned int index = 0;
+			for (unsigned int len = 1; len <= FastBits; len++)
+			{
+				for (unsigned int i = 0; i < Counts[len]; i++, code++, index++)
+				{
+					unsigned int first = code << (FastBits - len);
+					std::fill(Fast + first, Fast + first + (1u << (FastBits - len)), static_cast<uint16_t>((Symbols[index] << 5) | len));
+				}
+				code <<= 1;
+			}
+			return true;
+		}
+
+		// Returns -1 for a code that is not part of the code
+		inline int decode(BitReader& bits) const
+		{
+			uint32_t peeked = bits.peek(MaxCodeBits);
+			uint16_t entry = Fast[peeked >> (MaxCodeBits - FastBits)];
+			if (entry)
+			{
+				bits.drop(entry & 31);
+				return entry >> 5;
+			}
+
+			int code = 0;
+			int first = 0;
+			int index = 0;
+			for (unsigned int len = 1; len <= MaxCodeBits; len++)
+			{
+				code |= (peeked >> (MaxCodeBits - len)) & 1;
+				int count = Counts[len];
+				if (code - first < count)
+				{
+					bits.drop(len);
+					return Symbols[index + code - first];
+				}
+				index += count;
+				first = (first + count) << 1;
+				code <<= 1;
+			}
+			return -1;
+		}
+	};
+
+	// Code lengths are sent through a pretree, as differences (mod 17) to the previous lengths
+	bool read_lengths(BitReader& bits, uint8_t* lengths, unsigned int first, unsigned int last)
+	{
+		uint8_t pretreeLengths[NumPretreeSymbols];
+		for (unsigned int i = 0; i < NumPretreeSymbols; i++)
+			pretreeLengths[i] = static_cast<uint8_t>(bits.read(4));
+
+		HuffmanCode pretree;
+		if (!pretree.build(pretreeLengths, NumPretreeSymbols))
+			return false;
+
+		for (unsigned int i = first; i < last;)
+		{
+			int symbol = pretree.decode(bits);
+			if (symbol < 0)
+				return false;
+
+			unsigned int repeat = 1;
+			uint8_t value = 0;
+			if (symbol == 17)
+			{
+				repeat = bits.read(4) + 4;
+			}
+			else if (symbol == 18)
+			{
+				repeat = bits.read(5) + 20;
+			}
+			else
+			{
+				if (symbol == 19)
+				{
+					repeat = bits.read(1) + 4;
+					symbol = pretree.decode(bits);
+					if (symbol < 0 || symbol > 16)
+						return false;
+				}
+				value = static_cast<uint8_t>((lengths[i] + 17 - symbol) % 17);
+			}
+
+			if (repeat > last - i)
+				return false;
+			std::fill(lengths + i, lengths + i + repeat, value);
+			i += repeat;
+		}
+		return !bits.overrun();
+	}
+}
+
+struct LzxDecoder::State
+{
+	unsigned int WindowBits;
+	unsigned int MainSymbols;
+	std::vector<uint8_t> Window;
+
+	uint64_t Position = 0; // Decoded into the window; a match may run into the next frame
+	uint64_t OutputPosition = 0; // Returned by decode_block
+	uint32_t Repeated[3] = { 1, 1, 1 };
+	uint8_t BlockType = 0;
+	uint32_t BlockLength = 0;
+	uint32_t BlockRemaining = 0;
+	bool HeaderRead = false;
+	bool IntelStarted = false;
+	int32_t IntelFileSize = 0;
+
+	uint8_t MainLengths[MaxMainSymbols] = {};
+	uint8_t LengthLengths[NumLengthSymbols] = {};
+	uint8_t AlignedLengths[NumAlignedSymbols] = {};
+	HuffmanCode MainCode;
+	HuffmanCode LengthCode;
+	HuffmanCode AlignedCode;
+
+	bool build_codes()
+	{
+		return MainCode.build(MainLengths, MainSymbols) && LengthCode.build(LengthLengths, NumLengthSymbols)
+			&& AlignedCode.build(AlignedLengths, NumAlignedSymbols);
+	}
+
+	bool read_block_header(BitReader& bits, bool paddingPending)
+	{
+		// An uncompressed block of odd length is followed by a padding byte
+		if (paddingPending)
+		{
+			if (bits.In >= bits.InEnd)
+				return false;
+			bits.In++;
+		}
+
+		BlockType = static_cast<uint8_t>(bits.read(3));
+		uint32_t high = bits.read(16);
+		BlockLength = BlockRemaining = (high << 8) | bits.read(8);
+
+		switch (BlockType)
+		{
+		case BlockAligned:
+			for (unsigned int i = 0; i < NumAlignedSymbols; i++)
+				AlignedLengths[i] = static_cast<uint8_t>(bits.read(3));
+			[[fallthrough]];
+		case BlockVerbatim:
+			if (!read_lengths(bits, MainLengths, 0, NumChars) || !read_lengths(bits, MainLengths, NumChars, MainSymbols)
+				|| !read_lengths(bits, LengthLengths, 0, NumLengthSymbols) || !build_codes())
+				return false;
+			if (MainLengths[0xE8])
+				IntelStarted = true;
+			return true;
+		case BlockUncompressed:
+			IntelStarted = true;
+			bits.align();
+			if (bits.InEnd - bits.In < 12)
+				return false;
+			for (unsigned int i = 0; i < 3; i++)
+				memcpy(&Repeated[i], bits.In + 4 * i, 4);
+			bits.In += 12;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Decodes the matches and literals of a verbatim or aligned block up to runEnd; the last
+	// match may run past it, but not past the end of the block
+	bool decode_run(BitReader& bits, uint64_t runEnd)
+	{
+		const size_t windowMask = Window.size() - 1;
+		uint8_t* window = Window.data();
+		uint64_t pos = Position;
+		uint64_t blockEnd = Position + BlockRemaining;
+		uint32_t r0 = Repeated[0], r1 = Repeated[1], r2 = Repeated[2];
+
+		while (pos < runEnd)
+		{
+			int symbol = MainCode.decode(bits);
+			if (symbol < 0)
+				return false;
+
+			if (symbol < static_cast<int>(NumChars))
+			{
+				window[pos & windowMask] = static_cast<uint8_t>(symbol);
+				pos++;
+				continue;
+			}
+
+			symbol -= NumChars;
+			uint32_t length = symbol & 7;
+			if (length == NumPrimaryLengths)
+			{
+				int footer = LengthCode.decode(bits);
+				if (footer < 0)
+					return false;
+				length += footer;
+			}
+			length += MinMatch;
+
+			unsigned int slot = symbol >> 3;
+			uint32_t offset;
+			if (slot == 0)
+			{
+				offset = r0;
+			}
+			else if (slot == 1)
+			{
+				offset = r1;
+				r1 = r0;
+				r0 = offset;
+			}
+			else if (slot == 2)
+			{
+				offset = r2;
+				r2 = r0;
+				r0 = offset;
+			}
+			else
+			{
+				unsigned int extra = Slots.ExtraBits[slot];
+				offset = Slots.Base[slot] - 2;
+				if (BlockType == BlockAligned && extra >= 3)
+				{
+					offset += bits.read(extra - 3) << 3;
+					int aligned = AlignedCode.decode(bits);
+					if (aligned < 0)
+						return false;
+					offset += aligned;
+				}
+				else
+				{
+					offset += bits.read(extra);
+				}
+				r2 = r1;
+				r1 = r0;
+				r0 = offset;
+			}
+
+			if (offset > pos || offset >= Window.size() || length > blockEnd - pos)
+				return false;
+
+			size_t dest = pos & windowMask;
+			size_t src = (pos - offset) & windowMask;
+			if (offset >= length && dest + length <= Window.size() && src + length <= Window.size())
+			{
+				memcpy(window + dest, window + src, length);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < length; i++)
+					window[(dest + i) & windowMask] = window[(src + i) & windowMask];
+			}
+			pos += length;
+		}
+
+		BlockRemaining -= static_cast<uint32_t>(pos - Position);
+		Position = pos;
+		Repeated[0] = r0;
+		Repeated[1] = r1;
+		Repeated[2] = r2;
+		return !bits.overrun();
+	}
+
+	// Call instructions were translated to absolute targets by the compressor, as in the BCJ filter
+	void translate_e8(uint8_t* data, size_t size) const
+	{
+		if (size <= 10 || !IntelStarted || !IntelFileSize || OutputPosition / FrameSize >= MaxIntelFrames)
+			return;
+
+		const size_t end = size - 10;
+		for (size_t pos = find_x86_branch(data, 0, end, false); pos < end; pos = find_x86_branch(data, pos + 5, end, false))
+		{
+			int32_t absolute;
+			memcpy(&absolute, data + pos + 1, 4);
+			int32_t current = static_cast<int32_t>(OutputPosition + pos);
+			if (absolute >= -current && absolute < IntelFileSize)
+			{
+				int32_t relative = absolute >= 0 ? absolute - current : absolute + IntelFileSize;
+				memcpy(data + pos + 1, &relative, 4);
+			}
+		}
+	}
+};
+
+LzxDecoder::LzxDecoder(unsigned int windowBits)
+	: state(std::make_unique<State>())
+{
+	state->WindowBits = windowBits;
+	state->MainSymbols = NumChars + get_position_slots(windowBits) * 8;
+	state->Window.resize(static_cast<size_t>(1) << windowBits);
+}
+
+LzxDecoder::~LzxDecoder() = default;
+
+// Every block starts a new bit stream; what is left of the previous block is alignment padding
+bool LzxDecoder::decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize)
+{
+	State& s = *state;
+	if (outSize > FrameSize || s.Position - s.OutputPosition > outSize)
+		return false;
+
+	BitReader bits;
+	bits.In = in;
+	bits.InEnd = in + inSize;
+
+	if (!s.HeaderRead)
+	{
+		if (bits.read(1))
+		{
+			uint32_t high = bits.read(16);
+			s.IntelFileSize = static_cast<int32_t>((high << 16) | bits.read(16));
+		}
+		s.HeaderRead = true;
+	}
+
+	const uint64_t frameEnd = s.OutputPosition + outSize;
+	bool paddingPending = false;
+	while (s.Position < frameEnd)
+	{
+		if (s.BlockRemaining == 0)
+		{
+			if (!s.read_block_header(bits, paddingPending) || bits.overrun())
+				return false;
+			paddingPending = false;
+		}
+
+		uint64_t runEnd = s.Position + std::min<uint64_t>(s.BlockRemaining, frameEnd - s.Position);
+		if (s.BlockType == BlockUncompressed)
+		{
+			size_t count = static_cast<size_t>(runEnd - s.Position);
+			if (static_cast<size_t>(bits.InEnd - bits.In) < count)
+				return false;
+
+			size_t dest = s.Position & (s.Window.size() - 1);
+			memcpy(s.Window.data() + dest, bits.In, count);
+			bits.In += count;
+			s.Position += count;
+			s.BlockRemaining -= static_cast<uint32_t>(count);
+			paddingPending = s.BlockRemaining == 0 && (s.BlockLength & 1);
+		}
+		else if (!s.decode_run(bits, runEnd))
+		{
+			return false;
+		}
+	}
+
+	// Frames never wrap around the window, as its size is a multiple of the frame size
+	memcpy(out, s.Window.data() + (s.OutputPosition & (s.Window.size() - 1)), outSize);
+	s.translate_e8(out, outSize);
+	s.OutputPosition = frameEnd;
+	return true;
+}
+
+void LzxDecoder::save_state(std::vector<uint8_t>& state_out) const
+{
+	const State& s = *state;
+	state_out.clear();
+	append_value(state_out, s.Position);
+	append_value(state_out, s.OutputPosition);
+	append_value(state_out, s.Repeated);
+	append_value(state_out, s.BlockType);
+	append_value(state_out, s.BlockLength);
+	append_value(state_out, s.BlockRemaining);
+	append_value(state_out, s.HeaderRead);
+	append_value(state_out, s.IntelStarted);
+	append_value(state_out, s.IntelFileSize);
+	append_value(state_out, s.MainLengths);
+	append_value(state_out, s.LengthLengths);
+	append_value(state_out, s.AlignedLengths);
+
+	// The window as far as it has been filled, oldest byte first
+	const size_t windowMask = s.Window.size() - 1;
+	size_t filled = static_cast<size_t>(std::min<uint64_t>(s.Position, s.Window.size()));
+	size_t start = static_cast<size_t>(s.Position - filled) & windowMask;
+	size_t first = std::min(filled, s.Window.size() - start);
+	state_out.insert(state_out.end(), s.Window.begin() + start, s.Window.begin() + start + first);
+	state_out.insert(state_out.end(), s.Window.begin(), s.Window.begin() + (filled - first));
+}
+
+bool LzxDecoder::restore_state(const uint8_t* data, size_t size)
+{
+	State& s = *state;
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+	if (!read_value(p, end, s.Position) || !read_value(p, end, s.OutputPosition) || !read_value(p, end, s.Repeated)
+		|| !read_value(p, end, s.BlockType) || !read_value(p, end, s.BlockLength) || !read_value(p, end, s.BlockRemaining)
+		|| !read_value(p, end, s.HeaderRead) || !read_value(p, end, s.IntelStarted) || !read_value(p, end, s.IntelFileSize)
+		|| !read_value(p, end, s.MainLengths) || !read_value(p, end, s.LengthLengths) || !read_value(p, end, s.AlignedLengths))
+		return false;
+
+	const size_t windowMask = s.Window.size() - 1;
+	size_t filled = static_cast<size_t>(std::min<uint64_t>(s.Position, s.Window.size()));
+	if (static_cast<size_t>(end - p) != filled || s.Position < s.OutputPosition)
+		return false;
+
+	size_t start = static_cast<size_t>(s.Position - filled) & windowMask;
+	size_t first = std::min(filled, s.Window.size() - start);
+	std::copy(p, p + first, s.Window.begin() + start);
+	std::copy(p + first, end, s.Window.begin());
+	return s.build_codes();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Cabinet.h"
+
+// LZX as used in cabinets: one stream per folder with a window of 2^windowBits bytes (15 to 21),
+// of which every CFDATA block holds one 32KB frame. The state between two blocks is the window, the
+// repeated offsets, the code lengths (new trees are coded relative to them) and the position in
+// the current LZX block; the bit position is always the start of the next CFDATA block.
+class LzxDecoder : public FolderDecoder
+{
+public:
+	explicit LzxDecoder(unsigned int windowBits);
+	~LzxDecoder() override;
+
+	bool decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) override;
+	void save_state(std::vector<uint8_t>& state_out) const override;
+	bool restore_state(const uint8_t* state, size_t size) override;
+
+private:
+	struct State;
+	std::unique_ptr<State> state;
+};
@@ -0,0 +1,254 @@
+#include "Md5.h"
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include "Cpu.h"
+
+namespace
+{
+	const uint32_t InitialState[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+
+	const uint32_t RoundConstants[64] = {
+		0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+		0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+		0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+		0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+		0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+		0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+		0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+		0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+	};
+
+	const int Shifts[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+
+	inline uint32_t read_uint32_le(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+	inline uint32_t rotl(uint32_t x, int n)
+	{
+		return (x << n) | (x >> (32 - n));
+	}
+
+	// The message word a round takes
+	inline int get_word_index(int t)
+	{
+		switch (t / 16)
+		{
+		case 0: return t;
+		case 1: return (5 * t + 1) & 15;
+		case 2: return (3 * t + 5) & 15;
+		default: return (7 * t) & 15;
+		}
+	}
+
+	void compress(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		for (; count; blocks += 64, count--)
+		{
+			uint32_t m[16];
+			for (int t = 0; t < 16; t++)
+				m[t] = read_uint32_le(blocks + 4 * t);
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			for (int t = 0; t < 64; t++)
+			{
+				uint32_t f;
+				switch (t / 16)
+				{
+				case 0: f = (b & c) | (~b & d); break;
+				case 1: f = (d & b) | (~d & c); break;
+				case 2: f = b ^ c ^ d; break;
+				default: f = c ^ (b | ~d); break;
+				}
+				uint32_t rotated = rotl(a + f + RoundConstants[t] + m[get_word_index(t)], Shifts[t / 16][t & 3]);
+				a = d;
+				d = c;
+				c = b;
+				b += rotated;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		}
+	}
+
+	// The final one or two blocks of a message: its remaining bytes, the 0x80 marker, zeros and the
+	// length in bits. Returns the number of blocks.
+	size_t pad_message(const uint8_t* rest, size_t restSize, uint64_t length, uint8_t* tail)
+	{
+		size_t tailSize = restSize + 9 > 64 ? 128 : 64;
+		memset(tail, 0, tailSize);
+		memcpy(tail, rest, restSize);
+		tail[restSize] = 0x80;
+		for (int i = 0; i < 8; i++)
+			tail[tailSize - 8 + i] = static_cast<uint8_t>((length * 8) >> (8 * i));
+		return tailSize / 64;
+	}
+
+	Md5Digest get_digest(const uint32_t* state)
+	{
+		Md5Digest digest;
+		for (int i = 0; i < 4; i++)
+		{
+			digest[4 * i] = static_cast<uint8_t>(state[i]);
+			digest[4 * i + 1] = static_cast<uint8_t>(state[i] >> 8);
+			digest[4 * i + 2] = static_cast<uint8_t>(state[i] >> 16);
+			digest[4 * i + 3] = static_cast<uint8_t>(state[i] >> 24);
+		}
+		return digest;
+	}
+
+	inline __m256i rotl8(__m256i x, int n)
+	{
+		return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+	}
+
+	// A message in a lane of the multi-buffer hash; its blocks are taken from the data in place, and
+	// then from the padded tail
+	struct Lane
+	{
+		size_t Message;
+		size_t Block;
+		size_t FullBlocks;
+		size_t Blocks;
+		uint8_t Tail[128];
+
+		const uint8_t* get_block(const uint8_t* data) const
+		{
+			return Block < FullBlocks ? data + 64 * Block : Tail + 64 * (Block - FullBlocks);
+		}
+	};
+
+	// Eight messages at a time, one per 32-bit lane: the same rounds as compress on vectors
+	void md5_many_avx2(const uint8_t* const* data, const size_t* sizes, size_t count, Md5Digest* digests_out)
+	{
+		const size_t NumLanes = 8;
+		const size_t Idle = static_cast<size_t>(-1);
+
+		Lane lanes[NumLanes];
+		alignas(32) uint32_t state[4][NumLanes];
+		size_t next = 0;
+		auto start_message = [&](size_t lane)
+		{
+			Lane& l = lanes[lane];
+			l.Message = next < count ? next++ : Idle;
+			l.Block = 0;
+			if (l.Message == Idle)
+				return;
+			l.FullBlocks = sizes[l.Message] / 64;
+			l.Blocks = l.FullBlocks + pad_message(data[l.Message] + 64 * l.FullBlocks, sizes[l.Message] % 64, sizes[l.Message], l.Tail);
+			for (int i = 0; i < 4; i++)
+				state[i][lane] = InitialState[i];
+		};
+		for (size_t lane = 0; lane < NumLanes; lane++)
+			start_message(lane);
+
+		const __m256i ones = _mm256_set1_epi32(-1);
+		while (true)
+		{
+			bool active = false;
+			alignas(32) uint32_t words[16][NumLanes];
+			for (size_t lane = 0; lane < NumLanes; lane++)
+			{
+				const uint8_t* block = lanes[lane].Message == Idle ? lanes[0].Tail : lanes[lane].get_block(data[lanes[lane].Message]);
+				active |= lanes[lane].Message != Idle;
+				for (int t = 0; t < 16; t++)
+					words[t][lane] = read_uint32_le(block + 4 * t);
+			}
+			if (!active)
+				break;
+
+			__m256i m[16];
+			for (int t = 0; t < 16; t++)
+				m[t] = _mm256_load_si256(reinterpret_cast<const __m256i*>(words[t]));
+			__m256i v[4];
+			for (int i = 0; i < 4; i++)
+				v[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[i]));
+
+			__m256i a = v[0], b = v[1], c = v[2], d = v[3];
+			for (int t = 0; t < 64; t++)
+			{
+				__m256i f;
+				switch (t / 16)
+				{
+				case 0: f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d)); break;
+				case 1: f = _mm256_or_si256(_mm256_and_si256(d, b), _mm256_andnot_si256(d, c)); break;
+				case 2: f = _mm256_xor_si256(_mm256_xor_si256(b, c), d); break;
+				default: f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones))); break;
+				}
+				__m256i sum = _mm256_add_epi32(_mm256_add_epi32(a, f), _mm256_add_epi32(m[get_word_index(t)], _mm256_set1_epi32(static_cast<int>(RoundConstants[t]))));
+				a = d;
+				d = c;
+				c = b;
+				b = _mm256_add_epi32(b, rotl8(sum, Shifts[t / 16][t & 3]));
+			}
+
+			__m256i result[4] = { a, b, c, d };
+			for (int i = 0; i < 4; i++)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(state[i]), _mm256_add_epi32(v[i], result[i]));
+
+			for (size_t lane = 0; lane < NumLanes; lane++)
+			{
+				Lane& l = lanes[lane];
+				if (l.Message == Idle || ++l.Block < l.Blocks)
+					continue;
+
+				uint32_t laneState[4];
+				for (int i = 0; i < 4; i++)
+					laneState[i] = state[i][lane];
+				digests_out[l.Message] = get_digest(laneState);
+				start_message(lane);
+			}
+		}
+	}
+}
+
+Md5::Md5()
+{
+	memcpy(state, InitialState, sizeof(state));
+}
+
+void Md5::update(const uint8_t* data, size_t size)
+{
+	length += size;
+	if (buffered)
+	{
+		size_t count = std::min(size, sizeof(buffer) - buffered);
+		memcpy(buffer + buffered, data, count);
+		buffered += count;
+		data += count;
+		size -= count;
+		if (buffered < sizeof(buffer))
+			return;
+		compress(state, buffer, 1);
+		buffered = 0;
+	}
+
+	compress(state, data, size / 64);
+	buffered = size % 64;
+	memcpy(buffer, data + size - buffered, buffered);
+}
+
+Md5Digest Md5::finish()
+{
+	uint8_t tail[128];
+	compress(state, tail, pad_message(buffer, buffered, length, tail));
+	return get_digest(state);
+}
+
+void md5_many(const uint8_t* const* data, const size_t* sizes, size_t count, Md5Digest* digests_out)
+{
+	if (get_cpu_features().Avx2)
+	{
+		md5_many_avx2(data, sizes, count, digests_out);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Md5 hash;
+		hash.update(data[i], sizes[i]);
+		digests_out[i] = hash.finish();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+typedef std::array<uint8_t, 16> Md5Digest;
+
+// Incremental MD5, only used to check files against the hashes an MSI database holds for them
+class Md5
+{
+public:
+	Md5();
+
+	void update(const uint8_t* data, size_t size);
+
+	Md5Digest finish();
+
+private:
+	uint32_t state[4];
+	uint8_t buffer[64];
+	size_t buffered = 0;
+	uint64_t length = 0;
+};
+
+// Hashes count whole messages. There are no instructions for MD5, but AVX2 runs eight messages side
+// by side in the lanes of its vectors like sha256_many.
+void md5_many(const uint8_t* const* data, const size_t* sizes, size_t count, Md5Digest* digests_out);
@@ -0,0 +1,141 @@
+#include "MetadataCache.h"
+
+#include <cstring>
+#include "Util.h"
+
+namespace
+{
+	const char MetadataMagic[4] = { 'S', 'L', 'X', 'M' };
+	const uint32_t MetadataVersion = 3;
+
+	// Strings are stored as their length in UTF-16 code units, followed by the code units
+	void append_string(std::vector<uint8_t>& out, const std::wstring& s)
+	{
+		append_value(out, static_cast<uint32_t>(s.size()));
+		auto bytes = reinterpret_cast<const uint8_t*>(s.data());
+		out.insert(out.end(), bytes, bytes + s.size() * sizeof(wchar_t));
+	}
+
+	bool read_string(const uint8_t*& p, const uint8_t* end, std::wstring& s_out)
+	{
+		uint32_t length;
+		if (!read_value(p, end, length) || static_cast<size_t>(end - p) / sizeof(wchar_t) < length)
+			return false;
+		s_out.resize(length);
+		memcpy(&s_out[0], p, length * sizeof(wchar_t));
+		p += length * sizeof(wchar_t);
+		return true;
+	}
+}
+
+Sha256Digest hash_setup(const uint8_t* data, size_t size)
+{
+	Sha256 hash;
+	hash.update(data, size);
+	return hash.finish();
+}
+
+std::wstring get_metadata_cache_path(const std::wstring& cacheDir, const Sha256Digest& setupHash)
+{
+	return concat_path(cacheDir, to_hex(setupHash.data(), setupHash.size()) + L".silmeta");
+}
+
+bool save_setup_metadata(const std::wstring& path, const SetupMetadata& metadata)
+{
+	std::vector<uint8_t> out;
+	append_value(out, MetadataMagic);
+	append_value(out, MetadataVersion);
+	append_value(out, metadata.SetupHash);
+
+	append_value(out, static_cast<uint32_t>(metadata.Info.Directories.size()));
+	for (auto& directory : metadata.Info.Directories)
+	{
+		append_string(out, directory.first);
+		append_string(out, directory.second.ParentKey);
+		append_string(out, directory.second.Name);
+	}
+
+	append_value(out, static_cast<uint32_t>(metadata.Info.Files.size()));
+	for (auto& file : metadata.Info.Files)
+	{
+		append_string(out, file.first);
+		append_string(out, file.second.FileName);
+		append_string(out, file.second.DirectoryKey);
+		append_value(out, static_cast<uint8_t>(file.second.Md5.has_value()));
+		if (file.second.Md5)
+			append_value(out, *file.second.Md5);
+	}
+
+	append_value(out, static_cast<uint32_t>(metadata.Files.size()));
+	for (size_t i = 0; i < metadata.Files.size(); i++)
+	{
+		auto& entry = metadata.Files[i];
+		append_string(out, entry.Name);
+		append_string(out, metadata.Paths[i]);
+		append_value(out, entry.Size);
+		append_value(out, entry.FolderOffset);
+		append_value(out, entry.Folder);
+		append_value(out, entry.Date);
+		append_value(out, entry.Time);
+		append_value(out, entry.Attributes);
+	}
+	return write_file(path, out.data(), out.size());
+}
+
+bool load_setup_metadata(const std::wstring& path, const Sha256Digest& setupHash, SetupMetadata& metadata_out)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	const uint8_t* p = file.get_data();
+	const uint8_t* end = p + file.get_size();
+	char magic[4];
+	uint32_t version;
+	if (!read_value(p, end, magic) || memcmp(magic, MetadataMagic, sizeof(magic)) != 0 || !read_value(p, end, version) || version != MetadataVersion
+		|| !read_value(p, end, metadata_out.SetupHash) || metadata_out.SetupHash != setupHash)
+		return false;
+
+	uint32_t numDirectories;
+	if (!read_value(p, end, numDirectories))
+		return false;
+	for (uint32_t i = 0; i < numDirectories; i++)
+	{
+		std::wstring key;
+		DirInfo directory;
+		if (!read_string(p, end, key) || !read_string(p, end, directory.ParentKey) || !read_string(p, end, directory.Name))
+			return false;
+		metadata_out.Info.Directories.emplace_hint(metadata_out.Info.Directories.end(), std::move(key), std::move(directory));
+	}
+
+	uint32_t numFiles;
+	if (!read_value(p, end, numFiles))
+		return false;
+	for (uint32_t i = 0; i < numFiles; i++)
+	{
+		std::wstring key;
+		FileInfo fileInfo;
+		uint8_t hasMd5;
+		if (!read_string(p, end, key) || !read_string(p, end, fileInfo.FileName) || !read_string(p, end, fileInfo.DirectoryKey)
+			|| !read_value(p, end, hasMd5))
+			return false;
+		if (hasMd5 && !read_value(p, end, fileInfo.Md5.emplace()))
+			return false;
+		metadata_out.Info.Files.emplace_hint(metadata_out.Info.Files.end(), std::move(key), std::move(fileInfo));
+	}
+
+	uint32_t numEntries;
+	if (!read_value(p, end, numEntries))
+		return false;
+	metadata_out.Files.resize(numEntries);
+	metadata_out.Paths.resize(numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		auto& entry = metadata_out.Files[i];
+		if (!read_string(p, end, entry.Name) || !read_string(p, end, metadata_out.Paths[i]) || !read_value(p, end, entry.Size)
+			|| !read_value(p, end, entry.FolderOffset) || !read_value(p, end, entry.Folder) || !read_value(p, end, entry.Date)
+			|| !read_value(p, end, entry.Time) || !read_value(p, end, entry.Attributes))
+			return false;
+	}
+	return p == end;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Cabinet.h"
+#include "Sha256.h"
+#include "Silext.h"
+
+// The metadata of an installer once its MSI and transform are applied: the File (with the hashes of
+// MsiFileHash) and Directory tables, and every file of the payload cabinet with the path the tables
+// give it in the whole tree (empty if they do not list it). A repeat run for the same setup EXE loads
+// it instead of running the MSI stages.
+struct SetupMetadata
+{
+	Sha256Digest SetupHash;
+	DbInfo Info;
+	std::vector<CabinetEntry> Files;
+	std::vector<std::wstring> Paths; // Of Files, before the ExtractOptions are applied
+};
+
+// The SHA-256 of the whole setup EXE. It is the only check that cached metadata or a plan belongs to
+// the installer, so it has to withstand installers crafted to collide with another one.
+Sha256Digest hash_setup(const uint8_t* data, size_t size);
+
+// The cache file of a setup EXE in cacheDir, named after its hash
+std::wstring get_metadata_cache_path(const std::wstring& cacheDir, const Sha256Digest& setupHash);
+
+bool save_setup_metadata(const std::wstring& path, const SetupMetadata& metadata);
+
+// The file is mapped and its fields are copied out of the mapping into metadata_out; returns false if it
+// is missing, invalid or for another setup EXE
+bool load_setup_metadata(const std::wstring& path, const Sha256Digest& setupHash, SetupMetadata& metadata_out);
@@ -0,0 +1,336 @@
+#include "Mszip.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const size_t HistorySize = 32768;
+	const unsigned int MaxCodeBits = 15;
+	const unsigned int FastBits = 9;
+	const unsigned int NumLitLenSymbols = 288;
+	const unsigned int NumDistSymbols = 32;
+
+	const uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const uint8_t LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const uint16_t DistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const uint8_t DistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const uint8_t CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	// Deflate packs the bits starting at the least significant bit of every byte
+	struct BitReader
+	{
+		const uint8_t* In;
+		const uint8_t* InEnd;
+		uint64_t Buffer = 0;
+		unsigned int Count = 0;
+
+		// Past the end zeros are shifted in; overrun() tells whether any of them were used
+		inline void fill()
+		{
+			while (Count <= 56)
+			{
+				Buffer |= static_cast<uint64_t>(In < InEnd ? *In : 0) << Count;
+				In++;
+				Count += 8;
+			}
+		}
+
+		inline uint32_t read(unsigned int bits)
+		{
+			if (Count < bits)
+				fill();
+			uint32_t value = static_cast<uint32_t>(Buffer & ((1ull << bits) - 1));
+			Buffer >>= bits;
+			Count -= bits;
+			return value;
+		}
+
+		bool overrun() const
+		{
+			return In - Count / 8 > InEnd;
+		}
+
+		// Drops the bits up to the next byte boundary, and returns the unread bytes to the input
+		void align()
+		{
+			Buffer >>= Count % 8;
+			Count -= Count % 8;
+			In -= Count / 8;
+			Buffer = 0;
+			Count = 0;
+		}
+	};
+
+	// A canonical Huffman code: codes of up to FastBits are decoded with one table lookup,
+	// longer ones by walking the code lengths
+	struct HuffmanCode
+	{
+		uint16_t Fast[1 << FastBits]; // Symbol << 4 | length, 0 if the code is longer
+		uint16_t Counts[MaxCodeBits + 1];
+		uint16_t Symbols[NumLitLenSymbols];
+
+		bool build(const uint8_t* lengths, unsigned int numSymbols)
+		{
+			std::fill(Counts, Counts + MaxCodeBits + 1, 0);
+			for (unsigned int i = 0; i < numSymbols; i++)
+				Counts[lengths[i]]++;
+			Counts[0] = 0;
+
+			// Over-subscribed codes are invalid; incomplete ones occur (a single distance code)
+			int left = 1;
+			uint16_t offsets[MaxCodeBits + 2] = {};
+			for (unsigned int len = 1; len <= MaxCodeBits; len++)
+			{
+				left = (left << 1) - Counts[len];
+				if (left < 0)
+					return false;
+				offsets[len + 1] = offsets[len] + Counts[len];
+			}
+			for (unsigned int i = 0; i < numSymbols; i++)
+			{
+				if (lengths[i])
+					Symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+			}
+
+			std::fill(Fast, Fast + (1 << FastBits), 0);
+			unsigned int code = 0;
+			unsigned int index = 0;
+			for (unsigned int len = 1; len <= FastBits; len++)
+			{
+				for (unsigned int i = 0; i < Counts[len]; i++, code++, index++)
+				{
+					unsigned int reversed = 0;
+					for (unsigned int bit = 0; bit < len; bit++)
+						reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+					for (unsigned int fill = reversed; fill < (1u << FastBits); fill += 1u << len)
+						Fast[fill] = static_cast<uint16_t>((Symbols[index] << 4) | len);
+				}
+				code <<= 1;
+			}
+			return true;
+		}
+
+		// Returns -1 for a code that is not part of an incomplete code
+		inline int decode(BitReader& bits) const
+		{
+			if (bits.Count < MaxCodeBits)
+				bits.fill();
+
+			uint16_t entry = Fast[bits.Buffer & ((1 << FastBits) - 1)];
+			if (entry)
+			{
+				bits.Buffer >>= entry & 15;
+				bits.Count -= entry & 15;
+				return entry >> 4;
+			}
+
+			int code = 0;
+			int first = 0;
+			int index = 0;
+			for (unsigned int len = 1; len <= MaxCodeBits; len++)
+			{
+				code |= static_cast<int>(bits.Buffer & 1);
+				bits.Buffer >>= 1;
+				bits.Count--;
+				int count = Counts[len];
+				if (code - first < count)
+					return Symbols[index + code - first];
+				index += count;
+				first = (first + count) << 1;
+				code <<= 1;
+			}
+			return -1;
+		}
+	};
+
+	struct Inflater
+	{
+		BitReader Bits;
+		uint8_t* Out;
+		size_t Pos;
+		size_t Limit;
+		HuffmanCode LitLen;
+		HuffmanCode Dist;
+
+		bool stored()
+		{
+			Bits.align();
+			if (Bits.InEnd - Bits.In < 4)
+				return false;
+
+			uint16_t length = static_cast<uint16_t>(Bits.In[0] | (Bits.In[1] << 8));
+			uint16_t check = static_cast<uint16_t>(Bits.In[2] | (Bits.In[3] << 8));
+			Bits.In += 4;
+			if (length != static_cast<uint16_t>(~check) || Bits.InEnd - Bits.In < length || Limit - Pos < length)
+				return false;
+
+			memcpy(Out + Pos, Bits.In, length);
+			Bits.In += length;
+			Pos += length;
+			return true;
+		}
+
+		bool fixed_codes()
+		{
+			uint8_t lengths[NumLitLenSymbols + NumDistSymbols];
+			std::fill(lengths, lengths + 144, 8);
+			std::fill(lengths + 144, lengths + 256, 9);
+			std::fill(lengths + 256, lengths + 280, 7);
+			std::fill(lengths + 280, lengths + NumLitLenSymbols, 8);
+			std::fill(lengths + NumLitLenSymbols, lengths + NumLitLenSymbols + NumDistSymbols, 5);
+			return LitLen.build(lengths, NumLitLenSymbols) && Dist.build(lengths + NumLitLenSymbols, NumDistSymbols);
+		}
+
+		bool dynamic_codes()
+		{
+			unsigned int numLitLen = Bits.read(5) + 257;
+			unsigned int numDist = Bits.read(5) + 1;
+			unsigned int numCodeLen = Bits.read(4) + 4;
+			if (numLitLen > 286 || numDist > 30)
+				return false;
+
+			uint8_t lengths[NumLitLenSymbols + NumDistSymbols] = {};
+			for (unsigned int i = 0; i < numCodeLen; i++)
+				lengths[CodeLengthOrder[i]] = static_cast<uint8_t>(Bits.read(3));
+
+			HuffmanCode codeLengths;
+			if (!codeLengths.build(lengths, 19))
+				return false;
+
+			std::fill(lengths, lengths + 19, 0);
+			for (unsigned int i = 0; i < numLitLen + numDist;)
+			{
+				int symbol = codeLengths.decode(Bits);
+				if (symbol < 0)
+					return false;
+
+				if (symbol < 16)
+				{
+					lengths[i++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+
+				uint8_t value = 0;
+				unsigned int repeat;
+				if (symbol == 16)
+				{
+					if (i == 0)
+						return false;
+					value = lengths[i - 1];
+					repeat = 3 + Bits.read(2);
+				}
+				else
+				{
+					repeat = symbol == 17 ? 3 + Bits.read(3) : 11 + Bits.read(7);
+				}
+				if (i + repeat > numLitLen + numDist)
+					return false;
+				std::fill(lengths + i, lengths + i + repeat, value);
+				i += repeat;
+			}
+
+			// The distance lengths follow the literal/length lengths directly
+			uint8_t distLengths[NumDistSymbols] = {};
+			std::copy(lengths + numLitLen, lengths + numLitLen + numDist, distLengths);
+			std::fill(lengths + numLitLen, lengths + NumLitLenSymbols, 0);
+			return lengths[256] != 0 && LitLen.build(lengths, NumLitLenSymbols) && Dist.build(distLengths, NumDistSymbols);
+		}
+
+		bool codes()
+		{
+			for (;;)
+			{
+				int symbol = LitLen.decode(Bits);
+				if (symbol < 0)
+					return false;
+
+				if (symbol < 256)
+				{
+					if (Pos == Limit)
+						return false;
+					Out[Pos++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+				if (symbol == 256)
+					return true;
+
+				symbol -= 257;
+				if (symbol >= 29)
+					return false;
+				size_t length = LengthBase[symbol] + Bits.read(LengthExtra[symbol]);
+
+				int distSymbol = Dist.decode(Bits);
+				if (distSymbol < 0 || distSymbol >= 30)
+					return false;
+				size_t distance = DistBase[distSymbol] + Bits.read(DistExtra[distSymbol]);
+
+				if (distance > Pos || length > Limit - Pos)
+					return false;
+
+				// Overlapping copies repeat the last distance bytes, so they go byte by byte
+				const uint8_t* src = Out + Pos - distance;
+				uint8_t* dest = Out + Pos;
+				if (distance >= length)
+					memcpy(dest, src, length);
+				else
+					for (size_t i = 0; i < length; i++)
+						dest[i] = src[i];
+				Pos += length;
+			}
+		}
+	};
+}
+
+// The block is inflated right behind the history, so that matches can reach into it
+bool MszipDecoder::decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize)
+{
+	if (inSize < 2 || in[0] != 'C' || in[1] != 'K')
+		return false;
+
+	std::vector<uint8_t> buffer(history.size() + outSize);
+	std::copy(history.begin(), history.end(), buffer.begin());
+
+	Inflater inflater;
+	inflater.Bits.In = in + 2;
+	inflater.Bits.InEnd = in + inSize;
+	inflater.Out = buffer.data();
+	inflater.Pos = history.size();
+	inflater.Limit = buffer.size();
+
+	bool last = false;
+	while (!last)
+	{
+		last = inflater.Bits.read(1) != 0;
+		unsigned int type = inflater.Bits.read(2);
+		bool decoded = false;
+		if (type == 0)
+			decoded = inflater.stored();
+		else if (type == 1)
+			decoded = inflater.fixed_codes() && inflater.codes();
+		else if (type == 2)
+			decoded = inflater.dynamic_codes() && inflater.codes();
+		if (!decoded || inflater.Bits.overrun())
+			return false;
+	}
+	if (inflater.Pos != buffer.size())
+		return false;
+
+	memcpy(out, buffer.data() + history.size(), outSize);
+	size_t keep = std::min(buffer.size(), HistorySize);
+	history.assign(buffer.end() - keep, buffer.end());
+	return true;
+}
+
+void MszipDecoder::save_state(std::vector<uint8_t>& state_out) const
+{
+	state_out = history;
+}
+
+bool MszipDecoder::restore_state(const uint8_t* state, size_t size)
+{
+	if (size > HistorySize)
+		return false;
+	history.assign(state, state + size);
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Cabinet.h"
+
+// MSZIP: every CFDATA block holds "CK" and a complete deflate stream, which may refer back into
+// the last 32KB of output of the previous blocks. That history is the whole state between blocks.
+class MszipDecoder : public FolderDecoder
+{
+public:
+	bool decode_block(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) override;
+	void save_state(std::vector<uint8_t>& state_out) const override;
+	bool restore_state(const uint8_t* state, size_t size) override;
+
+private:
+	std::vector<uint8_t> history;
+};
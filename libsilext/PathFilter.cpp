@@ -0,0 +1,77 @@
+#include "PathFilter.h"
+
+#include <algorithm>
+
+namespace
+{
+	const std::wstring RegexPrefix = L"re:";
+
+	std::wstring glob_to_regex(const std::wstring& glob)
+	{
+		std::wstring regex;
+		for (size_t i = 0; i < glob.size(); i++)
+		{
+			wchar_t c = glob[i] == L'/' ? L'\\' : glob[i];
+			if (c == L'*' && i + 1 < glob.size() && glob[i + 1] == L'*')
+			{
+				// "**\" also matches no directory at all
+				bool separator = i + 2 < glob.size() && (glob[i + 2] == L'\\' || glob[i + 2] == L'/');
+				regex += separator ? L"(.*\\\\)?" : L".*";
+				i += separator ? 2 : 1;
+			}
+			else if (c == L'*')
+			{
+				regex += L"[^\\\\]*";
+			}
+			else if (c == L'?')
+			{
+				regex += L"[^\\\\]";
+			}
+			else
+			{
+				if (std::wstring(L"\\^$.|+()[]{}").find(c) != std::wstring::npos)
+					regex += L'\\';
+				regex += c;
+			}
+		}
+		return regex;
+	}
+
+	bool add_pattern(const std::wstring& pattern, std::vector<std::wregex>& patterns)
+	{
+		bool isRegex = pattern.compare(0, RegexPrefix.size(), RegexPrefix) == 0;
+		try
+		{
+			patterns.emplace_back(isRegex ? pattern.substr(RegexPrefix.size()) : glob_to_regex(pattern),
+				std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize);
+		}
+		catch (const std::regex_error&)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	bool matches_any(const std::wstring& path, const std::vector<std::wregex>& patterns)
+	{
+		return std::any_of(patterns.begin(), patterns.end(), [&path](const std::wregex& pattern)
+		{
+			return std::regex_match(path, pattern);
+		});
+	}
+}
+
+bool PathFilter::include(const std::wstring& pattern)
+{
+	return add_pattern(pattern, includes);
+}
+
+bool PathFilter::exclude(const std::wstring& pattern)
+{
+	return add_pattern(pattern, excludes);
+}
+
+bool PathFilter::matches(const std::wstring& path) const
+{
+	return (includes.empty() || matches_any(path, includes)) && !matches_any(path, excludes);
+}
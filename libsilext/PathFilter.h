@@ -0,0 +1,26 @@
+#pragma once
+
+#include <regex>
+#include <string>
+#include <vector>
+
+// Include and exclude patterns for the relative paths of the extracted files, e.g.
+// "Microsoft Silverlight\5.1.50918.0\*.dll". A pattern is a glob in which * and ? stay within a
+// directory and ** spans directories, or with the prefix "re:" a regular expression (ECMAScript).
+// Paths are matched whole and case-insensitively, with \ as the separator; globs accept / as well.
+class PathFilter
+{
+public:
+	// Both return false for an invalid regular expression
+	bool include(const std::wstring& pattern);
+	bool exclude(const std::wstring& pattern);
+
+	bool empty() const { return includes.empty() && excludes.empty(); }
+
+	// True if the path matches any include pattern (or there are none) and no exclude pattern
+	bool matches(const std::wstring& path) const;
+
+private:
+	std::vector<std::wregex> includes;
+	std::vector<std::wregex> excludes;
+};
@@ -0,0 +1,308 @@
+#include "Plan.h"
+
+#include <fdi.h>
+#include <algorithm>
+#include <atomic>
+#include <cwchar>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "Cabinet.h"
+#include "Util.h"
+
+namespace
+{
+	const std::wstring PlanMagic = L"SLXP";
+	const unsigned int PlanVersion = 2;
+
+	std::wstring format_codec(uint16_t compressionType)
+	{
+		switch (compressionType & tcompMASK_TYPE)
+		{
+		case tcompTYPE_NONE: return L"none";
+		case tcompTYPE_MSZIP: return L"mszip";
+		case tcompTYPE_LZX: return L"lzx:" + std::to_wstring((compressionType & tcompMASK_LZX_WINDOW) >> tcompSHIFT_LZX_WINDOW);
+		default: return L"type:" + std::to_wstring(compressionType);
+		}
+	}
+
+	bool parse_number(const std::wstring& s, uint64_t& value_out, int base = 10)
+	{
+		if (s.empty())
+			return false;
+		wchar_t* end = nullptr;
+		value_out = wcstoull(s.c_str(), &end, base);
+		return *end == L'\0';
+	}
+
+	template <typename T>
+	bool parse_field(const std::wstring& s, T& value_out)
+	{
+		uint64_t value;
+		if (!parse_number(s, value) || value > static_cast<uint64_t>(static_cast<T>(-1)))
+			return false;
+		value_out = static_cast<T>(value);
+		return true;
+	}
+
+	bool parse_codec(const std::wstring& s, uint16_t& compressionType_out)
+	{
+		uint64_t windowBits;
+		if (s == L"none")
+		{
+			compressionType_out = tcompTYPE_NONE;
+			return true;
+		}
+		if (s == L"mszip")
+		{
+			compressionType_out = tcompTYPE_MSZIP;
+			return true;
+		}
+		if (s.compare(0, 4, L"lzx:") == 0 && parse_number(s.substr(4), windowBits) && windowBits <= 0x1F)
+		{
+			compressionType_out = static_cast<uint16_t>(tcompTYPE_LZX | (windowBits << tcompSHIFT_LZX_WINDOW));
+			return true;
+		}
+		return s.compare(0, 5, L"type:") == 0 && parse_field(s.substr(5), compressionType_out);
+	}
+
+	// A range of a folder that is decoded on its own, from a checkpoint or the start of the folder
+	struct SegmentTask
+	{
+		size_t Folder;
+		const CabinetCheckpoint* Checkpoint;
+		uint16_t FirstBlock;
+		uint16_t EndBlock;
+		size_t DataOffset;
+		uint64_t Offset;
+		uint64_t End;
+	};
+
+	uint64_t get_file_end(const PlanFile& file)
+	{
+		return static_cast<uint64_t>(file.FolderOffset) + file.Size;
+	}
+
+	// files holds the indices of the planned files of the folder, by their offset in it
+	bool decode_segment(const ExtractionPlan& plan, const uint8_t* cabData, size_t cabSize, const SegmentTask& task, const std::vector<size_t>& files, BlockVerifier* verifier, const CancellationToken& cancellation, const PlanWriter& write)
+	{
+		auto decoder = create_folder_decoder(plan.Folders[task.Folder].CompressionType);
+		if (!decoder || (task.Checkpoint && !decoder->restore_state(task.Checkpoint->State.data(), task.Checkpoint->State.size())))
+			return false;
+
+		auto next = std::upper_bound(files.begin(), files.end(), task.Offset, [&plan](uint64_t offset, size_t file)
+		{
+			return offset < get_file_end(plan.Files[file]);
+		});
+		uint64_t end = task.End;
+		if (!files.empty())
+			end = std::min(end, get_file_end(plan.Files[files.back()]));
+
+		size_t dataOffset = task.DataOffset;
+		uint64_t offset = task.Offset;
+		std::vector<uint8_t> output;
+		for (uint16_t block = task.FirstBlock; block < task.EndBlock && offset < end; block++)
+		{
+			CabinetDataBlock dataBlock;
+			if (cancellation.is_cancelled() || !read_cab_data_block(cabData, cabSize, plan.DataReserve, dataOffset, dataBlock)
+				|| (verifier && !verifier->verify(dataBlock)))
+				return false;
+			output.resize(dataBlock.UncompressedSize);
+			if (!decoder->decode_block(dataBlock.Data, dataBlock.Size, output.data(), output.size()))
+				return false;
+
+			uint64_t blockEnd = offset + dataBlock.UncompressedSize;
+			for (auto it = next; it != files.end() && plan.Files[*it].FolderOffset < blockEnd; ++it)
+			{
+				const PlanFile& file = plan.Files[*it];
+				uint64_t begin = std::max<uint64_t>(file.FolderOffset, offset);
+				uint64_t fileEnd = std::min(get_file_end(file), blockEnd);
+				if (begin < fileEnd && !write(*it, begin - file.FolderOffset, output.data() + (begin - offset), static_cast<size_t>(fileEnd - begin)))
+					return false;
+			}
+			while (next != files.end() && get_file_end(plan.Files[*next]) <= blockEnd)
+				++next;
+			offset = blockEnd;
+		}
+		return offset >= end;
+	}
+}
+
+bool write_plan(const std::wstring& path, const ExtractionPlan& plan)
+{
+	std::wstringstream ss;
+	ss << PlanMagic << L"\t" << PlanVersion << L"\n";
+	ss << L"X\t" << plan.SetupSize << L"\t" << to_hex(plan.SetupHash.data(), plan.SetupHash.size()) << L"\t" << plan.SetupExeName << L"\n";
+	for (auto& stage : plan.Stages)
+	{
+		ss << L"A\t" << stage.Format << L"\t" << stage.Size << L"\t";
+		if (stage.InParent)
+			ss << stage.Offset;
+		else
+			ss << L"-";
+		ss << L"\t" << stage.Name << L"\n";
+	}
+	ss << L"C\t" << plan.CabinetSize << L"\t" << plan.DataReserve << L"\t" << plan.IndexPath << L"\n";
+	for (size_t i = 0; i < plan.Folders.size(); i++)
+	{
+		auto& folder = plan.Folders[i];
+		ss << L"D\t" << i << L"\t" << format_codec(folder.CompressionType) << L"\t" << folder.DataOffset << L"\t" << folder.DataBlocks << L"\t" << folder.Size << L"\n";
+		for (auto& segment : folder.Segments)
+			ss << L"G\t" << i << L"\t" << segment.Offset << L"\t" << segment.Block << L"\t" << segment.DataOffset << L"\n";
+	}
+	for (auto& file : plan.Files)
+	{
+		uint64_t writeTime = (static_cast<uint64_t>(file.LastWriteTime.dwHighDateTime) << 32) | file.LastWriteTime.dwLowDateTime;
+		ss << L"F\t" << file.Folder << L"\t" << file.FolderOffset << L"\t" << file.Size << L"\t" << writeTime << L"\t" << file.Attributes << L"\t" << file.Path << L"\n";
+	}
+
+	std::ofstream stream(path, std::ios_base::binary);
+	stream << to_utf8(ss.str());
+	return stream.good();
+}
+
+bool read_plan(const std::wstring& path, ExtractionPlan& plan_out)
+{
+	std::ifstream stream(path, std::ios_base::binary);
+	if (!stream.is_open())
+		return false;
+
+	std::string line;
+	bool headerRead = false;
+	plan_out = {};
+	while (std::getline(stream, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			continue;
+
+		auto parts = split(from_utf8(line), L'\t');
+		const std::wstring& type = parts[0];
+		uint64_t value;
+		if (!headerRead)
+		{
+			if (type != PlanMagic || parts.size() != 2 || !parse_number(parts[1], value) || value != PlanVersion)
+				return false;
+			headerRead = true;
+		}
+		else if (type == L"X" && parts.size() == 4)
+		{
+			if (!parse_number(parts[1], plan_out.SetupSize) || !from_hex(parts[2], plan_out.SetupHash.data(), plan_out.SetupHash.size()))
+				return false;
+			plan_out.SetupExeName = parts[3];
+		}
+		else if (type == L"A" && parts.size() == 5)
+		{
+			PlanStage stage = { parts[4], parts[1], 0, parts[3] != L"-", 0 };
+			if (!parse_number(parts[2], stage.Size) || (stage.InParent && !parse_number(parts[3], stage.Offset)))
+				return false;
+			plan_out.Stages.push_back(stage);
+		}
+		else if (type == L"C" && parts.size() == 4)
+		{
+			if (!parse_number(parts[1], plan_out.CabinetSize) || !parse_field(parts[2], plan_out.DataReserve))
+				return false;
+			plan_out.IndexPath = parts[3];
+		}
+		else if (type == L"D" && parts.size() == 6)
+		{
+			PlanFolder folder = {};
+			if (!parse_number(parts[1], value) || value != plan_out.Folders.size() || !parse_codec(parts[2], folder.CompressionType)
+				|| !parse_field(parts[3], folder.DataOffset) || !parse_field(parts[4], folder.DataBlocks) || !parse_number(parts[5], folder.Size))
+				return false;
+			plan_out.Folders.push_back(folder);
+		}
+		else if (type == L"G" && parts.size() == 5)
+		{
+			PlanSegment segment;
+			if (!parse_number(parts[1], value) || value >= plan_out.Folders.size() || !parse_field(parts[2], segment.Offset)
+				|| !parse_field(parts[3], segment.Block) || !parse_field(parts[4], segment.DataOffset))
+				return false;
+			plan_out.Folders[static_cast<size_t>(value)].Segments.push_back(segment);
+		}
+		else if (type == L"F" && parts.size() == 7)
+		{
+			PlanFile file = { parts[6] };
+			uint64_t writeTime;
+			if (!parse_field(parts[1], file.Folder) || !parse_field(parts[2], file.FolderOffset) || !parse_field(parts[3], file.Size)
+				|| !parse_number(parts[4], writeTime) || !parse_field(parts[5], file.Attributes))
+				return false;
+			file.LastWriteTime.dwLowDateTime = static_cast<DWORD>(writeTime);
+			file.LastWriteTime.dwHighDateTime = static_cast<DWORD>(writeTime >> 32);
+			plan_out.Files.push_back(file);
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return headerRead && !plan_out.Stages.empty();
+}
+
+bool decode_plan_files(const ExtractionPlan& plan, const uint8_t* cabData, size_t cabSize, const CabinetIndex* index, BlockVerifier* verifier, const CancellationToken& cancellation, const PlanWriter& write)
+{
+	std::vector<std::vector<size_t>> folderFiles(plan.Folders.size());
+	for (size_t i = 0; i < plan.Files.size(); i++)
+	{
+		if (plan.Files[i].Folder >= plan.Folders.size())
+			return false;
+		if (plan.Files[i].Size)
+			folderFiles[plan.Files[i].Folder].push_back(i);
+	}
+
+	// A segment starts at every planned checkpoint the index has a state for
+	std::vector<SegmentTask> tasks;
+	for (size_t i = 0; i < plan.Folders.size(); i++)
+	{
+		auto& folder = plan.Folders[i];
+		auto& files = folderFiles[i];
+		std::sort(files.begin(), files.end(), [&plan](size_t a, size_t b) { return plan.Files[a].FolderOffset < plan.Files[b].FolderOffset; });
+
+		std::vector<SegmentTask> segments = { { i, nullptr, 0, folder.DataBlocks, folder.DataOffset, 0, folder.Size } };
+		for (auto& segment : folder.Segments)
+		{
+			if (!index || i >= index->Folders.size())
+				break;
+
+			auto& checkpoints = index->Folders[i];
+			auto checkpoint = std::find_if(checkpoints.begin(), checkpoints.end(), [&segment](const CabinetCheckpoint& checkpoint) { return checkpoint.Block == segment.Block; });
+			if (checkpoint == checkpoints.end() || checkpoint->Offset != segment.Offset || segment.Block <= segments.back().FirstBlock)
+				continue;
+
+			segments.back().EndBlock = segment.Block;
+			segments.back().End = segment.Offset;
+			segments.push_back({ i, &*checkpoint, segment.Block, folder.DataBlocks, segment.DataOffset, segment.Offset, folder.Size });
+		}
+
+		for (auto& segment : segments)
+		{
+			bool needed = std::any_of(files.begin(), files.end(), [&](size_t file)
+			{
+				return plan.Files[file].FolderOffset < segment.End && get_file_end(plan.Files[file]) > segment.Offset;
+			});
+			if (needed)
+				tasks.push_back(segment);
+		}
+	}
+
+	std::atomic<size_t> nextTask{ 0 };
+	std::atomic<bool> failed{ false };
+	auto decodeSegments = [&]()
+	{
+		for (size_t i = nextTask++; i < tasks.size() && !failed; i = nextTask++)
+		{
+			if (!decode_segment(plan, cabData, cabSize, tasks[i], folderFiles[tasks[i].Folder], verifier, cancellation, write))
+				failed = true;
+		}
+	};
+
+	unsigned int numThreads = std::min<unsigned int>(std::max(1u, std::thread::hardware_concurrency()), static_cast<unsigned int>(std::max<size_t>(1, tasks.size())));
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.emplace_back(decodeSegments);
+	decodeSegments();
+	for (auto& thread : threads)
+		thread.join();
+	return !failed && !cancellation.is_cancelled();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Sha256.h"
+#include "Async.h"
+#include "CabinetIndex.h"
+
+// A container on the way from the setup EXE to the payload cabinet
+struct PlanStage
+{
+	std::wstring Name; // The member name in the previous stage; the path of the setup EXE for the first
+	std::wstring Format;
+	uint64_t Size;
+	bool InParent; // A byte range of the previous stage at Offset, rather than decoded from it
+	uint64_t Offset;
+};
+
+// Where decoding restarts from a checkpoint of the random-access index, so that every segment of a
+// folder is decoded independently of the others
+struct PlanSegment
+{
+	uint32_t Offset; // In the uncompressed data of the folder
+	uint16_t Block;
+	uint32_t DataOffset;
+};
+
+struct PlanFolder
+{
+	uint16_t CompressionType;
+	uint32_t DataOffset;
+	uint16_t DataBlocks;
+	uint64_t Size; // Uncompressed
+	std::vector<PlanSegment> Segments; // After the first, which starts at the beginning of the folder
+};
+
+struct PlanFile
+{
+	std::wstring Path; // Relative to the root of the extracted tree
+	uint16_t Folder;
+	uint32_t FolderOffset;
+	uint32_t Size;
+	FILETIME LastWriteTime;
+	DWORD Attributes;
+};
+
+// Everything the analysis of an installer found out: which containers lead to the payload cabinet,
+// how each of its folders is decoded, and which byte ranges of them go into which files
+struct ExtractionPlan
+{
+	std::wstring SetupExeName;
+	uint64_t SetupSize;
+	Sha256Digest SetupHash; // hash_setup
+	std::vector<PlanStage> Stages; // From the setup EXE to the payload cabinet
+	uint64_t CabinetSize;
+	uint32_t DataReserve; // Of every CFDATA block
+	std::wstring IndexPath; // Holds the decoder state at the segments; empty if there are none
+	std::vector<PlanFolder> Folders;
+	std::vector<PlanFile> Files;
+};
+
+/*
+Plan format (UTF-8, one entry per line, tab separated):
+	SLXP <version>
+	X <setup size> <setup sha256> <setup exe>                  The installer the plan is for
+	A <format> <size> <offset in previous stage or -> <name>   Stage, from the setup EXE to the cabinet
+	C <cabinet size> <data reserve> <index path>               The payload cabinet
+	D <folder> <codec> <data offset> <blocks> <size>           Folder, codec none, mszip or lzx:<window bits>
+	G <folder> <offset> <block> <data offset>                  Segment start
+	F <folder> <folder offset> <size> <write time> <attributes> <relative path>
+*/
+bool write_plan(const std::wstring& path, const ExtractionPlan& plan);
+
+bool read_plan(const std::wstring& path, ExtractionPlan& plan_out);
+
+// Receives a byte range of plan.Files[file]; called concurrently from several threads
+typedef std::function<bool(size_t file, uint64_t offset, const uint8_t* data, size_t size)> PlanWriter;
+
+// Decodes the segments of the payload cabinet that hold planned files, all of them at the same time,
+// and passes every decoded range of a file to write. index provides the state at the segments, without
+// it every folder is a single segment. Blocks are checked with verifier first, unless it is null. Returns
+// false if a block is invalid, write fails or on cancellation.
+bool decode_plan_files(const ExtractionPlan& plan, const uint8_t* cabData, size_t cabSize, const CabinetIndex* index, BlockVerifier* verifier, const CancellationToken& cancellation, const PlanWriter& write);
@@ -0,0 +1,435 @@
+#include "Resolver.h"
+
+#include <windows.h>
+#include <objbase.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "Cabinet.h"
+#include "Locator.h"
+#include "SevenZip.h"
+
+namespace
+{
+	const CLSID CLSID_MsiTransform = { 0xC1082, 0x0, 0x0, {0xC0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x46} };
+
+	// Read-only ILockBytes over a memory buffer, so that compound files which were decoded
+	// into memory can be opened without writing them to disk first.
+	class MemoryLockBytes : public ILockBytes
+	{
+	public:
+		MemoryLockBytes(const uint8_t* data, size_t size)
+			: refCount(1), data(data), size(size)
+		{
+		}
+
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+		{
+			if (riid == IID_IUnknown || riid == IID_ILockBytes)
+			{
+				*ppvObject = static_cast<ILockBytes*>(this);
+				AddRef();
+				return S_OK;
+			}
+			*ppvObject = nullptr;
+			return E_NOINTERFACE;
+		}
+
+		ULONG STDMETHODCALLTYPE AddRef() override
+		{
+			return InterlockedIncrement(&refCount);
+		}
+
+		ULONG STDMETHODCALLTYPE Release() override
+		{
+			ULONG count = InterlockedDecrement(&refCount);
+			if (count == 0)
+				delete this;
+			return count;
+		}
+
+		HRESULT STDMETHODCALLTYPE ReadAt(ULARGE_INTEGER ulOffset, void* pv, ULONG cb, ULONG* pcbRead) override
+		{
+			ULONG count = 0;
+			if (ulOffset.QuadPart < size)
+			{
+				count = static_cast<ULONG>(std::min<ULONGLONG>(cb, size - ulOffset.QuadPart));
+				memcpy(pv, data + ulOffset.QuadPart, count);
+			}
+			if (pcbRead) *pcbRead = count;
+			return S_OK;
+		}
+
+		HRESULT STDMETHODCALLTYPE WriteAt(ULARGE_INTEGER, const void*, ULONG, ULONG*) override
+		{
+			return STG_E_ACCESSDENIED;
+		}
+
+		HRESULT STDMETHODCALLTYPE Flush() override
+		{
+			return S_OK;
+		}
+
+		HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER) override
+		{
+			return STG_E_ACCESSDENIED;
+		}
+
+		HRESULT STDMETHODCALLTYPE LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override
+		{
+			return STG_E_INVALIDFUNCTION;
+		}
+
+		HRESULT STDMETHODCALLTYPE UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD) override
+		{
+			return STG_E_INVALIDFUNCTION;
+		}
+
+		HRESULT STDMETHODCALLTYPE Stat(STATSTG* pstatstg, DWORD) override
+		{
+			*pstatstg = { 0 };
+			pstatstg->type = STGTY_LOCKBYTES;
+			pstatstg->cbSize.QuadPart = size;
+			pstatstg->grfMode = STGM_READ;
+			return S_OK;
+		}
+
+	private:
+		~MemoryLockBytes() = default;
+
+		LONG refCount;
+		const uint8_t* const data;
+		const size_t size;
+	};
+
+	// MSI stores stream names compressed: two characters from the set [0-9A-Za-z._] are
+	// packed into a single character in the range 0x3800-0x47FF, a single one in 0x4800-0x483F.
+	// Names of table streams additionally start with 0x4840.
+	wchar_t decode_stream_name_char(unsigned int x)
+	{
+		if (x < 10) return static_cast<wchar_t>(x + L'0');
+		if (x < 10 + 26) return static_cast<wchar_t>(x - 10 + L'A');
+		if (x < 10 + 26 + 26) return static_cast<wchar_t>(x - 10 - 26 + L'a');
+		if (x == 10 + 26 + 26) return L'.';
+		return L'_';
+	}
+
+	std::wstring decode_stream_name(const std::wstring& encodedName)
+	{
+		std::wstring name;
+		for (wchar_t ch : encodedName)
+		{
+			if (ch >= 0x3800 && ch < 0x4840)
+			{
+				if (ch >= 0x4800)
+				{
+					name.push_back(decode_stream_name_char(ch - 0x4800));
+				}
+				else
+				{
+					name.push_back(decode_stream_name_char((ch - 0x3800) & 0x3f));
+					name.push_back(decode_stream_name_char(((ch - 0x3800) >> 6) & 0x3f));
+				}
+			}
+			else
+			{
+				name.push_back(ch);
+			}
+		}
+		return name;
+	}
+
+	typedef std::function<bool(const std::wstring& name)> MemberFilter;
+
+	Artifact make_child(const std::wstring& name, const uint8_t* data, size_t size, std::shared_ptr<const std::vector<uint8_t>> buffer)
+	{
+		return { name, sniff_format(data, size), NoParent, 0, false, false, data, size, std::move(buffer), std::chrono::steady_clock::duration::zero() };
+	}
+
+	Artifact make_child(const std::wstring& name, std::vector<uint8_t>&& data)
+	{
+		auto buffer = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+		return make_child(name, buffer->data(), buffer->size(), buffer);
+	}
+
+	const wchar_t* get_extension(PayloadType type)
+	{
+		switch (type)
+		{
+		case PayloadType::Cabinet: return L".cab";
+		case PayloadType::SevenZip: return L".7z";
+		default: return L".cfb";
+		}
+	}
+
+	// The payloads of an EXE are views into it and are named after their offset
+	bool expand_executable(const Artifact& artifact, const MemberFilter& include, std::vector<Artifact>& children_out)
+	{
+		for (auto& payload : locate_payloads(artifact.Data, artifact.Size))
+		{
+			std::wstring name = std::to_wstring(payload.Offset) + get_extension(payload.Type);
+			if (include(name))
+				children_out.push_back(make_child(name, artifact.Data + payload.Offset, payload.Size, artifact.Buffer));
+		}
+		return true;
+	}
+
+	bool expand_cabinet(const Artifact& artifact, const MemberFilter& include, std::vector<Artifact>& children_out)
+	{
+		std::vector<CabinetFile> files;
+		if (!extract_cab_from_memory(artifact.Data, artifact.Size, include, files))
+			return false;
+
+		for (auto& file : files)
+			children_out.push_back(make_child(file.Name, std::move(file.Data)));
+		return true;
+	}
+
+	// Every folder that holds an included item is decoded once, also when it is solid
+	bool expand_7z(const Artifact& artifact, const MemberFilter& include, std::vector<Artifact>& children_out, Lzma2Stats& stats)
+	{
+		SevenZipArchive archive;
+		if (!open_7z(artifact.Data, artifact.Size, archive))
+			return false;
+
+		uint32_t decodedFolder = static_cast<uint32_t>(-1);
+		std::vector<uint8_t> folderData;
+		for (auto& item : archive.Items)
+		{
+			if (item.IsDirectory || !include(item.Name))
+				continue;
+
+			if (!item.HasStream)
+			{
+				children_out.push_back(make_child(item.Name, std::vector<uint8_t>()));
+				continue;
+			}
+
+			if (item.Folder != decodedFolder)
+			{
+				if (!decode_7z_folder(archive, item.Folder, folderData, &stats))
+					return false;
+				decodedFolder = item.Folder;
+			}
+
+			if (item.FolderOffset > folderData.size() || item.Size > folderData.size() - item.FolderOffset)
+				return false;
+			auto begin = folderData.begin() + static_cast<size_t>(item.FolderOffset);
+			children_out.push_back(make_child(item.Name, std::vector<uint8_t>(begin, begin + static_cast<size_t>(item.Size))));
+		}
+		return true;
+	}
+
+	bool read_storage_stream(IStorage* pStorage, const wchar_t* name, size_t size, std::vector<uint8_t>& data_out)
+	{
+		IStream* pStream = nullptr;
+		HRESULT hr = pStorage->OpenStream(name, NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &pStream);
+		if (FAILED(hr) || !pStream)
+			return false;
+
+		data_out.resize(size);
+		ULONG cbRead = 0;
+		size_t pos = 0;
+		while (pos < size && SUCCEEDED(hr = pStream->Read(data_out.data() + pos, static_cast<ULONG>(std::min<size_t>(size - pos, 1 << 30)), &cbRead)) && cbRead)
+			pos += cbRead;
+		pStream->Release();
+		return pos == size;
+	}
+
+	// Copies a sub-storage (e.g. a transform inside an MSP) into a compound file of its own in memory
+	bool copy_storage(IStorage* pStorage, const wchar_t* name, std::vector<uint8_t>& data_out)
+	{
+		IStorage* pSubStorage = nullptr;
+		ILockBytes* pLockBytes = nullptr;
+		IStorage* pMemoryStorage = nullptr;
+		HGLOBAL hGlobal = NULL;
+		STATSTG stat = { 0 };
+
+		HRESULT hr = pStorage->OpenStorage(name, NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pSubStorage);
+		if (SUCCEEDED(hr))
+			hr = CreateILockBytesOnHGlobal(NULL, TRUE, &pLockBytes);
+		if (SUCCEEDED(hr))
+			hr = StgCreateDocfileOnILockBytes(pLockBytes, STGM_READWRITE | STGM_SHARE_EXCLUSIVE | STGM_CREATE, 0, &pMemoryStorage);
+		if (SUCCEEDED(hr))
+			hr = pSubStorage->CopyTo(0, NULL, NULL, pMemoryStorage);
+		if (SUCCEEDED(hr))
+			hr = pMemoryStorage->Commit(STGC_DEFAULT);
+		if (pMemoryStorage) pMemoryStorage->Release();
+		if (SUCCEEDED(hr))
+			hr = pLockBytes->Stat(&stat, STATFLAG_NONAME);
+		if (SUCCEEDED(hr))
+			hr = GetHGlobalFromILockBytes(pLockBytes, &hGlobal);
+		if (SUCCEEDED(hr))
+		{
+			auto data = static_cast<const uint8_t*>(GlobalLock(hGlobal));
+			if (data)
+			{
+				data_out.assign(data, data + static_cast<size_t>(stat.cbSize.QuadPart));
+				GlobalUnlock(hGlobal);
+			}
+			else
+			{
+				hr = E_FAIL;
+			}
+		}
+
+		if (pLockBytes) pLockBytes->Release();
+		if (pSubStorage) pSubStorage->Release();
+		return SUCCEEDED(hr);
+	}
+
+	// The streams and storages of a compound file; table streams and the summary information are skipped
+	bool expand_compound_file(const Artifact& artifact, const MemberFilter& include, std::vector<Artifact>& children_out)
+	{
+		IStorage* pRootStorage = nullptr;
+		auto pLockBytes = new MemoryLockBytes(artifact.Data, artifact.Size);
+		HRESULT hr = StgOpenStorageOnILockBytes(pLockBytes, NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pRootStorage);
+		pLockBytes->Release();
+		if (FAILED(hr) || !pRootStorage)
+			return false;
+
+		IEnumSTATSTG* pEnum = nullptr;
+		hr = pRootStorage->EnumElements(0, NULL, 0, &pEnum);
+		if (SUCCEEDED(hr))
+		{
+			STATSTG stg = { 0 };
+			while (S_OK == (hr = pEnum->Next(1, &stg, NULL)))
+			{
+				std::wstring name = decode_stream_name(stg.pwcsName);
+				std::vector<uint8_t> data;
+				if (STGTY_STORAGE == stg.type && include(name))
+				{
+					if (copy_storage(pRootStorage, stg.pwcsName, data))
+					{
+						children_out.push_back(make_child(name, std::move(data)));
+						children_out.back().IsTransform = stg.clsid == CLSID_MsiTransform;
+					}
+				}
+				else if (STGTY_STREAM == stg.type && stg.pwcsName[0] != 0x4840 && stg.pwcsName[0] != 5 && include(name))
+				{
+					if (read_storage_stream(pRootStorage, stg.pwcsName, static_cast<size_t>(stg.cbSize.QuadPart), data))
+						children_out.push_back(make_child(name, std::move(data)));
+				}
+				CoTaskMemFree(stg.pwcsName);
+			}
+			pEnum->Release();
+		}
+		pRootStorage->Release();
+		return SUCCEEDED(hr);
+	}
+
+	bool expand_artifact(const Artifact& artifact, const MemberFilter& include, std::vector<Artifact>& children_out, Lzma2Stats& stats)
+	{
+		switch (artifact.Format)
+		{
+		case ArtifactFormat::Executable: return expand_executable(artifact, include, children_out);
+		case ArtifactFormat::Cabinet: return expand_cabinet(artifact, include, children_out);
+		case ArtifactFormat::SevenZip: return expand_7z(artifact, include, children_out, stats);
+		case ArtifactFormat::CompoundFile: return expand_compound_file(artifact, include, children_out);
+		default: return false;
+		}
+	}
+}
+
+ArtifactFormat sniff_format(const uint8_t* data, size_t size)
+{
+	const uint8_t SevenZipSignature[] = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+	const uint8_t CompoundFileSignature[] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+
+	if (size >= 4 && memcmp(data, "MSCF", 4) == 0)
+		return ArtifactFormat::Cabinet;
+	if (size >= sizeof(SevenZipSignature) && memcmp(data, SevenZipSignature, sizeof(SevenZipSignature)) == 0)
+		return ArtifactFormat::SevenZip;
+	if (size >= sizeof(CompoundFileSignature) && memcmp(data, CompoundFileSignature, sizeof(CompoundFileSignature)) == 0)
+		return ArtifactFormat::CompoundFile;
+	if (size >= 2 && data[0] == 'M' && data[1] == 'Z')
+		return ArtifactFormat::Executable;
+	return ArtifactFormat::Unknown;
+}
+
+const wchar_t* get_format_name(ArtifactFormat format)
+{
+	switch (format)
+	{
+	case ArtifactFormat::Executable: return L"exe";
+	case ArtifactFormat::Cabinet: return L"cab";
+	case ArtifactFormat::SevenZip: return L"7z";
+	case ArtifactFormat::CompoundFile: return L"cfb";
+	default: return L"unknown";
+	}
+}
+
+void resolve_artifacts(const std::wstring& rootName, const uint8_t* data, size_t size, const ResolvePolicy& policy, ArtifactGraph& graph_out)
+{
+	graph_out.Artifacts.clear();
+	graph_out.Artifacts.push_back(make_child(rootName, data, size, nullptr));
+	graph_out.Lzma2 = {};
+
+	std::mutex mutex;
+	std::condition_variable pendingChanged;
+	std::deque<size_t> pending;
+	size_t active = 0;
+	if (policy.Expand(graph_out, 0))
+		pending.push_back(0);
+
+	auto resolveArtifacts = [&]()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			pendingChanged.wait(lock, [&]() { return !pending.empty() || active == 0; });
+			if (pending.empty())
+				break;
+
+			size_t index = pending.front();
+			pending.pop_front();
+			active++;
+
+			// The artifact is copied, the graph may grow while it is expanded
+			Artifact artifact = graph_out.Artifacts[index];
+			lock.unlock();
+
+			auto include = [&](const std::wstring& name)
+			{
+				std::lock_guard<std::mutex> includeLock(mutex);
+				return policy.Include(graph_out, index, name);
+			};
+
+			auto start = std::chrono::steady_clock::now();
+			Lzma2Stats stats = {};
+			std::vector<Artifact> children;
+			bool expanded = expand_artifact(artifact, include, children, stats);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+
+			lock.lock();
+			graph_out.Artifacts[index].Expanded = expanded;
+			graph_out.Artifacts[index].ExpandTime = elapsed;
+			graph_out.Lzma2.Segments += stats.Segments;
+			graph_out.Lzma2.Threads = std::max(graph_out.Lzma2.Threads, stats.Threads);
+			graph_out.Lzma2.SegmentTime += stats.SegmentTime;
+			for (auto& child : children)
+			{
+				child.Parent = index;
+				child.Depth = artifact.Depth + 1;
+				graph_out.Artifacts.push_back(std::move(child));
+				size_t childIndex = graph_out.Artifacts.size() - 1;
+				auto& added = graph_out.Artifacts[childIndex];
+				if (added.Format != ArtifactFormat::Unknown && added.Depth < policy.MaxDepth && policy.Expand(graph_out, childIndex))
+					pending.push_back(childIndex);
+			}
+			active--;
+			pendingChanged.notify_all();
+		}
+	};
+
+	unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.emplace_back(resolveArtifacts);
+	resolveArtifacts();
+	for (auto& thread : threads)
+		thread.join();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Lzma.h"
+
+enum class ArtifactFormat
+{
+	Unknown,
+	Executable,
+	Cabinet,
+	SevenZip,
+	CompoundFile
+};
+
+// Identifies a container by its magic bytes
+ArtifactFormat sniff_format(const uint8_t* data, size_t size);
+
+// A short lowercase name, e.g. for the stages of an extraction plan
+const wchar_t* get_format_name(ArtifactFormat format);
+
+const size_t NoParent = static_cast<size_t>(-1);
+
+// A node of the artifact graph: a file, stream, storage or embedded range found inside its parent.
+// Data either points into the parent (e.g. a cabinet in a mapped EXE) or is owned by Buffer.
+struct Artifact
+{
+	std::wstring Name;
+	ArtifactFormat Format;
+	size_t Parent;
+	unsigned int Depth;
+	bool IsTransform; // A storage with the MSI transform CLSID
+	bool Expanded;
+	const uint8_t* Data;
+	size_t Size;
+	std::shared_ptr<const std::vector<uint8_t>> Buffer;
+	std::chrono::steady_clock::duration ExpandTime;
+};
+
+struct ArtifactGraph
+{
+	std::vector<Artifact> Artifacts;
+	Lzma2Stats Lzma2;
+};
+
+struct ResolvePolicy
+{
+	// Whether the container at the given index is opened at all
+	std::function<bool(const ArtifactGraph& graph, size_t index)> Expand;
+	// Whether the member with the given name of the container at the given index is decoded
+	std::function<bool(const ArtifactGraph& graph, size_t index, const std::wstring& name)> Include;
+	unsigned int MaxDepth;
+};
+
+// Opens the root and recursively every nested container (EXE, CAB, 7z, CFB/MSI/MSP/MST) the policy
+// accepts, from memory. A container only depends on its parent, so all pending containers are
+// expanded concurrently. Containers that cannot be decoded are left unexpanded.
+void resolve_artifacts(const std::wstring& rootName, const uint8_t* data, size_t size, const ResolvePolicy& policy, ArtifactGraph& graph_out);
@@ -0,0 +1,929 @@
+#include "SevenZip.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include "Bcj.h"
+#include "Crc32.h"
+
+namespace
+{
+	enum PropertyId
+	{
+		End = 0x00,
+		Header = 0x01,
+		ArchiveProperties = 0x02,
+		AdditionalStreamsInfo = 0x03,
+		MainStreamsInfo = 0x04,
+		FilesInfo = 0x05,
+		PackInfo = 0x06,
+		UnpackInfo = 0x07,
+		SubStreamsInfo = 0x08,
+		Size = 0x09,
+		Crc = 0x0A,
+		Folder = 0x0B,
+		CodersUnpackSize = 0x0C,
+		NumUnpackStream = 0x0D,
+		EmptyStream = 0x0E,
+		EmptyFile = 0x0F,
+		Name = 0x11,
+		WinAttributes = 0x15,
+		EncodedHeader = 0x17
+	};
+
+	const uint8_t Signature[] = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+	const size_t SignatureHeaderSize = 32;
+	const uint32_t MaxEntries = 1 << 24;
+
+	const std::vector<uint8_t> MethodCopy = { 0x00 };
+	const std::vector<uint8_t> MethodLzma = { 0x03, 0x01, 0x01 };
+	const std::vector<uint8_t> MethodLzma2 = { 0x21 };
+	const std::vector<uint8_t> MethodBcjX86 = { 0x03, 0x03, 0x01, 0x03 };
+
+	struct ByteReader
+	{
+		const uint8_t* Pos;
+		const uint8_t* End;
+		bool Error = false;
+
+		size_t remaining() const
+		{
+			return End - Pos;
+		}
+
+		uint8_t read_byte()
+		{
+			if (Pos >= End)
+			{
+				Error = true;
+				return 0;
+			}
+			return *Pos++;
+		}
+
+		// 7z numbers: the count of leading one bits in the first byte gives the number of
+		// extra little endian bytes, the remaining bits of the first byte are the high part.
+		uint64_t read_number()
+		{
+			uint8_t first = read_byte();
+			uint8_t mask = 0x80;
+			uint64_t value = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				if ((first & mask) == 0)
+				{
+					uint64_t high = first & (mask - 1);
+					return value | (high << (8 * i));
+				}
+				value |= static_cast<uint64_t>(read_byte()) << (8 * i);
+				mask >>= 1;
+			}
+			return value;
+		}
+
+		uint32_t read_count()
+		{
+			uint64_t value = read_number();
+			if (value > MaxEntries)
+			{
+				Error = true;
+				return 0;
+			}
+			return static_cast<uint32_t>(value);
+		}
+
+		uint32_t read_uint32()
+		{
+			if (remaining() < 4)
+			{
+				Error = true;
+				return 0;
+			}
+			uint32_t value = Pos[0] | (Pos[1] << 8) | (Pos[2] << 16) | (static_cast<uint32_t>(Pos[3]) << 24);
+			Pos += 4;
+			return value;
+		}
+
+		uint64_t read_uint64()
+		{
+			uint64_t low = read_uint32();
+			return low | (static_cast<uint64_t>(read_uint32()) << 32);
+		}
+
+		void skip(uint64_t count)
+		{
+			if (count > remaining())
+			{
+				Error = true;
+				Pos = End;
+			}
+			else
+			{
+				Pos += count;
+			}
+		}
+
+		bool expect(uint64_t id)
+		{
+			if (read_number() != id)
+				Error = true;
+			return !Error;
+		}
+	};
+
+	std::vector<bool> read_bit_vector(ByteReader& reader, size_t count)
+	{
+		std::vector<bool> bits(count);
+		uint8_t mask = 0;
+		uint8_t value = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (mask == 0)
+			{
+				value = reader.read_byte();
+				mask = 0x80;
+			}
+			bits[i] = (value & mask) != 0;
+			mask >>= 1;
+		}
+		return bits;
+	}
+
+	std::vector<bool> read_optional_bit_vector(ByteReader& reader, size_t count)
+	{
+		if (reader.read_byte() != 0)
+			return std::vector<bool>(count, true);
+		return read_bit_vector(reader, count);
+	}
+
+	void read_digests(ByteReader& reader, size_t count, std::vector<bool>& defined_out, std::vector<uint32_t>& crcs_out)
+	{
+		defined_out = read_optional_bit_vector(reader, count);
+		crcs_out.assign(count, 0);
+		for (size_t i = 0; i < count; i++)
+			if (defined_out[i])
+				crcs_out[i] = reader.read_uint32();
+	}
+
+	void read_folder(ByteReader& reader, SevenZipFolder& folder)
+	{
+		uint32_t numCoders = reader.read_count();
+		uint32_t numInStreams = 0;
+		uint32_t numOutStreams = 0;
+		for (uint32_t i = 0; i < numCoders && !reader.Error; i++)
+		{
+			uint8_t flags = reader.read_byte();
+			if (flags & 0x80)
+			{
+				// Alternative methods were never used by 7-Zip
+				reader.Error = true;
+				return;
+			}
+
+			SevenZipCoder coder;
+			size_t idSize = flags & 0x0F;
+			if (idSize > reader.remaining())
+			{
+				reader.Error = true;
+				return;
+			}
+			coder.MethodId.assign(reader.Pos, reader.Pos + idSize);
+			reader.skip(idSize);
+
+			coder.NumInStreams = 1;
+			coder.NumOutStreams = 1;
+			if (flags & 0x10)
+			{
+				coder.NumInStreams = reader.read_count();
+				coder.NumOutStreams = reader.read_count();
+			}
+
+			if (flags & 0x20)
+			{
+				uint64_t propsSize = reader.read_number();
+				if (propsSize > reader.remaining())
+				{
+					reader.Error = true;
+					return;
+				}
+				coder.Properties.assign(reader.Pos, reader.Pos + propsSize);
+				reader.skip(propsSize);
+			}
+
+			numInStreams += coder.NumInStreams;
+			numOutStreams += coder.NumOutStreams;
+			folder.Coders.push_back(coder);
+		}
+
+		if (numOutStreams == 0 || numInStreams < numOutStreams - 1)
+		{
+			reader.Error = true;
+			return;
+		}
+
+		for (uint32_t i = 0; i < numOutStreams - 1; i++)
+		{
+			uint32_t inIndex = reader.read_count();
+			uint32_t outIndex = reader.read_count();
+			folder.BindPairs.push_back({ inIndex, outIndex });
+		}
+
+		uint32_t numPackedStreams = numInStreams - (numOutStreams - 1);
+		if (numPackedStreams == 1)
+		{
+			for (uint32_t i = 0; i < numInStreams; i++)
+			{
+				bool bound = false;
+				for (auto& bindPair : folder.BindPairs)
+					bound |= bindPair.first == i;
+				if (!bound)
+				{
+					folder.PackedStreams.push_back(i);
+					break;
+				}
+			}
+		}
+		else
+		{
+			for (uint32_t i = 0; i < numPackedStreams; i++)
+				folder.PackedStreams.push_back(reader.read_count());
+		}
+	}
+
+	void read_pack_info(ByteReader& reader, SevenZipArchive& archive)
+	{
+		uint64_t packPos = reader.read_number();
+		uint32_t numPackStreams = reader.read_count();
+		archive.PackSizes.assign(numPackStreams, 0);
+
+		uint64_t id = reader.read_number();
+		if (id == Size)
+		{
+			for (auto& packSize : archive.PackSizes)
+				packSize = reader.read_number();
+			id = reader.read_number();
+		}
+		if (id == Crc)
+		{
+			std::vector<bool> defined;
+			std::vector<uint32_t> crcs;
+			read_digests(reader, numPackStreams, defined, crcs);
+			id = reader.read_number();
+		}
+		if (id != End)
+			reader.Error = true;
+
+		uint64_t offset = SignatureHeaderSize + packPos;
+		for (auto packSize : archive.PackSizes)
+		{
+			if (offset > archive.Size || packSize > archive.Size - offset)
+			{
+				reader.Error = true;
+				return;
+			}
+			archive.PackOffsets.push_back(offset);
+			offset += packSize;
+		}
+	}
+
+	void read_unpack_info(ByteReader& reader, SevenZipArchive& archive)
+	{
+		if (!reader.expect(Folder))
+			return;
+
+		uint32_t numFolders = reader.read_count();
+		if (reader.read_byte() != 0)
+		{
+			// External folder definitions are not written by 7-Zip
+			reader.Error = true;
+			return;
+		}
+
+		archive.Folders.resize(numFolders);
+		uint32_t firstPackStream = 0;
+		for (auto& folder : archive.Folders)
+		{
+			read_folder(reader, folder);
+			if (reader.Error)
+				return;
+
+			folder.FirstPackStream = firstPackStream;
+			folder.NumUnpackStreams = 1;
+			folder.HasCrc = false;
+			folder.Crc = 0;
+			firstPackStream += static_cast<uint32_t>(folder.PackedStreams.size());
+		}
+		if (firstPackStream > archive.PackSizes.size())
+		{
+			reader.Error = true;
+			return;
+		}
+
+		if (!reader.expect(CodersUnpackSize))
+			return;
+
+		for (auto& folder : archive.Folders)
+		{
+			uint32_t numOutStreams = 0;
+			for (auto& coder : folder.Coders)
+				numOutStreams += coder.NumOutStreams;
+			for (uint32_t i = 0; i < numOutStreams; i++)
+				folder.UnpackSizes.push_back(reader.read_number());
+		}
+
+		uint64_t id = reader.read_number();
+		if (id == Crc)
+		{
+			std::vector<bool> defined;
+			std::vector<uint32_t> crcs;
+			read_digests(reader, numFolders, defined, crcs);
+			for (uint32_t i = 0; i < numFolders; i++)
+			{
+				archive.Folders[i].HasCrc = defined[i];
+				archive.Folders[i].Crc = crcs[i];
+			}
+			id = reader.read_number();
+		}
+		if (id != End)
+			reader.Error = true;
+	}
+
+	struct SubStreams
+	{
+		std::vector<uint64_t> Sizes;
+		std::vector<bool> HasCrc;
+		std::vector<uint32_t> Crcs;
+	};
+
+	void read_substreams_info(ByteReader& reader, SevenZipArchive& archive, SubStreams& subStreams)
+	{
+		uint64_t id = reader.read_number();
+		if (id == NumUnpackStream)
+		{
+			for (auto& folder : archive.Folders)
+				folder.NumUnpackStreams = reader.read_count();
+			id = reader.read_number();
+		}
+
+		for (auto& folder : archive.Folders)
+		{
+			if (folder.NumUnpackStreams == 0)
+				continue;
+
+			uint64_t folderSize = get_7z_folder_size(folder);
+			uint64_t sum = 0;
+			if (id == Size)
+			{
+				for (uint32_t i = 1; i < folder.NumUnpackStreams; i++)
+				{
+					uint64_t size = reader.read_number();
+					subStreams.Sizes.push_back(size);
+					sum += size;
+				}
+			}
+			if (sum > folderSize)
+			{
+				reader.Error = true;
+				return;
+			}
+			subStreams.Sizes.push_back(folderSize - sum);
+		}
+		if (id == Size)
+			id = reader.read_number();
+
+		size_t numUnknownCrcs = 0;
+		for (auto& folder : archive.Folders)
+			if (folder.NumUnpackStreams != 1 || !folder.HasCrc)
+				numUnknownCrcs += folder.NumUnpackStreams;
+
+		std::vector<bool> defined;
+		std::vector<uint32_t> crcs;
+		if (id == Crc)
+		{
+			read_digests(reader, numUnknownCrcs, defined, crcs);
+			id = reader.read_number();
+		}
+
+		size_t crcIndex = 0;
+		for (auto& folder : archive.Folders)
+		{
+			if (folder.NumUnpackStreams == 1 && folder.HasCrc)
+			{
+				subStreams.HasCrc.push_back(true);
+				subStreams.Crcs.push_back(folder.Crc);
+				continue;
+			}
+			for (uint32_t i = 0; i < folder.NumUnpackStreams; i++, crcIndex++)
+			{
+				bool hasCrc = crcIndex < defined.size() && defined[crcIndex];
+				subStreams.HasCrc.push_back(hasCrc);
+				subStreams.Crcs.push_back(hasCrc ? crcs[crcIndex] : 0);
+			}
+		}
+
+		if (id != End)
+			reader.Error = true;
+	}
+
+	void read_streams_info(ByteReader& reader, SevenZipArchive& archive, SubStreams& subStreams)
+	{
+		uint64_t id = reader.read_number();
+		if (id == PackInfo)
+		{
+			read_pack_info(reader, archive);
+			id = reader.read_number();
+		}
+		if (id == UnpackInfo)
+		{
+			read_unpack_info(reader, archive);
+			id = reader.read_number();
+		}
+
+		if (id == SubStreamsInfo)
+		{
+			read_substreams_info(reader, archive, subStreams);
+			id = reader.read_number();
+		}
+		else
+		{
+			for (auto& folder : archive.Folders)
+			{
+				subStreams.Sizes.push_back(get_7z_folder_size(folder));
+				subStreams.HasCrc.push_back(folder.HasCrc);
+				subStreams.Crcs.push_back(folder.Crc);
+			}
+		}
+
+		if (id != End)
+			reader.Error = true;
+	}
+
+	void read_files_info(ByteReader& reader, SevenZipArchive& archive, const SubStreams& subStreams)
+	{
+		uint32_t numFiles = reader.read_count();
+		std::vector<bool> emptyStream(numFiles, false);
+		std::vector<bool> emptyFile;
+		std::vector<uint32_t> attributes(numFiles, 0);
+		archive.Items.resize(numFiles);
+
+		while (!reader.Error)
+		{
+			uint64_t type = reader.read_number();
+			if (type == End)
+				break;
+
+			uint64_t size = reader.read_number();
+			if (size > reader.remaining())
+			{
+				reader.Error = true;
+				return;
+			}
+
+			ByteReader property = { reader.Pos, reader.Pos + size };
+			reader.skip(size);
+			switch (type)
+			{
+			case EmptyStream:
+				emptyStream = read_bit_vector(property, numFiles);
+				break;
+			case EmptyFile:
+				emptyFile = read_bit_vector(property, std::count(emptyStream.begin(), emptyStream.end(), true));
+				break;
+			case Name:
+				if (property.read_byte() != 0)
+				{
+					reader.Error = true;
+					return;
+				}
+				for (auto& item : archive.Items)
+				{
+					while (property.remaining() >= 2)
+					{
+						wchar_t ch = static_cast<wchar_t>(property.Pos[0] | (property.Pos[1] << 8));
+						property.Pos += 2;
+						if (ch == 0)
+							break;
+						item.Name.push_back(ch);
+					}
+				}
+				break;
+			case WinAttributes:
+			{
+				auto defined = read_optional_bit_vector(property, numFiles);
+				if (property.read_byte() != 0)
+					break;
+				for (uint32_t i = 0; i < numFiles; i++)
+					if (defined[i])
+						attributes[i] = property.read_uint32();
+				break;
+			}
+			default:
+				break;
+			}
+			reader.Error |= property.Error;
+		}
+
+		size_t emptyIndex = 0;
+		size_t streamIndex = 0;
+		uint32_t folderIndex = 0;
+		uint32_t indexInFolder = 0;
+		uint64_t folderOffset = 0;
+		for (uint32_t i = 0; i < numFiles && !reader.Error; i++)
+		{
+			auto& item = archive.Items[i];
+			item.HasStream = !emptyStream[i];
+			item.HasCrc = false;
+			item.Crc = 0;
+			item.Folder = 0;
+			item.FolderOffset = 0;
+			item.Size = 0;
+			if (!item.HasStream)
+			{
+				bool isEmptyFile = emptyIndex < emptyFile.size() && emptyFile[emptyIndex];
+				item.IsDirectory = !isEmptyFile || (attributes[i] & 0x10) != 0;
+				emptyIndex++;
+				continue;
+			}
+
+			item.IsDirectory = false;
+			while (indexInFolder == 0 && folderIndex < archive.Folders.size() && archive.Folders[folderIndex].NumUnpackStreams == 0)
+				folderIndex++;
+			if (folderIndex >= archive.Folders.size() || streamIndex >= subStreams.Sizes.size())
+			{
+				reader.Error = true;
+				return;
+			}
+
+			item.Folder = folderIndex;
+			item.FolderOffset = folderOffset;
+			item.Size = subStreams.Sizes[streamIndex];
+			item.HasCrc = subStreams.HasCrc[streamIndex];
+			item.Crc = subStreams.Crcs[streamIndex];
+			streamIndex++;
+
+			folderOffset += item.Size;
+			if (++indexInFolder >= archive.Folders[folderIndex].NumUnpackStreams)
+			{
+				folderIndex++;
+				indexInFolder = 0;
+				folderOffset = 0;
+			}
+		}
+	}
+
+	void read_header(ByteReader& reader, SevenZipArchive& archive)
+	{
+		SubStreams subStreams;
+		uint64_t id = reader.read_number();
+		if (id == ArchiveProperties)
+		{
+			while (!reader.Error && reader.read_number() != End)
+				reader.skip(reader.read_number());
+			id = reader.read_number();
+		}
+		if (id == AdditionalStreamsInfo)
+		{
+			SevenZipArchive additional = { archive.Data, archive.Size };
+			SubStreams additionalSubStreams;
+			read_streams_info(reader, additional, additionalSubStreams);
+			id = reader.read_number();
+		}
+		if (id == MainStreamsInfo)
+		{
+			read_streams_info(reader, archive, subStreams);
+			id = reader.read_number();
+		}
+		if (id == FilesInfo)
+		{
+			read_files_info(reader, archive, subStreams);
+			id = reader.read_number();
+		}
+		if (id != End)
+			reader.Error = true;
+	}
+
+	// Checks the CRCs of a folder and of its items against the ranges of the output the decoder reports,
+	// each checksummed while it is still in cache. The ranges may come from several threads and in any
+	// order, so the CRCs of the pieces of every target are only combined in order at the end.
+	class FolderCrcChecker
+	{
+	public:
+		FolderCrcChecker(const SevenZipArchive& archive, uint32_t folderIndex, uint64_t folderSize)
+		{
+			auto& folder = archive.Folders[folderIndex];
+			if (folder.HasCrc)
+				targets.push_back({ 0, folderSize, folder.Crc });
+			firstItem = targets.size();
+
+			// The only item of a folder usually repeats its CRC
+			for (auto& item : archive.Items)
+			{
+				if (item.HasStream && item.HasCrc && item.Folder == folderIndex
+					&& !(folder.HasCrc && item.FolderOffset == 0 && item.Size == folderSize && item.Crc == folder.Crc))
+					targets.push_back({ item.FolderOffset, item.Size, item.Crc });
+			}
+			std::sort(targets.begin() + firstItem, targets.end(), [](const Target& a, const Target& b) { return a.Offset < b.Offset; });
+		}
+
+		bool empty() const
+		{
+			return targets.empty();
+		}
+
+		void add(const uint8_t* data, uint64_t offset, size_t size)
+		{
+			std::vector<Piece> pieces;
+			if (firstItem)
+				pieces.push_back({ 0, offset, size, crc32(data, size) });
+
+			uint64_t end = offset + size;
+			auto next = std::upper_bound(targets.begin() + firstItem, targets.end(), offset, [](uint64_t pos, const Target& target) { return pos < target.Offset + target.Size; });
+			for (; next != targets.end() && next->Offset < end; ++next)
+			{
+				uint64_t begin = std::max(next->Offset, offset);
+				uint64_t pieceEnd = std::min(next->Offset + next->Size, end);
+				pieces.push_back({ static_cast<size_t>(next - targets.begin()), begin, pieceEnd - begin, crc32(data + (begin - offset), static_cast<size_t>(pieceEnd - begin)) });
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			added.insert(added.end(), pieces.begin(), pieces.end());
+		}
+
+		// Whether the pieces cover every target exactly and add up to its CRC
+		bool check()
+		{
+			std::sort(added.begin(), added.end(), [](const Piece& a, const Piece& b) { return a.Target != b.Target ? a.Target < b.Target : a.Offset < b.Offset; });
+			auto piece = added.begin();
+			for (size_t i = 0; i < targets.size(); i++)
+			{
+				uint64_t offset = targets[i].Offset;
+				uint32_t crc = 0;
+				for (; piece != added.end() && piece->Target == i; ++piece)
+				{
+					if (piece->Offset != offset)
+						return false;
+					crc = crc32_combine(crc, piece->Crc, piece->Size);
+					offset += piece->Size;
+				}
+				if (offset != targets[i].Offset + targets[i].Size || crc != targets[i].Crc)
+					return false;
+			}
+			return true;
+		}
+
+	private:
+		struct Target
+		{
+			uint64_t Offset;
+			uint64_t Size;
+			uint32_t Crc;
+		};
+
+		struct Piece
+		{
+			size_t Target;
+			uint64_t Offset;
+			uint64_t Size;
+			uint32_t Crc;
+		};
+
+		std::vector<Target> targets; // The folder if it has a CRC, then the items by offset
+		size_t firstItem = 0;
+		std::mutex mutex;
+		std::vector<Piece> added;
+	};
+
+	struct InputSpan
+	{
+		const uint8_t* Data;
+		size_t Size;
+	};
+
+	// observer receives the output as it is decoded, unless it is null
+	bool decode_coder(const SevenZipCoder& coder, const InputSpan& in, uint8_t* out, size_t outSize, Lzma2Stats* stats, const LzmaOutputObserver* observer)
+	{
+		if (coder.MethodId == MethodCopy)
+		{
+			if (in.Size < outSize)
+				return false;
+			for (size_t pos = 0; pos < outSize; pos += LzmaObserverStep)
+			{
+				size_t size = std::min(outSize - pos, LzmaObserverStep);
+				memcpy(out + pos, in.Data + pos, size);
+				if (observer)
+					(*observer)(pos, size);
+			}
+			return true;
+		}
+
+		if (coder.MethodId == MethodLzma)
+		{
+			LzmaProperties properties;
+			if (!parse_lzma_properties(coder.Properties.data(), coder.Properties.size(), properties))
+				return false;
+			return lzma_decode(properties, in.Data, in.Size, out, outSize, observer);
+		}
+
+		if (coder.MethodId == MethodLzma2)
+		{
+			Lzma2Stats coderStats = {};
+			if (!lzma2_decode(in.Data, in.Size, out, outSize, &coderStats, observer))
+				return false;
+
+			if (stats)
+			{
+				stats->Segments += coderStats.Segments;
+				stats->Threads = std::max(stats->Threads, coderStats.Threads);
+				stats->SegmentTime += coderStats.SegmentTime;
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	// observer receives the output of the main stream of the folder only
+	bool decode_out_stream(const SevenZipArchive& archive, const SevenZipFolder& folder, uint32_t outIndex, std::vector<uint8_t>& out, Lzma2Stats* stats, const LzmaOutputObserver* observer, int depth)
+	{
+		if (depth > 32 || outIndex >= folder.UnpackSizes.size())
+			return false;
+
+		uint32_t coderIndex = 0;
+		uint32_t firstInStream = 0;
+		uint32_t firstOutStream = 0;
+		for (; coderIndex < folder.Coders.size(); coderIndex++)
+		{
+			auto& coder = folder.Coders[coderIndex];
+			if (outIndex < firstOutStream + coder.NumOutStreams)
+				break;
+			firstInStream += coder.NumInStreams;
+			firstOutStream += coder.NumOutStreams;
+		}
+		if (coderIndex == folder.Coders.size())
+			return false;
+
+		auto& coder = folder.Coders[coderIndex];
+		if (coder.NumInStreams != 1 || coder.NumOutStreams != 1)
+			return false;
+
+		std::vector<uint8_t> boundInput;
+		InputSpan input = { nullptr, 0 };
+		auto bindPairIt = std::find_if(folder.BindPairs.begin(), folder.BindPairs.end(),
+			[firstInStream](const std::pair<uint32_t, uint32_t>& bindPair) { return bindPair.first == firstInStream; });
+		if (bindPairIt != folder.BindPairs.end())
+		{
+			if (!decode_out_stream(archive, folder, bindPairIt->second, boundInput, stats, nullptr, depth + 1))
+				return false;
+			input = { boundInput.data(), boundInput.size() };
+		}
+		else
+		{
+			auto packedIt = std::find(folder.PackedStreams.begin(), folder.PackedStreams.end(), firstInStream);
+			if (packedIt == folder.PackedStreams.end())
+				return false;
+
+			size_t packIndex = folder.FirstPackStream + (packedIt - folder.PackedStreams.begin());
+			if (packIndex >= archive.PackOffsets.size())
+				return false;
+			input = { archive.Data + archive.PackOffsets[packIndex], static_cast<size_t>(archive.PackSizes[packIndex]) };
+		}
+
+		uint64_t outSize = folder.UnpackSizes[outIndex];
+		if (outSize > SIZE_MAX)
+			return false;
+
+		// The BCJ filter runs in place on the output of the coder bound to it, which is only final
+		// once the whole of it is filtered
+		if (coder.MethodId == MethodBcjX86)
+		{
+			if (input.Data != boundInput.data() || boundInput.size() != outSize)
+				return false;
+
+			uint32_t startOffset = 0;
+			if (coder.Properties.size() >= 4)
+				startOffset = coder.Properties[0] | (coder.Properties[1] << 8) | (coder.Properties[2] << 16) | (static_cast<uint32_t>(coder.Properties[3]) << 24);
+
+			out.swap(boundInput);
+			bcj_x86_decode(out.data(), out.size(), startOffset);
+			if (observer && !out.empty())
+				(*observer)(0, out.size());
+			return true;
+		}
+
+		out.resize(static_cast<size_t>(outSize));
+		return decode_coder(coder, input, out.data(), out.size(), stats, observer);
+	}
+
+	bool find_main_out_stream(const SevenZipFolder& folder, uint32_t& outIndex_out)
+	{
+		for (uint32_t i = 0; i < folder.UnpackSizes.size(); i++)
+		{
+			auto bindPairIt = std::find_if(folder.BindPairs.begin(), folder.BindPairs.end(),
+				[i](const std::pair<uint32_t, uint32_t>& bindPair) { return bindPair.second == i; });
+			if (bindPairIt == folder.BindPairs.end())
+			{
+				outIndex_out = i;
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+uint64_t get_7z_folder_size(const SevenZipFolder& folder)
+{
+	uint32_t outIndex;
+	return find_main_out_stream(folder, outIndex) ? folder.UnpackSizes[outIndex] : 0;
+}
+
+bool open_7z(const uint8_t* data, size_t size, SevenZipArchive& archive_out)
+{
+	if (size < SignatureHeaderSize || memcmp(data, Signature, sizeof(Signature)) != 0)
+		return false;
+
+	ByteReader startHeader = { data + 12, data + SignatureHeaderSize };
+	uint64_t nextHeaderOffset = startHeader.read_uint64();
+	uint64_t nextHeaderSize = startHeader.read_uint64();
+	if (nextHeaderOffset > size - SignatureHeaderSize || nextHeaderSize > size - SignatureHeaderSize - nextHeaderOffset)
+		return false;
+
+	archive_out = { data, size };
+	if (nextHeaderSize == 0)
+		return true;
+
+	const uint8_t* header = data + SignatureHeaderSize + nextHeaderOffset;
+	std::vector<uint8_t> decodedHeader;
+	ByteReader reader = { header, header + nextHeaderSize };
+	for (int i = 0; i < 4; i++)
+	{
+		uint64_t id = reader.read_number();
+		if (id == Header)
+		{
+			read_header(reader, archive_out);
+			return !reader.Error;
+		}
+		if (id != EncodedHeader)
+			return false;
+
+		// The real header is itself packed; decode it and parse the result
+		SevenZipArchive headerArchive = { data, size };
+		SubStreams subStreams;
+		read_streams_info(reader, headerArchive, subStreams);
+		if (reader.Error || headerArchive.Folders.empty())
+			return false;
+
+		std::vector<uint8_t> nextHeader;
+		if (!decode_7z_folder(headerArchive, 0, nextHeader))
+			return false;
+
+		decodedHeader.swap(nextHeader);
+		reader = { decodedHeader.data(), decodedHeader.data() + decodedHeader.size() };
+	}
+	return false;
+}
+
+bool decode_7z_folder(const SevenZipArchive& archive, uint32_t folderIndex, std::vector<uint8_t>& out, Lzma2Stats* stats)
+{
+	if (folderIndex >= archive.Folders.size())
+		return false;
+
+	auto& folder = archive.Folders[folderIndex];
+	uint32_t outIndex;
+	if (!find_main_out_stream(folder, outIndex))
+		return false;
+
+	FolderCrcChecker crcs(archive, folderIndex, folder.UnpackSizes[outIndex]);
+	LzmaOutputObserver observer = [&crcs, &out](size_t offset, size_t size) { crcs.add(out.data() + offset, offset, size); };
+	return decode_out_stream(archive, folder, outIndex, out, stats, crcs.empty() ? nullptr : &observer, 0) && crcs.check();
+}
+
+bool extract_7z_item(const SevenZipArchive& archive, size_t itemIndex, std::vector<uint8_t>& out, Lzma2Stats* stats)
+{
+	if (itemIndex >= archive.Items.size())
+		return false;
+
+	auto& item = archive.Items[itemIndex];
+	if (!item.HasStream)
+	{
+		out.clear();
+		return true;
+	}
+
+	std::vector<uint8_t> folderData;
+	if (!decode_7z_folder(archive, item.Folder, folderData, stats))
+		return false;
+
+	if (item.FolderOffset > folderData.size() || item.Size > folderData.size() - item.FolderOffset)
+		return false;
+
+	if (item.FolderOffset == 0 && item.Size == folderData.size())
+	{
+		out.swap(folderData);
+	}
+	else
+	{
+		auto first = folderData.begin() + static_cast<size_t>(item.FolderOffset);
+		out.assign(first, first + static_cast<size_t>(item.Size));
+	}
+	return true;
+}
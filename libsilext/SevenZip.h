@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Lzma.h"
+
+struct SevenZipCoder
+{
+	std::vector<uint8_t> MethodId;
+	std::vector<uint8_t> Properties;
+	uint32_t NumInStreams;
+	uint32_t NumOutStreams;
+};
+
+struct SevenZipFolder
+{
+	std::vector<SevenZipCoder> Coders;
+	std::vector<std::pair<uint32_t, uint32_t>> BindPairs; // coder in stream, coder out stream
+	std::vector<uint32_t> PackedStreams;
+	std::vector<uint64_t> UnpackSizes;
+	uint32_t FirstPackStream;
+	uint32_t NumUnpackStreams;
+	bool HasCrc;
+	uint32_t Crc;
+};
+
+struct SevenZipItem
+{
+	std::wstring Name;
+	uint64_t Size;
+	bool IsDirectory;
+	bool HasStream;
+	uint32_t Folder;
+	uint64_t FolderOffset;
+	bool HasCrc;
+	uint32_t Crc;
+};
+
+// A 7z archive that is read in place from memory; Data must outlive the archive.
+struct SevenZipArchive
+{
+	const uint8_t* Data;
+	size_t Size;
+	std::vector<uint64_t> PackOffsets;
+	std::vector<uint64_t> PackSizes;
+	std::vector<SevenZipFolder> Folders;
+	std::vector<SevenZipItem> Items;
+};
+
+bool open_7z(const uint8_t* data, size_t size, SevenZipArchive& archive_out);
+
+uint64_t get_7z_folder_size(const SevenZipFolder& folder);
+
+// Decodes a complete (solid) folder. Returns false for unsupported coders (e.g. BCJ2 or AES),
+// in which case the archive has to be handled by 7z.dll instead, and if the CRC of the folder or of
+// one of its items does not match. The CRCs are computed on the output as it is decoded.
+// LZMA2 segment statistics are accumulated into stats when given.
+bool decode_7z_folder(const SevenZipArchive& archive, uint32_t folderIndex, std::vector<uint8_t>& out, Lzma2Stats* stats = nullptr);
+
+bool extract_7z_item(const SevenZipArchive& archive, size_t itemIndex, std::vector<uint8_t>& out, Lzma2Stats* stats = nullptr);
@@ -0,0 +1,316 @@
+#include "Sha256.h"
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include "Cpu.h"
+
+namespace
+{
+	const uint32_t InitialState[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+
+	const uint32_t RoundConstants[64] = {
+		0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+		0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+		0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+		0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+		0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+		0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+		0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+		0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+	};
+
+	inline uint32_t read_uint32_be(const uint8_t* p)
+	{
+		return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	inline uint32_t rotr(uint32_t x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	void compress_scalar(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		for (; count; blocks += 64, count--)
+		{
+			uint32_t w[64];
+			for (int t = 0; t < 16; t++)
+				w[t] = read_uint32_be(blocks + 4 * t);
+			for (int t = 16; t < 64; t++)
+			{
+				uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+				uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+				w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int t = 0; t < 64; t++)
+			{
+				uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + RoundConstants[t] + w[t];
+				uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+	// With the SHA extensions, which run two rounds per instruction on the state kept as its ABEF and
+	// CDGH halves; the message words are loaded big-endian
+	void compress_shani(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		const __m128i byteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0B, 0x0405060700010203);
+
+		__m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+		__m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+		__m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+		__m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+		__m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+		__m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+		for (; count; blocks += 64, count--)
+		{
+			__m128i abefSaved = abef;
+			__m128i cdghSaved = cdgh;
+
+			__m128i messages[4];
+			for (int i = 0; i < 4; i++)
+				messages[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), byteSwap);
+
+			// Every group of four rounds also advances the schedule of the groups after it
+			for (int i = 0; i < 16; i++)
+			{
+				const __m128i current = messages[i & 3];
+				__m128i words = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(RoundConstants + 4 * i)));
+				cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+				if (i >= 3 && i <= 14)
+				{
+					__m128i& next = messages[(i + 1) & 3];
+					next = _mm_sha256msg2_epu32(_mm_add_epi32(next, _mm_alignr_epi8(current, messages[(i - 1) & 3], 4)), current);
+				}
+				abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0E));
+				if (i >= 1 && i <= 12)
+					messages[(i - 1) & 3] = _mm_sha256msg1_epu32(messages[(i - 1) & 3], current);
+			}
+
+			abef = _mm_add_epi32(abef, abefSaved);
+			cdgh = _mm_add_epi32(cdgh, cdghSaved);
+		}
+
+		__m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+		__m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(feba, dchg, 0xF0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+	}
+
+	bool has_shani()
+	{
+		auto& cpu = get_cpu_features();
+		return cpu.Sha && cpu.Sse41;
+	}
+
+	void compress(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		if (has_shani())
+			compress_shani(state, blocks, count);
+		else
+			compress_scalar(state, blocks, count);
+	}
+
+	// The final one or two blocks of a message: its remaining bytes, the 0x80 marker, zeros and the
+	// length in bits. Returns the number of blocks.
+	size_t pad_message(const uint8_t* rest, size_t restSize, uint64_t length, uint8_t* tail)
+	{
+		size_t tailSize = restSize + 9 > 64 ? 128 : 64;
+		memset(tail, 0, tailSize);
+		memcpy(tail, rest, restSize);
+		tail[restSize] = 0x80;
+		for (int i = 0; i < 8; i++)
+			tail[tailSize - 1 - i] = static_cast<uint8_t>((length * 8) >> (8 * i));
+		return tailSize / 64;
+	}
+
+	Sha256Digest get_digest(const uint32_t* state)
+	{
+		Sha256Digest digest;
+		for (int i = 0; i < 8; i++)
+		{
+			digest[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+			digest[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+			digest[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+			digest[4 * i + 3] = static_cast<uint8_t>(state[i]);
+		}
+		return digest;
+	}
+
+	inline __m256i rotr8(__m256i x, int n)
+	{
+		return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+	}
+
+	// A message in a lane of the multi-buffer hash; its blocks are taken from the data in place, and
+	// then from the padded tail
+	struct Lane
+	{
+		size_t Message;
+		size_t Block;
+		size_t FullBlocks;
+		size_t Blocks;
+		uint8_t Tail[128];
+
+		const uint8_t* get_block(const uint8_t* data) const
+		{
+			return Block < FullBlocks ? data + 64 * Block : Tail + 64 * (Block - FullBlocks);
+		}
+	};
+
+	// Eight messages at a time, one per 32-bit lane: the same rounds as compress_scalar on vectors
+	void sha256_many_avx2(const uint8_t* const* data, const size_t* sizes, size_t count, Sha256Digest* digests_out)
+	{
+		const size_t NumLanes = 8;
+		const size_t Idle = static_cast<size_t>(-1);
+
+		Lane lanes[NumLanes];
+		alignas(32) uint32_t state[8][NumLanes];
+		size_t next = 0;
+		auto start_message = [&](size_t lane)
+		{
+			Lane& l = lanes[lane];
+			l.Message = next < count ? next++ : Idle;
+			l.Block = 0;
+			if (l.Message == Idle)
+				return;
+			l.FullBlocks = sizes[l.Message] / 64;
+			l.Blocks = l.FullBlocks + pad_message(data[l.Message] + 64 * l.FullBlocks, sizes[l.Message] % 64, sizes[l.Message], l.Tail);
+			for (int i = 0; i < 8; i++)
+				state[i][lane] = InitialState[i];
+		};
+		for (size_t lane = 0; lane < NumLanes; lane++)
+			start_message(lane);
+
+		while (true)
+		{
+			bool active = false;
+			alignas(32) uint32_t words[16][NumLanes];
+			for (size_t lane = 0; lane < NumLanes; lane++)
+			{
+				const uint8_t* block = lanes[lane].Message == Idle ? lanes[0].Tail : lanes[lane].get_block(data[lanes[lane].Message]);
+				active |= lanes[lane].Message != Idle;
+				for (int t = 0; t < 16; t++)
+					words[t][lane] = read_uint32_be(block + 4 * t);
+			}
+			if (!active)
+				break;
+
+			__m256i w[16];
+			for (int t = 0; t < 16; t++)
+				w[t] = _mm256_load_si256(reinterpret_cast<const __m256i*>(words[t]));
+			__m256i v[8];
+			for (int i = 0; i < 8; i++)
+				v[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[i]));
+
+			__m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+			for (int t = 0; t < 64; t++)
+			{
+				if (t >= 16)
+				{
+					__m256i w15 = w[(t - 15) & 15];
+					__m256i w2 = w[(t - 2) & 15];
+					__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w15, 7), rotr8(w15, 18)), _mm256_srli_epi32(w15, 3));
+					__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w2, 17), rotr8(w2, 19)), _mm256_srli_epi32(w2, 10));
+					w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+				}
+
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(e, 6), rotr8(e, 11)), rotr8(e, 25));
+				__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+				__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, w[t & 15])), _mm256_set1_epi32(static_cast<int>(RoundConstants[t])));
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(a, 2), rotr8(a, 13)), rotr8(a, 22));
+				__m256i maj = _mm256_xor_si256(_mm256_and_si256(a, _mm256_xor_si256(b, c)), _mm256_and_si256(b, c));
+				h = g;
+				g = f;
+				f = e;
+				e = _mm256_add_epi32(d, t1);
+				d = c;
+				c = b;
+				b = a;
+				a = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+			}
+
+			__m256i result[8] = { a, b, c, d, e, f, g, h };
+			for (int i = 0; i < 8; i++)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(state[i]), _mm256_add_epi32(v[i], result[i]));
+
+			for (size_t lane = 0; lane < NumLanes; lane++)
+			{
+				Lane& l = lanes[lane];
+				if (l.Message == Idle || ++l.Block < l.Blocks)
+					continue;
+
+				uint32_t laneState[8];
+				for (int i = 0; i < 8; i++)
+					laneState[i] = state[i][lane];
+				digests_out[l.Message] = get_digest(laneState);
+				start_message(lane);
+			}
+		}
+	}
+}
+
+Sha256::Sha256()
+{
+	memcpy(state, InitialState, sizeof(state));
+}
+
+void Sha256::update(const uint8_t* data, size_t size)
+{
+	length += size;
+	if (buffered)
+	{
+		size_t count = std::min(size, sizeof(buffer) - buffered);
+		memcpy(buffer + buffered, data, count);
+		buffered += count;
+		data += count;
+		size -= count;
+		if (buffered < sizeof(buffer))
+			return;
+		compress(state, buffer, 1);
+		buffered = 0;
+	}
+
+	compress(state, data, size / 64);
+	buffered = size % 64;
+	memcpy(buffer, data + size - buffered, buffered);
+}
+
+Sha256Digest Sha256::finish()
+{
+	uint8_t tail[128];
+	compress(state, tail, pad_message(buffer, buffered, length, tail));
+	return get_digest(state);
+}
+
+void sha256_many(const uint8_t* const* data, const size_t* sizes, size_t count, Sha256Digest* digests_out)
+{
+	if (!has_shani() && get_cpu_features().Avx2)
+	{
+		sha256_many_avx2(data, sizes, count, digests_out);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Sha256 hash;
+		hash.update(data[i], sizes[i]);
+		digests_out[i] = hash.finish();
+	}
+}
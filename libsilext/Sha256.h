@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+typedef std::array<uint8_t, 32> Sha256Digest;
+
+// Incremental SHA-256, using the SHA extensions (SHA-NI) where the CPU has them
+class Sha256
+{
+public:
+	Sha256();
+
+	void update(const uint8_t* data, size_t size);
+
+	Sha256Digest finish();
+
+private:
+	uint32_t state[8];
+	uint8_t buffer[64];
+	size_t buffered = 0;
+	uint64_t length = 0;
+};
+
+// Hashes count whole messages. Without SHA-NI, AVX2 runs eight of them side by side in the lanes of
+// its vectors (multi-buffer), and a lane takes the next message as soon as its own is done, so that
+// many small files of any size keep all lanes busy.
+void sha256_many(const uint8_t* const* data, const size_t* sizes, size_t count, Sha256Digest* digests_out);
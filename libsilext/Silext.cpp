@@ -0,0 +1,1443 @@
+#include "Silext.h"
+
+#include <tchar.h>
+#include <crtdbg.h>
+#include <objbase.h>
+#include <msiquery.h>
+#include <setupapi.h>
+#include <shlwapi.h>
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cwchar>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <bitarchiveinfo.hpp>
+#include <bitextractor.hpp>
+#include "Cabinet.h"
+#include "CabinetIndex.h"
+#include "CabinetReader.h"
+#include "MetadataCache.h"
+#include "Resolver.h"
+#include "Util.h"
+
+#pragma comment(lib, "msi.lib")
+#pragma comment(lib, "setupapi.lib")
+
+/*
+STEPS:
+1-3: Resolve the nested containers of the memory-mapped EXE (EXE -> CAB -> 7z -> MSP) in memory,
+	sniffing the format of every member (Z-7ip and the MSI API as fallback)
+	RESULT:
+	- silverlight.msi
+	- oldTocurrent.mst
+	- PCW_CAB_Silver.cab
+4: Apply "oldTocurrent.mst" transform to silverlight.msi from step 1 (in memory)
+5: Read File and Directory tables
+6: Reconstruct the directory structure using Directory table info
+7: Reconstruct the relative path and file name of every file
+8: Decode PCW_CAB_Silver.cab and pass every file to the FileSink under its path from 6 and 7
+	RESULT: Uncompressed files in structure (on disk when the sink is the CLI)
+DONE
+*/
+
+namespace
+{
+	const CLSID CLSID_MsiTransform = { 0xC1082, 0x0, 0x0, {0xC0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x46} };
+
+	bool make_path(LPTSTR pszDest, size_t cchDest, const std::wstring& pszDir, const std::wstring& pszName, const std::wstring& pszExt)
+	{
+		// Make sure pszDest is NULL-terminated.
+		pszDest[0] = TEXT('\0');
+
+		size_t len = pszDir.length();
+		if (len)
+		{
+			if (0 != _tcsncpy_s(pszDest, cchDest, pszDir.c_str(), pszDir.length()))
+			{
+				return false;
+			}
+
+			if (len && TEXT('\\') != pszDest[len - 1])
+			{
+				// Make sure the path ends with a "\".
+				if (0 != _tcsncat_s(pszDest, cchDest, TEXT("\\"), _TRUNCATE))
+				{
+					return false;
+				}
+			}
+		}
+
+		// Append the file name.
+		if (0 != _tcsncat_s(pszDest, cchDest, pszName.c_str(), _TRUNCATE))
+		{
+			return false;
+		}
+
+		// Append the extension.
+		if (!pszExt.empty())
+		{
+			if (0 != _tcsncat_s(pszDest, cchDest, pszExt.c_str(), _TRUNCATE))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Most cells fit the buffer and take a single call; longer ones are read again at their length
+	std::wstring get_record_string(MSIHANDLE hRecord, unsigned int iField)
+	{
+		wchar_t szValueBuf[MAX_PATH] = L"";
+		DWORD cchValue = MAX_PATH;
+		UINT result = MsiRecordGetString(hRecord, iField, szValueBuf, &cchValue);
+		if (result == ERROR_SUCCESS)
+			return std::wstring(szValueBuf, cchValue);
+		if (result != ERROR_MORE_DATA)
+			return std::wstring();
+
+		std::wstring value(cchValue, L'\0');
+		cchValue++;
+		if (MsiRecordGetString(hRecord, iField, &value[0], &cchValue) != ERROR_SUCCESS)
+			return std::wstring();
+		value.resize(cchValue);
+		return value;
+	}
+
+	// Passes every record of the query to recordFunc, which is called as void(PMSIHANDLE& hRecord)
+	template <typename RecordFunc>
+	void execute_view(PMSIHANDLE& hDatabase, const std::wstring& query, RecordFunc recordFunc)
+	{
+		PMSIHANDLE hView, hRecord;
+		if (MsiDatabaseOpenView(hDatabase, query.c_str(), &hView) == ERROR_SUCCESS)
+			if (MsiViewExecute(hView, NULL) == ERROR_SUCCESS)
+				while (MsiViewFetch(hView, &hRecord) == ERROR_SUCCESS)
+					recordFunc(hRecord);
+	}
+
+	// The columns of an MSI table that are read, in the order of the rows they are read into
+	template <size_t NumColumns>
+	struct TableSchema
+	{
+		const wchar_t* Table;
+		std::array<const wchar_t*, NumColumns> Columns;
+	};
+
+	template <size_t NumColumns>
+	using TableRow = std::array<std::wstring, NumColumns>;
+
+	constexpr TableSchema<3> DirectorySchema = { L"Directory", { L"Directory", L"Directory_Parent", L"DefaultDir" } };
+	constexpr TableSchema<3> FileSchema = { L"File", { L"File", L"FileName", L"Component_" } };
+	constexpr TableSchema<2> ComponentSchema = { L"Component", { L"Component", L"Directory_" } };
+	constexpr TableSchema<5> FileHashSchema = { L"MsiFileHash", { L"File_", L"HashPart1", L"HashPart2", L"HashPart3", L"HashPart4" } };
+
+	// Passes every row of the table to rowFunc, with the columns of the schema as strings
+	template <size_t NumColumns, typename RowFunc>
+	void read_table(PMSIHANDLE& hDatabase, const TableSchema<NumColumns>& schema, RowFunc rowFunc)
+	{
+		std::wstring query = L"SELECT ";
+		for (size_t i = 0; i < NumColumns; i++)
+			query += (i ? L", `" : L"`") + std::wstring(schema.Columns[i]) + L"`";
+		query += L" FROM `" + std::wstring(schema.Table) + L"`";
+
+		execute_view(hDatabase, query, [&rowFunc](PMSIHANDLE& hRecord)
+		{
+			TableRow<NumColumns> row;
+			for (size_t i = 0; i < NumColumns; i++)
+				row[i] = get_record_string(hRecord, static_cast<unsigned int>(i + 1));
+			rowFunc(row);
+		});
+	}
+
+	void get_directories(PMSIHANDLE& hDatabase, std::map<std::wstring, DirInfo>& directories)
+	{
+		read_table(hDatabase, DirectorySchema, [&directories](TableRow<3>& row)
+		{
+			directories[std::move(row[0])] = { std::move(row[1]), std::move(row[2]) };
+		});
+	}
+
+	// The parts of an MsiFileHash row are the four 32-bit words of the MD5, as MsiGetFileHash returns
+	// them (little-endian), stored as signed integers
+	std::optional<Md5Digest> parse_file_hash(const TableRow<5>& row)
+	{
+		Md5Digest digest;
+		for (size_t i = 0; i < 4; i++)
+		{
+			const std::wstring& part = row[i + 1];
+			wchar_t* end;
+			auto value = static_cast<uint32_t>(std::wcstol(part.c_str(), &end, 10));
+			if (part.empty() || *end)
+				return std::nullopt;
+			for (size_t j = 0; j < 4; j++)
+				digest[4 * i + j] = static_cast<uint8_t>(value >> (8 * j));
+		}
+		return digest;
+	}
+
+	// The File table joined with the Component table in memory, which reads each table once instead of
+	// having the MSI engine look up the component of every file
+	void get_files(PMSIHANDLE& hDatabase, std::map<std::wstring, FileInfo>& files)
+	{
+		std::unordered_map<std::wstring, std::wstring> componentDirectories;
+		read_table(hDatabase, ComponentSchema, [&componentDirectories](TableRow<2>& row)
+		{
+			componentDirectories.emplace(std::move(row[0]), std::move(row[1]));
+		});
+
+		read_table(hDatabase, FileSchema, [&files, &componentDirectories](TableRow<3>& row)
+		{
+			auto directory = componentDirectories.find(row[2]);
+			if (directory != componentDirectories.end())
+				files[std::move(row[0])] = { std::move(row[1]), directory->second };
+		});
+
+		read_table(hDatabase, FileHashSchema, [&files](TableRow<5>& row)
+		{
+			auto file = files.find(row[0]);
+			if (file != files.end())
+				file->second.Md5 = parse_file_hash(row);
+		});
+	}
+
+	unsigned int save_stream(MSIHANDLE hRecord, const std::wstring& directory)
+	{
+		unsigned int uiError = NOERROR;
+		wchar_t szPath[MAX_PATH];
+		char szBuffer[256];
+		unsigned long cbBuffer = sizeof(szBuffer);
+		std::ofstream file;
+
+		std::wstring streamName = get_record_string(hRecord, 1);
+		if (!streamName.empty() && streamName[0] != 5)
+		{
+			// Create the local file with the simple CFile write-only class.
+			do
+			{
+				uiError = MsiRecordReadStream(hRecord, 2, szBuffer, &cbBuffer);
+				if (ERROR_SUCCESS == uiError)
+				{
+					if (!file.is_open())
+					{
+						if (0 == memcmp(szBuffer, "MSCF", 4))
+						{
+							if (make_path(szPath, MAX_PATH, directory.c_str(), streamName.c_str(), L".cab"))
+							{
+								// Create the local file in which data is written.
+								file.open(szPath, std::ios_base::binary);
+							}
+						}
+					}
+
+					file.write(szBuffer, cbBuffer);
+				}
+			} while (cbBuffer && ERROR_SUCCESS == uiError);
+		}
+
+		file.close();
+
+		return uiError;
+	}
+
+	void save_streams(PMSIHANDLE& hDatabase, const std::wstring& directory)
+	{
+		execute_view(hDatabase,
+			L"SELECT Name, Data FROM _Streams",
+			[&directory](PMSIHANDLE& hRecord)
+		{
+			save_stream(hRecord, directory);
+		});
+	}
+
+	HRESULT save_storage(IStorage* const pRootStorage, const std::wstring& pszDir, const std::wstring& pszName, const std::wstring& pszExt)
+	{
+		HRESULT hr = NOERROR;
+		wchar_t szPath[MAX_PATH] = { L'\0' };
+		IStorage* pStg = nullptr;
+		IStorage* pFileStg = nullptr;
+
+		_ASSERTE(pRootStorage);
+
+		hr = pRootStorage->OpenStorage(
+			pszName.c_str(),
+			NULL,
+			STGM_READ | STGM_SHARE_EXCLUSIVE,
+			NULL,
+			0,
+			&pStg);
+		if (SUCCEEDED(hr) && pStg)
+		{
+			if (!make_path(szPath, MAX_PATH, pszDir, pszName, pszExt))
+			{
+				hr = E_INVALIDARG;
+			}
+			else
+			{
+				// Create the storage file.
+				hr = StgCreateDocfile(
+					szPath,
+					STGM_WRITE | STGM_SHARE_EXCLUSIVE | STGM_CREATE,
+					0,
+					&pFileStg);
+				if (SUCCEEDED(hr) && pFileStg)
+				{
+					hr = pStg->CopyTo(0, NULL, NULL, pFileStg);
+				}
+			}
+		}
+
+		if (pFileStg) pFileStg->Release();
+		if (pStg) pStg->Release();
+
+		return hr;
+	}
+
+	void save_msp_elements(IStorage* const pRootStorage, const std::wstring& workDir)
+	{
+		IEnumSTATSTG* pEnum = nullptr;
+		HRESULT hr = pRootStorage->EnumElements(0, NULL, 0, &pEnum);
+		if (SUCCEEDED(hr))
+		{
+			STATSTG stg = { 0 };
+			while (S_OK == (hr = pEnum->Next(1, &stg, NULL)))
+			{
+				if (STGTY_STORAGE == stg.type && stg.clsid == CLSID_MsiTransform)
+					save_storage(pRootStorage, workDir, stg.pwcsName, L".mst");
+				CoTaskMemFree(stg.pwcsName);
+			}
+			if (pEnum) pEnum->Release();
+		}
+	}
+
+	void extract_msp(const std::wstring& mspName, const std::wstring& workDir, StageTimings& timings)
+	{
+		StageTimer timer(timings, L"extract_msp");
+		IStorage* pRootStorage = nullptr;
+
+		//// Open the root storage file and extract storages first. Storages cannot
+		//// be extracted using MSI APIs so we must use the compound file implementation
+		//// for IStorage.
+		HRESULT hr = StgOpenStorage(mspName.c_str(), NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pRootStorage);
+		if (SUCCEEDED(hr) && pRootStorage)
+			save_msp_elements(pRootStorage, workDir);
+		if (pRootStorage) pRootStorage->Release();
+
+		PMSIHANDLE hDatabase;
+		if (MsiOpenDatabase(mspName.c_str(), (LPCTSTR)(MSIDBOPEN_READONLY + MSIDBOPEN_PATCHFILE), &hDatabase) == ERROR_SUCCESS)
+		{
+			save_streams(hDatabase, workDir);
+		}
+		MsiCloseHandle(hDatabase);
+	}
+
+	void get_files_from_mst(const std::wstring& msiName, const std::wstring& mstFile, DbInfo& dbInfo, StageTimings& timings)
+	{
+		PMSIHANDLE hDatabase = NULL;
+		PMSIHANDLE hView = NULL;
+		PMSIHANDLE hRecord = NULL;
+
+		UINT dwError;
+		{
+			StageTimer timer(timings, L"open_msi");
+			dwError = MsiOpenDatabase(msiName.c_str(), MSIDBOPEN_READONLY, &hDatabase);
+		}
+		if (ERROR_SUCCESS == dwError)
+		{
+			{
+				StageTimer timer(timings, L"apply_transform");
+				MsiDatabaseApplyTransform(hDatabase, mstFile.c_str(), 0);
+			}
+
+			StageTimer timer(timings, L"load_tables");
+			get_directories(hDatabase, dbInfo.Directories);
+			get_files(hDatabase, dbInfo.Files);
+		}
+	}
+
+	const std::wstring SourceDirPathPart = L"SourceDir";
+	const std::wstring PFiles64PathPart = L"PFiles_64";
+	const size_t MaxPrefetchBytes = 256 * 1024 * 1024;
+
+	// The long name of a DefaultDir or FileName, which holds "short|long" when they differ
+	std::wstring get_long_name(const std::wstring& name)
+	{
+		return name.substr(name.rfind(L'|') + 1);
+	}
+
+	// Determines where the files of the cabinet go in the whole tree (below SourceDir) from the File and
+	// Directory tables, which are kept as they were read. The path of a directory is only built when the
+	// first file in it is resolved, from the path of its parent, and then reused by the other files. The
+	// filters of the decoders resolve files from their own threads.
+	class PathResolver
+	{
+	public:
+		explicit PathResolver(const DbInfo& dbInfo) : dbInfo(dbInfo) {}
+
+		// False if the tables do not list the file
+		bool resolve(const std::wstring& nameInCabinet, std::wstring& path_out)
+		{
+			auto fileInfoIt = dbInfo.Files.find(nameInCabinet);
+			if (fileInfoIt == dbInfo.Files.end())
+				return false;
+
+			const FileInfo& fileInfo = fileInfoIt->second;
+			std::wstring directory;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				directory = get_directory_path(fileInfo.DirectoryKey);
+			}
+
+			const std::wstring sourceDir = SourceDirPathPart + L"\\";
+			if (directory.compare(0, sourceDir.size(), sourceDir) == 0)
+				directory.erase(0, sourceDir.size());
+			path_out = directory + get_long_name(fileInfo.FileName);
+			return true;
+		}
+
+	private:
+		// The names from the root down, each followed by a separator; a directory the table does not
+		// list ends the chain. A root may be its own parent, as the schema allows; a cycle, which only a
+		// malformed transform creates, ends where it comes back to a directory on the way.
+		const std::wstring& get_directory_path(const std::wstring& key)
+		{
+			static const std::wstring cycle;
+			auto cached = directoryPaths.find(key);
+			if (cached != directoryPaths.end())
+				return cached->second;
+			if (!visiting.insert(key).second)
+				return cycle;
+
+			std::wstring path;
+			auto dirInfoIt = dbInfo.Directories.find(key);
+			if (dirInfoIt != dbInfo.Directories.end())
+			{
+				auto& dirInfo = dirInfoIt->second;
+				if (!dirInfo.ParentKey.empty() && dirInfo.ParentKey != key)
+					path = get_directory_path(dirInfo.ParentKey);
+				path += get_long_name(dirInfo.Name) + L"\\";
+			}
+			visiting.erase(key);
+			return directoryPaths.emplace(key, std::move(path)).first->second;
+		}
+
+		const DbInfo& dbInfo;
+		std::mutex mutex;
+		std::unordered_map<std::wstring, std::wstring> directoryPaths; // By directory key
+		std::unordered_set<std::wstring> visiting; // The directories get_directory_path is below
+	};
+
+	// Applies the extract options to a path of the whole tree; false if the file is not extracted
+	bool select_relative_path(const std::wstring& path, const ExtractOptions& extractOptions, std::wstring& path_out)
+	{
+		std::wstring selected = path;
+		if (extractOptions.sixtyFourBitOnly)
+		{
+			const std::wstring prefix = PFiles64PathPart + L"\\";
+			if (selected.compare(0, prefix.size(), prefix) != 0)
+				return false;
+			selected.erase(0, prefix.size());
+		}
+
+		if (!extractOptions.pathFilter.matches(selected))
+			return false;
+
+		path_out = selected;
+		return true;
+	}
+
+	// Determines where a file of the cabinet goes in the extracted tree; false if it is not extracted
+	bool get_relative_path(const std::wstring& nameInCabinet, PathResolver& paths, const ExtractOptions& extractOptions, std::wstring& path_out)
+	{
+		std::wstring path;
+		return paths.resolve(nameInCabinet, path) && select_relative_path(path, extractOptions, path_out);
+	}
+
+	// Whether get_relative_path leaves out any file the tables list
+	bool is_selective(const ExtractOptions& extractOptions)
+	{
+		return extractOptions.sixtyFourBitOnly || !extractOptions.pathFilter.empty();
+	}
+
+	SinkFile make_sink_file(const std::wstring& path, const std::wstring& nameInCabinet, uint64_t size, uint16_t date, uint16_t time, uint16_t attributes)
+	{
+		SinkFile file = { path, nameInCabinet, size, {}, attributes & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE) };
+
+		// Cabinets store local time, the same as SetupIterateCabinet the time stamp is converted to UTC
+		FILETIME localTime;
+		if (!DosDateTimeToFileTime(date, time, &localTime) || !LocalFileTimeToFileTime(&localTime, &file.LastWriteTime))
+			file.LastWriteTime = {};
+		return file;
+	}
+
+	bool send_to_sink(FileSink& sink, const SinkFile& file, const uint8_t* data, size_t size)
+	{
+		if (!sink.begin_file(file))
+			return false;
+
+		for (size_t pos = 0; pos < size; pos += MaxSinkChunk)
+		{
+			if (!sink.write_chunk(data + pos, std::min(size - pos, MaxSinkChunk)))
+				return false;
+		}
+		return sink.end_file();
+	}
+
+	struct CabExtractContext
+	{
+		const std::wstring tempPath;
+		PathResolver& paths;
+		const ExtractOptions& extractOptions;
+		FileSink& sink;
+		const CancellationToken& cancellation;
+		SinkFile file;
+		bool failed;
+	};
+
+	bool send_extracted_file(FileSink& sink, const SinkFile& file, const std::wstring& path)
+	{
+		std::ifstream stream(path, std::ios_base::binary);
+		if (!stream.is_open() || !sink.begin_file(file))
+			return false;
+
+		std::vector<char> buffer(MaxSinkChunk);
+		while (stream)
+		{
+			stream.read(buffer.data(), buffer.size());
+			auto count = static_cast<size_t>(stream.gcount());
+			if (count && !sink.write_chunk(reinterpret_cast<const uint8_t*>(buffer.data()), count))
+				return false;
+		}
+		return sink.end_file();
+	}
+
+	// The reference backend: SetupIterateCabinet extracts every file to a temporary file in the work dir,
+	// which is passed to the sink and deleted again
+	bool extract_cab(const std::wstring& cabName, const std::wstring& workDir, PathResolver& paths, const ExtractOptions& extractOptions, FileSink& sink, const CancellationToken& cancellation, StageTimings& timings)
+	{
+		StageTimer timer(timings, L"extract_cab");
+		auto context = CabExtractContext{ concat_path(workDir, L"payload.tmp"), paths, extractOptions, sink, cancellation, {}, false };
+		BOOL iterated = SetupIterateCabinet(cabName.c_str(), 0,
+			[](PVOID context, UINT notification, UINT_PTR param1, UINT_PTR param2) -> UINT
+		{
+			auto ccontext = static_cast<CabExtractContext*>(context);
+			if (notification == SPFILENOTIFY_FILEINCABINET)
+			{
+				auto fileInCabinetInfo = reinterpret_cast<FILE_IN_CABINET_INFO*>(param1);
+				if (ccontext->cancellation.is_cancelled())
+					return FILEOP_ABORT;
+
+				std::wstring path;
+				if (!get_relative_path(fileInCabinetInfo->NameInCabinet, ccontext->paths, ccontext->extractOptions, path))
+					return FILEOP_SKIP;
+
+				ccontext->file = make_sink_file(path, fileInCabinetInfo->NameInCabinet, fileInCabinetInfo->FileSize, fileInCabinetInfo->DosDate, fileInCabinetInfo->DosTime, fileInCabinetInfo->DosAttribs);
+				wcsncpy_s(fileInCabinetInfo->FullTargetName, ccontext->tempPath.c_str(), _TRUNCATE);
+				return FILEOP_DOIT;
+			}
+			if (notification == SPFILENOTIFY_FILEEXTRACTED)
+			{
+				auto filePaths = reinterpret_cast<FILEPATHS*>(param1);
+				bool sent = filePaths->Win32Error == NO_ERROR && send_extracted_file(ccontext->sink, ccontext->file, filePaths->Target);
+				SetFileAttributes(filePaths->Target, FILE_ATTRIBUTE_NORMAL);
+				DeleteFile(filePaths->Target);
+				if (!sent)
+				{
+					ccontext->failed = true;
+					return ERROR_WRITE_FAULT;
+				}
+			}
+			return NO_ERROR;
+		}, static_cast<void*>(&context));
+		return iterated && !context.failed;
+	}
+
+	// Decodes the files of a cabinet that filter takes into sink
+	typedef std::function<bool(const CabinetFilter& filter, const CabinetSink& sink)> CabinetDecoder;
+
+	// The native decoders on the whole cabinet, checking the blocks with verifier unless it is null, or
+	// FDI for Quantum; empty without a cabinet
+	CabinetDecoder get_memory_decoder(const uint8_t* cabData, size_t cabSize, BlockVerifier* verifier)
+	{
+		if (!cabData)
+			return nullptr;
+		return [cabData, cabSize, verifier](const CabinetFilter& filter, const CabinetSink& sink) { return extract_cab_native(cabData, cabSize, verifier, filter, sink); };
+	}
+
+	// Decodes a cabinet on a worker thread while the MSI tables are still being loaded. Decoded files
+	// wait in a bounded buffer until their target paths are known; the decoder blocks when it is full.
+	// With waitForFilter the decoder first waits for set_filter instead, so that it skips the files that
+	// are not extracted: a folder without wanted files is then never decompressed.
+	class CabinetPrefetch
+	{
+	public:
+		// Whatever the decoder reads has to outlive the prefetch
+		CabinetPrefetch(CabinetDecoder cabinetDecoder, size_t maxBufferedBytes, bool waitForFilter)
+			: decoder(std::move(cabinetDecoder)), maxBufferedBytes(maxBufferedBytes), filterSet(!waitForFilter)
+		{
+			if (!decoder)
+			{
+				done = true;
+				return;
+			}
+			worker = std::thread([this]() { decode(); });
+		}
+
+		CabinetPrefetch(const CabinetPrefetch&) = delete;
+		CabinetPrefetch& operator=(const CabinetPrefetch&) = delete;
+
+		~CabinetPrefetch()
+		{
+			cancel();
+			if (worker.joinable())
+				worker.join();
+		}
+
+		// Stops the decoder at the next file; files that are already buffered can still be taken
+		void cancel()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cancelled = true;
+			}
+			changed.notify_all();
+		}
+
+		// Only has an effect before the decoder started, i.e. with waitForFilter
+		void set_filter(const CabinetFilter& cabinetFilter)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (filterSet)
+					return;
+
+				filter = cabinetFilter;
+				filterSet = true;
+			}
+			changed.notify_all();
+		}
+
+		// Returns false once all files have been taken, or the decoder failed
+		bool pop(CabinetFile& file_out)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this]() { return !files.empty() || done; });
+			if (files.empty())
+				return false;
+
+			file_out = std::move(files.front());
+			files.pop_front();
+			bufferedBytes -= file_out.Data.size();
+			changed.notify_all();
+			return true;
+		}
+
+		bool succeeded()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return done && result;
+		}
+
+		std::chrono::steady_clock::duration get_decode_time()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return decodeTime;
+		}
+
+	private:
+		void decode()
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this]() { return filterSet || cancelled; });
+				if (cancelled)
+				{
+					done = true;
+					changed.notify_all();
+					return;
+				}
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			bool decoded = decoder(filter, [this](CabinetFile&& file) { return push(std::move(file)); });
+
+			std::lock_guard<std::mutex> lock(mutex);
+			decodeTime = std::chrono::steady_clock::now() - start;
+			result = decoded;
+			done = true;
+			changed.notify_all();
+		}
+
+		bool push(CabinetFile&& file)
+		{
+			// A file larger than the whole buffer is let through once the buffer is empty
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return cancelled || files.empty() || bufferedBytes + file.Data.size() <= maxBufferedBytes; });
+			if (cancelled)
+				return false;
+
+			bufferedBytes += file.Data.size();
+			files.push_back(std::move(file));
+			changed.notify_all();
+			return true;
+		}
+
+		const CabinetDecoder decoder;
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<CabinetFile> files;
+		size_t bufferedBytes = 0;
+		const size_t maxBufferedBytes;
+		CabinetFilter filter = [](const std::wstring&) { return true; };
+		bool filterSet;
+		bool done = false;
+		bool cancelled = false;
+		bool result = false;
+		std::chrono::steady_clock::duration decodeTime = std::chrono::steady_clock::duration::zero();
+		std::thread worker;
+	};
+
+	// The relative paths that the filter of a decoder resolved for the files it took, kept until the
+	// files reach the sink so that their paths are not resolved twice. The filter runs on the thread
+	// of the decoder.
+	class ResolvedPaths
+	{
+	public:
+		ResolvedPaths(PathResolver& paths, const ExtractOptions& extractOptions) : paths(paths), extractOptions(extractOptions) {}
+
+		CabinetFilter get_filter()
+		{
+			return [this](const std::wstring& name)
+			{
+				std::wstring path;
+				if (!get_relative_path(name, paths, extractOptions, path))
+					return false;
+
+				std::lock_guard<std::mutex> lock(mutex);
+				resolved[name] = std::move(path);
+				return true;
+			};
+		}
+
+		// The path the filter resolved for the file, or resolved now if the decoder ran without the filter
+		bool take(const std::wstring& name, std::wstring& path_out)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = resolved.find(name);
+				if (it != resolved.end())
+				{
+					path_out = std::move(it->second);
+					resolved.erase(it);
+					return true;
+				}
+			}
+			return get_relative_path(name, paths, extractOptions, path_out);
+		}
+
+	private:
+		PathResolver& paths;
+		const ExtractOptions& extractOptions;
+		std::mutex mutex;
+		std::unordered_map<std::wstring, std::wstring> resolved; // By name in the cabinet
+	};
+
+	// Passes the prefetched files to the sink, which is possible only now that the tables are loaded.
+	// The next file is taken from the decoder on the thread pool, so that the loop stays responsive.
+	Task<bool> deliver_cab_files_async(EventLoop& loop, const CancellationToken& cancellation, CabinetPrefetch& prefetch, ResolvedPaths& paths, FileSink& sink, StageTimings& timings)
+	{
+		StageTimer timer(timings, L"extract_cab");
+		bool result = true;
+		while (result && !cancellation.is_cancelled())
+		{
+			auto file = co_await run_blocking(loop, [&prefetch]() {
+				std::optional<CabinetFile> next;
+				CabinetFile popped;
+				if (prefetch.pop(popped))
+					next = std::move(popped);
+				return next;
+			});
+			if (!file)
+				break;
+
+			std::wstring path;
+			if (paths.take(file->Name, path))
+				result = send_to_sink(sink, make_sink_file(path, file->Name, file->Data.size(), file->Date, file->Time, file->Attributes), file->Data.data(), file->Data.size());
+		}
+
+		if (!result || cancellation.is_cancelled())
+			prefetch.cancel();
+
+		add_stage_timing(timings, L"decode_cab", prefetch.get_decode_time());
+		co_return result && prefetch.succeeded();
+	}
+
+	// Loads the index from indexPath, or builds it and saves it there (unless indexPath is empty)
+	bool get_cabinet_index(const uint8_t* cabData, size_t cabSize, const std::wstring& indexPath, BlockVerifier* verifier, CabinetIndex& index_out, StageTimings& timings)
+	{
+		StageTimer timer(timings, L"index_cab");
+		if (!indexPath.empty() && load_cabinet_index(indexPath, cabData, cabSize, index_out))
+			return true;
+		if (!build_cabinet_index(cabData, cabSize, DefaultCheckpointInterval, verifier, index_out))
+			return false;
+		if (!indexPath.empty())
+			save_cabinet_index(indexPath, index_out);
+		return true;
+	}
+
+	// With an index only the files that are extracted are decoded, each from the nearest checkpoint
+	// before it. The index is built (decoding the whole cabinet once) and saved when it is missing or
+	// stale; if it cannot be built, e.g. for Quantum, every folder is decoded from its start instead.
+	// Either way the files stream to the sink through the bounded buffer of a CabinetPrefetch.
+	Task<bool> extract_cab_indexed_async(EventLoop& loop, const CancellationToken& cancellation, const uint8_t* cabData, size_t cabSize, ResolvedPaths& paths, const ExtractOptions& extractOptions, FileSink& sink, StageTimings& timings)
+	{
+		BlockVerifier verifier;
+		BlockVerifier* checks = extractOptions.verifyChecksums ? &verifier : nullptr;
+		CabinetIndex index;
+		bool indexed = co_await run_blocking(loop, [&]() { return get_cabinet_index(cabData, cabSize, extractOptions.indexPath, checks, index, timings); });
+
+		CabinetDecoder decoder = indexed
+			? [&](const CabinetFilter& filter, const CabinetSink& cabinetSink) { return extract_cab_indexed(cabData, cabSize, index, checks, filter, cabinetSink); }
+			: get_memory_decoder(cabData, cabSize, checks);
+		CabinetPrefetch prefetch(decoder, MaxPrefetchBytes, true);
+		prefetch.set_filter(paths.get_filter());
+		bool extracted = co_await deliver_cab_files_async(loop, cancellation, prefetch, paths, sink, timings);
+		if (checks)
+			add_stage_timing(timings, L"verify_cab", verifier.get_time());
+		co_return extracted;
+	}
+
+	// Only the MSI and the 7z archive of the setup EXE are used
+	bool is_setup_payload(const std::wstring& name)
+	{
+		return PathMatchSpec(name.c_str(), L"*.msi") || PathMatchSpec(name.c_str(), L"*.7z");
+	}
+
+	// The reference pipeline: 7z.dll for the setup EXE and the 7z archive, the MSI API for the MSP
+	ReturnCode extract_setup_reference(const std::wstring& setupExeName, const std::wstring& workDir, StageTimings& timings)
+	{
+		bit7z::Bit7zLibrary blib;
+		{
+			StageTimer timer(timings, L"extract_setup_exe");
+
+			// List the cabinet first so that only the needed items are decoded
+			std::vector<uint32_t> indices;
+			bit7z::BitArchiveInfo setupInfo(blib, setupExeName, bit7z::BitFormat::Cab);
+			for (auto& item : setupInfo.items())
+			{
+				if (!item.isDir() && is_setup_payload(item.name()))
+					indices.push_back(item.index());
+			}
+			bit7z::BitExtractor cextractor(blib, bit7z::BitFormat::Cab);
+			cextractor.extractItems(setupExeName, indices, workDir);
+		}
+
+		auto sevenZipFiles = find_files(workDir, L"*.7z");
+		if (sevenZipFiles.size() != 1)
+			return ReturnCode::UnexpectedAmountOf7zFiles;
+
+		{
+			StageTimer timer(timings, L"extract_7z");
+			bit7z::BitExtractor extractor(blib, bit7z::BitFormat::SevenZip);
+			extractor.extract(sevenZipFiles.front(), workDir);
+		}
+
+		auto mspFiles = find_files(workDir, L"*.msp");
+		if (mspFiles.size() != 1)
+			return ReturnCode::UnexpectedAmountOfMspFiles;
+
+		extract_msp(mspFiles.front(), workDir, timings);
+		return ReturnCode::Success;
+	}
+
+	// Payload cabinets inside an MSP are extracted by SetupIterateCabinet later on, and the MSI and
+	// the transforms are opened through the MSI API, so none of them is expanded
+	bool expand_setup_artifact(const ArtifactGraph& graph, size_t index)
+	{
+		auto& artifact = graph.Artifacts[index];
+		if (artifact.Format == ArtifactFormat::CompoundFile)
+			return !artifact.IsTransform && PathMatchSpec(artifact.Name.c_str(), L"*.msp");
+		if (artifact.Format == ArtifactFormat::Cabinet)
+			return artifact.Parent == NoParent || graph.Artifacts[artifact.Parent].Format != ArtifactFormat::CompoundFile;
+		return true;
+	}
+
+	bool include_setup_member(const ArtifactGraph& graph, size_t index, const std::wstring& name)
+	{
+		switch (graph.Artifacts[index].Format)
+		{
+		case ArtifactFormat::Cabinet: return is_setup_payload(name);
+		case ArtifactFormat::SevenZip: return PathMatchSpec(name.c_str(), L"*.msp") == TRUE;
+		default: return true;
+		}
+	}
+
+	// The expand time of each container is reported under the stage the reference pipeline uses for it
+	void add_resolve_timings(const ArtifactGraph& graph, StageTimings& timings)
+	{
+		for (auto& artifact : graph.Artifacts)
+		{
+			if (!artifact.Expanded)
+				continue;
+
+			switch (artifact.Format)
+			{
+			case ArtifactFormat::Executable: add_stage_timing(timings, L"locate_payloads", artifact.ExpandTime); break;
+			case ArtifactFormat::Cabinet: add_stage_timing(timings, L"extract_setup_exe", artifact.ExpandTime); break;
+			case ArtifactFormat::SevenZip: add_stage_timing(timings, L"extract_7z", artifact.ExpandTime); break;
+			case ArtifactFormat::CompoundFile: add_stage_timing(timings, L"extract_msp", artifact.ExpandTime); break;
+			default: break;
+			}
+		}
+
+		// The summed segment time against the time of extract_7z gives the parallel LZMA2 speedup
+		if (graph.Lzma2.Segments)
+			add_stage_timing(timings, L"lzma2_segments", graph.Lzma2.SegmentTime, static_cast<unsigned int>(graph.Lzma2.Segments));
+	}
+
+	// Writes the MSI and the transforms to the work dir, named the way the reference pipeline names them,
+	// and returns the payload cabinet of the MSP, which is decoded from memory. Nothing is written if any
+	// of them is missing, e.g. because a container could not be decoded natively. Without stageTables
+	// (the tables are cached) only the cabinet is looked for.
+	const Artifact* stage_setup_artifacts(const ArtifactGraph& graph, const std::wstring& workDir, bool stageTables)
+	{
+		std::vector<std::pair<std::wstring, const Artifact*>> staged;
+		const Artifact* cabinet = nullptr;
+		size_t numMsi = 0, numMst = 0, numCab = 0;
+		for (auto& artifact : graph.Artifacts)
+		{
+			if (artifact.Parent == NoParent)
+				continue;
+
+			auto& parent = graph.Artifacts[artifact.Parent];
+			if (artifact.IsTransform)
+			{
+				staged.push_back({ artifact.Name + L".mst", &artifact });
+				numMst++;
+			}
+			else if (artifact.Format == ArtifactFormat::CompoundFile && PathMatchSpec(artifact.Name.c_str(), L"*.msi"))
+			{
+				staged.push_back({ PathFindFileName(artifact.Name.c_str()), &artifact });
+				numMsi++;
+			}
+			else if (artifact.Format == ArtifactFormat::Cabinet && parent.Format == ArtifactFormat::CompoundFile)
+			{
+				cabinet = &artifact;
+				numCab++;
+			}
+		}
+
+		if (numCab != 1)
+			return nullptr;
+		if (!stageTables)
+			return cabinet;
+		if (!numMsi || !numMst)
+			return nullptr;
+
+		for (auto& file : staged)
+		{
+			if (!write_file(concat_path(workDir, file.first), file.second->Data, file.second->Size))
+				return nullptr;
+		}
+		return cabinet;
+	}
+
+	// The setup EXE and everything resolved from it; the payload cabinet points into either of them
+	struct NativeSetup
+	{
+		MappedFile SetupExe;
+		ArtifactGraph Graph;
+		const Artifact* Cabinet = nullptr;
+	};
+
+	// Resolves the setup EXE from memory, without touching the disk until the MSI stages need files. When
+	// the tables are cached the MSI is not even decoded.
+	bool extract_setup_native(const std::wstring& setupExeName, const std::wstring& workDir, bool stageTables, NativeSetup& setup, StageTimings& timings)
+	{
+		if (!setup.SetupExe.open(setupExeName))
+			return false;
+
+		auto include = [stageTables](const ArtifactGraph& graph, size_t index, const std::wstring& name)
+		{
+			return include_setup_member(graph, index, name) && (stageTables || !PathMatchSpec(name.c_str(), L"*.msi"));
+		};
+		ResolvePolicy policy = { expand_setup_artifact, include, 8 };
+		{
+			StageTimer timer(timings, L"resolve");
+			resolve_artifacts(setupExeName, setup.SetupExe.get_data(), setup.SetupExe.get_size(), policy, setup.Graph);
+		}
+		add_resolve_timings(setup.Graph, timings);
+		setup.Cabinet = stage_setup_artifacts(setup.Graph, workDir, stageTables);
+		return setup.Cabinet != nullptr;
+	}
+
+	// The state of the pipeline once the tables are loaded. The payload cabinet is either part of the
+	// resolved setup, or staged in the work dir by the reference backends and mapped from there.
+	struct SetupState
+	{
+		NativeSetup Native;
+		std::wstring CabName;
+		MappedFile CabFile;
+		const uint8_t* CabData = nullptr;
+		size_t CabSize = 0;
+		BlockVerifier CabVerifier; // Of CabPrefetch, which it must outlive
+		std::unique_ptr<CabinetPrefetch> CabPrefetch;
+		bool MetadataChecked = false;
+		std::optional<Sha256Digest> SetupHash; // Set when the metadata cache is used
+		std::optional<SetupMetadata> Metadata; // Loaded from ExtractOptions::metadataCacheDir
+	};
+
+	// Looks up the metadata of the setup EXE in the cache, once
+	void load_cached_metadata(const std::wstring& setupExeName, const ExtractOptions& extractOptions, SetupState& state, StageTimings& timings)
+	{
+		if (state.MetadataChecked || extractOptions.metadataCacheDir.empty())
+			return;
+
+		state.MetadataChecked = true;
+		StageTimer timer(timings, L"load_metadata");
+		MappedFile& setupExe = state.Native.SetupExe;
+		if (!setupExe.open(setupExeName))
+			return;
+
+		Sha256Digest setupHash = hash_setup(setupExe.get_data(), setupExe.get_size());
+		SetupMetadata metadata;
+		if (load_setup_metadata(get_metadata_cache_path(extractOptions.metadataCacheDir, setupHash), setupHash, metadata))
+			state.Metadata = std::move(metadata);
+		state.SetupHash = setupHash;
+	}
+
+	// Caches the tables just loaded, with the listing of the payload cabinet resolved against them
+	void save_cached_metadata(const ExtractOptions& extractOptions, const SetupState& state, const DbInfo& dbInfo, StageTimings& timings)
+	{
+		StageTimer timer(timings, L"save_metadata");
+		SetupMetadata metadata = { *state.SetupHash, dbInfo, {}, {} };
+		CabinetListing listing;
+		if (!state.CabData || !list_cab_from_memory(state.CabData, state.CabSize, listing))
+			return;
+
+		PathResolver paths(dbInfo);
+		metadata.Files = std::move(listing.Files);
+		for (auto& entry : metadata.Files)
+		{
+			std::wstring path;
+			paths.resolve(entry.Name, path);
+			metadata.Paths.push_back(path);
+		}
+		save_setup_metadata(get_metadata_cache_path(extractOptions.metadataCacheDir, metadata.SetupHash), metadata);
+	}
+
+	// Runs the stages up to and including loading the tables, as a coroutine on the event loop. The
+	// blocking stages (the decoders and the MSI API) run on the thread pool and cancellation is checked
+	// whenever a stage completes. With prefetchCabinet the payload cabinet is decoded while the
+	// transform is applied and the tables are loaded, unless files are filtered out, which needs the
+	// tables to skip them without decoding. When the metadata of the setup EXE is cached, the tables
+	// are taken from there and the MSI stages do not run at all.
+	Task<ReturnCode> prepare_setup_async(EventLoop& loop, const CancellationToken& cancellation, const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, bool prefetchCabinet, SetupState& state, DbInfo& dbInfo, StageTimings& timings)
+	{
+		co_await run_blocking(loop, [&]() { load_cached_metadata(setupExeName, extractOptions, state, timings); return true; });
+		const bool stageTables = !state.Metadata;
+
+		bool staged = !extractOptions.referenceBackends
+			&& co_await run_blocking(loop, [&]() { return extract_setup_native(setupExeName, workDir, stageTables, state.Native, timings); });
+		if (cancellation.is_cancelled())
+			co_return ReturnCode::Cancelled;
+
+		if (!staged)
+		{
+			ReturnCode result = co_await run_blocking(loop, [&]() { return extract_setup_reference(setupExeName, workDir, timings); });
+			if (cancellation.is_cancelled())
+				co_return ReturnCode::Cancelled;
+			if (result != ReturnCode::Success)
+				co_return result;
+		}
+
+		auto msiFiles = find_files(workDir, L"*.msi");
+		if (stageTables && msiFiles.size() != 1)
+			co_return ReturnCode::UnexpectedAmountOfMsiFiles;
+
+		if (staged)
+		{
+			state.CabData = state.Native.Cabinet->Data;
+			state.CabSize = state.Native.Cabinet->Size;
+		}
+		else
+		{
+			auto cabFiles = find_files(workDir, L"*.cab");
+			if (cabFiles.size() != 1)
+				co_return ReturnCode::UnexpectedAmountOfCabFiles;
+
+			state.CabName = cabFiles.front();
+			if (state.CabFile.open(state.CabName))
+			{
+				state.CabData = state.CabFile.get_data();
+				state.CabSize = state.CabFile.get_size();
+			}
+		}
+
+		if (prefetchCabinet)
+			state.CabPrefetch = std::make_unique<CabinetPrefetch>(get_memory_decoder(state.CabData, state.CabSize, extractOptions.verifyChecksums ? &state.CabVerifier : nullptr), MaxPrefetchBytes, is_selective(extractOptions));
+
+		if (!stageTables)
+		{
+			dbInfo = state.Metadata->Info;
+			co_return ReturnCode::Success;
+		}
+
+		auto mstFiles = find_files(workDir, L"oldToCurrent.mst");
+		if (mstFiles.size() != 1)
+			co_return ReturnCode::UnexpectedAmountOfMstFiles;
+
+		co_await run_blocking(loop, [&]() { get_files_from_mst(msiFiles.front(), mstFiles.front(), dbInfo, timings); return true; });
+		if (cancellation.is_cancelled())
+			co_return ReturnCode::Cancelled;
+		if (dbInfo.Files.empty() || dbInfo.Directories.empty())
+			co_return ReturnCode::UnexpectedAmountOfPayloadFiles;
+
+		if (state.SetupHash)
+			co_await run_blocking(loop, [&]() { save_cached_metadata(extractOptions, state, dbInfo, timings); return true; });
+		co_return ReturnCode::Success;
+	}
+
+	// The sink is only called from the loop, i.e. the thread of extract_setup
+	Task<ReturnCode> extract_setup_async(EventLoop& loop, const CancellationToken& cancellation, const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, FileSink& sink, DbInfo& dbInfo, StageTimings& timings)
+	{
+		// The index only pays off when not every file is extracted
+		const bool indexed = !extractOptions.referenceBackends && !extractOptions.indexPath.empty() && is_selective(extractOptions);
+
+		SetupState state;
+		ReturnCode result = co_await prepare_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, !extractOptions.referenceBackends && !indexed, state, dbInfo, timings);
+		if (result != ReturnCode::Success)
+			co_return result;
+
+		PathResolver paths(dbInfo);
+		ResolvedPaths resolvedPaths(paths, extractOptions);
+		if (state.CabPrefetch)
+			state.CabPrefetch->set_filter(resolvedPaths.get_filter());
+
+		bool extracted = indexed
+			? co_await extract_cab_indexed_async(loop, cancellation, state.CabData, state.CabSize, resolvedPaths, extractOptions, sink, timings)
+			: state.CabPrefetch
+			? co_await deliver_cab_files_async(loop, cancellation, *state.CabPrefetch, resolvedPaths, sink, timings)
+			: extract_cab(state.CabName, workDir, paths, extractOptions, sink, cancellation, timings);
+		if (state.CabPrefetch && extractOptions.verifyChecksums)
+			add_stage_timing(timings, L"verify_cab", state.CabVerifier.get_time());
+		if (cancellation.is_cancelled())
+			co_return ReturnCode::Cancelled;
+		if (!extracted)
+			co_return ReturnCode::ErrorExtractingCab;
+
+		co_return ReturnCode::Success;
+	}
+
+	ListedFile make_listed_file(const CabinetEntry& entry, const std::wstring& path)
+	{
+		auto file = make_sink_file(path, entry.Name, entry.Size, entry.Date, entry.Time, entry.Attributes);
+		return { file.Path, entry.Name, file.Size, entry.Folder, entry.FolderOffset, file.LastWriteTime, file.Attributes };
+	}
+
+	// The files of the payload cabinet as the extraction would lay them out, from its header only
+	bool list_cab_files(const SetupState& state, const DbInfo& dbInfo, const ExtractOptions& extractOptions, std::vector<ListedFile>& files_out)
+	{
+		CabinetListing listing;
+		if (!state.CabData || !list_cab_from_memory(state.CabData, state.CabSize, listing))
+			return false;
+
+		PathResolver paths(dbInfo);
+		for (auto& entry : listing.Files)
+		{
+			std::wstring path;
+			if (get_relative_path(entry.Name, paths, extractOptions, path))
+				files_out.push_back(make_listed_file(entry, path));
+		}
+		return true;
+	}
+
+	// The same from the cached listing, whose paths are already resolved
+	void list_cached_files(const SetupMetadata& metadata, const ExtractOptions& extractOptions, std::vector<ListedFile>& files_out)
+	{
+		for (size_t i = 0; i < metadata.Files.size(); i++)
+		{
+			std::wstring path;
+			if (!metadata.Paths[i].empty() && select_relative_path(metadata.Paths[i], extractOptions, path))
+				files_out.push_back(make_listed_file(metadata.Files[i], path));
+		}
+	}
+
+	Task<ReturnCode> list_setup_async(EventLoop& loop, const CancellationToken& cancellation, const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, DbInfo& dbInfo, std::vector<ListedFile>& files_out, StageTimings& timings)
+	{
+		// With cached metadata nothing of the setup EXE is decoded at all
+		SetupState state;
+		co_await run_blocking(loop, [&]() { load_cached_metadata(setupExeName, extractOptions, state, timings); return true; });
+		if (state.Metadata)
+		{
+			StageTimer timer(timings, L"list_cab");
+			dbInfo = state.Metadata->Info;
+			list_cached_files(*state.Metadata, extractOptions, files_out);
+			co_return ReturnCode::Success;
+		}
+
+		ReturnCode result = co_await prepare_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, false, state, dbInfo, timings);
+		if (result != ReturnCode::Success)
+			co_return result;
+
+		StageTimer timer(timings, L"list_cab");
+		co_return list_cab_files(state, dbInfo, extractOptions, files_out) ? ReturnCode::Success : ReturnCode::ErrorExtractingCab;
+	}
+
+	// The verifier checks the blocks the index is built from, and later those the reader decodes
+	Task<ReturnCode> open_payload_async(EventLoop& loop, const CancellationToken& cancellation, const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, size_t cacheBytes, SetupState& state, std::vector<ListedFile>& files, BlockVerifier& verifier, CabinetReader& reader, DbInfo& dbInfo, StageTimings& timings)
+	{
+		ReturnCode result = co_await prepare_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, false, state, dbInfo, timings);
+		if (result != ReturnCode::Success)
+			co_return result;
+
+		{
+			StageTimer timer(timings, L"list_cab");
+			if (!list_cab_files(state, dbInfo, extractOptions, files))
+				co_return ReturnCode::ErrorExtractingCab;
+		}
+
+		BlockVerifier* checks = extractOptions.verifyChecksums ? &verifier : nullptr;
+		CabinetIndex index;
+		bool opened = co_await run_blocking(loop, [&]() {
+			return get_cabinet_index(state.CabData, state.CabSize, extractOptions.indexPath, checks, index, timings)
+				&& reader.open(state.CabData, state.CabSize, std::move(index), cacheBytes, checks);
+		});
+		if (checks)
+			add_stage_timing(timings, L"verify_cab", verifier.get_time());
+		if (cancellation.is_cancelled())
+			co_return ReturnCode::Cancelled;
+		co_return opened ? ReturnCode::Success : ReturnCode::ErrorExtractingCab;
+	}
+
+	// The containers from the setup EXE down to the payload cabinet, which is the last of them
+	void plan_stages(const NativeSetup& setup, std::vector<PlanStage>& stages_out)
+	{
+		auto& artifacts = setup.Graph.Artifacts;
+		for (size_t i = setup.Cabinet - artifacts.data(); i != NoParent; i = artifacts[i].Parent)
+		{
+			auto& artifact = artifacts[i];
+			PlanStage stage = { artifact.Name, get_format_name(artifact.Format), artifact.Size, false, 0 };
+			if (artifact.Parent != NoParent)
+			{
+				auto& parent = artifacts[artifact.Parent];
+				stage.InParent = artifact.Data >= parent.Data && artifact.Data + artifact.Size <= parent.Data + parent.Size;
+				if (stage.InParent)
+					stage.Offset = artifact.Data - parent.Data;
+			}
+			stages_out.push_back(stage);
+		}
+		std::reverse(stages_out.begin(), stages_out.end());
+	}
+
+	// The folders of the payload cabinet with their uncompressed size, segmented at the checkpoints of the index
+	bool plan_folders(const uint8_t* cabData, size_t cabSize, const CabinetListing& listing, const CabinetIndex* index, std::vector<PlanFolder>& folders_out)
+	{
+		for (size_t i = 0; i < listing.Folders.size(); i++)
+		{
+			auto& folder = listing.Folders[i];
+			PlanFolder planFolder = { folder.CompressionType, folder.DataOffset, folder.DataBlocks, 0, {} };
+			size_t dataOffset = folder.DataOffset;
+			for (uint16_t block = 0; block < folder.DataBlocks; block++)
+			{
+				CabinetDataBlock dataBlock;
+				if (!read_cab_data_block(cabData, cabSize, listing.DataReserve, dataOffset, dataBlock))
+					return false;
+				planFolder.Size += dataBlock.UncompressedSize;
+			}
+
+			if (index && i < index->Folders.size())
+			{
+				for (auto& checkpoint : index->Folders[i])
+					planFolder.Segments.push_back({ checkpoint.Offset, checkpoint.Block, checkpoint.DataOffset });
+			}
+			folders_out.push_back(std::move(planFolder));
+		}
+		return true;
+	}
+
+	Task<ReturnCode> plan_setup_async(EventLoop& loop, const CancellationToken& cancellation, const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, ExtractionPlan& plan, DbInfo& dbInfo, StageTimings& timings)
+	{
+		// Only the native backends resolve the containers from memory, where their ranges are known
+		if (extractOptions.referenceBackends)
+			co_return ReturnCode::InvalidArguments;
+
+		SetupState state;
+		ReturnCode result = co_await prepare_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, false, state, dbInfo, timings);
+		if (result != ReturnCode::Success)
+			co_return result;
+		if (!state.Native.Cabinet)
+			co_return ReturnCode::ErrorExtractingCab;
+
+		std::vector<ListedFile> files;
+		{
+			StageTimer timer(timings, L"list_cab");
+			if (!list_cab_files(state, dbInfo, extractOptions, files))
+				co_return ReturnCode::ErrorExtractingCab;
+		}
+
+		BlockVerifier verifier;
+		CabinetIndex index;
+		bool indexed = co_await run_blocking(loop, [&]() {
+			return get_cabinet_index(state.CabData, state.CabSize, extractOptions.indexPath, extractOptions.verifyChecksums ? &verifier : nullptr, index, timings);
+		});
+		if (extractOptions.verifyChecksums)
+			add_stage_timing(timings, L"verify_cab", verifier.get_time());
+		if (cancellation.is_cancelled())
+			co_return ReturnCode::Cancelled;
+
+		StageTimer timer(timings, L"plan");
+		MappedFile& setupExe = state.Native.SetupExe;
+		CabinetListing listing;
+		plan = { setupExeName, setupExe.get_size(), state.SetupHash ? *state.SetupHash : hash_setup(setupExe.get_data(), setupExe.get_size()) };
+		plan_stages(state.Native, plan.Stages);
+		if (!list_cab_from_memory(state.CabData, state.CabSize, listing) || !plan_folders(state.CabData, state.CabSize, listing, indexed ? &index : nullptr, plan.Folders))
+			co_return ReturnCode::ErrorExtractingCab;
+
+		plan.CabinetSize = state.CabSize;
+		plan.DataReserve = static_cast<uint32_t>(listing.DataReserve);
+		if (indexed && !extractOptions.indexPath.empty())
+			plan.IndexPath = extractOptions.indexPath;
+		for (auto& file : files)
+			plan.Files.push_back({ file.Path, file.Folder, file.FolderOffset, static_cast<uint32_t>(file.Size), file.LastWriteTime, file.Attributes });
+		co_return ReturnCode::Success;
+	}
+
+	// Opens exactly the members of the stages of the plan, each container only at its own depth
+	ResolvePolicy get_plan_policy(const ExtractionPlan& plan)
+	{
+		auto expand = [&plan](const ArtifactGraph& graph, size_t index)
+		{
+			auto& artifact = graph.Artifacts[index];
+			return artifact.Depth + 1 < plan.Stages.size() && artifact.Name == plan.Stages[artifact.Depth].Name
+				&& plan.Stages[artifact.Depth].Format == get_format_name(artifact.Format);
+		};
+		auto include = [&plan](const ArtifactGraph& graph, size_t index, const std::wstring& name)
+		{
+			auto depth = graph.Artifacts[index].Depth;
+			return depth + 1 < plan.Stages.size() && name == plan.Stages[depth + 1].Name;
+		};
+		return { expand, include, static_cast<unsigned int>(plan.Stages.size()) };
+	}
+
+	const Artifact* find_plan_cabinet(const ExtractionPlan& plan, const ArtifactGraph& graph)
+	{
+		for (auto& artifact : graph.Artifacts)
+		{
+			if (artifact.Depth + 1 == plan.Stages.size() && artifact.Format == ArtifactFormat::Cabinet && artifact.Name == plan.Stages.back().Name)
+				return &artifact;
+		}
+		return nullptr;
+	}
+}
+
+ReturnCode extract_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, FileSink& sink, const CancellationToken& cancellation, DbInfo& dbInfo_out, StageTimings& timings)
+{
+	EventLoop loop;
+	return extract_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, sink, dbInfo_out, timings).run(loop);
+}
+
+ReturnCode list_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, const CancellationToken& cancellation, DbInfo& dbInfo_out, std::vector<ListedFile>& files_out, StageTimings& timings)
+{
+	EventLoop loop;
+	return list_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, dbInfo_out, files_out, timings).run(loop);
+}
+
+struct SetupPayload::State
+{
+	SetupState Setup;
+	std::vector<ListedFile> Files;
+	BlockVerifier Verifier;
+	CabinetReader Reader;
+};
+
+SetupPayload::SetupPayload() = default;
+
+SetupPayload::~SetupPayload() = default;
+
+ReturnCode SetupPayload::open(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, size_t cacheBytes, const CancellationToken& cancellation, DbInfo& dbInfo_out, StageTimings& timings)
+{
+	state = std::make_unique<State>();
+	EventLoop loop;
+	ReturnCode result = open_payload_async(loop, cancellation, setupExeName, workDir, extractOptions, cacheBytes, state->Setup, state->Files, state->Verifier, state->Reader, dbInfo_out, timings).run(loop);
+	if (result != ReturnCode::Success)
+		state.reset();
+	return result;
+}
+
+const std::vector<ListedFile>& SetupPayload::get_files() const
+{
+	return state->Files;
+}
+
+bool SetupPayload::read_file(const ListedFile& file, uint64_t offset, uint8_t* out, size_t size)
+{
+	return offset + size <= file.Size && state->Reader.read(file.Folder, file.FolderOffset + offset, out, size);
+}
+
+void SetupPayload::close()
+{
+	state.reset();
+}
+
+ReturnCode plan_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, const CancellationToken& cancellation, ExtractionPlan& plan_out, DbInfo& dbInfo_out, StageTimings& timings)
+{
+	EventLoop loop;
+	return plan_setup_async(loop, cancellation, setupExeName, workDir, extractOptions, plan_out, dbInfo_out, timings).run(loop);
+}
+
+ReturnCode apply_plan(const ExtractionPlan& plan, bool verifyChecksums, const CancellationToken& cancellation, const PlanWriter& write, StageTimings& timings)
+{
+	if (plan.Stages.empty())
+		return ReturnCode::InvalidArguments;
+
+	MappedFile setupExe;
+	{
+		StageTimer timer(timings, L"verify_setup");
+		if (!setupExe.open(plan.SetupExeName) || setupExe.get_size() != plan.SetupSize || hash_setup(setupExe.get_data(), setupExe.get_size()) != plan.SetupHash)
+			return ReturnCode::PlanMismatch;
+	}
+
+	ArtifactGraph graph;
+	{
+		StageTimer timer(timings, L"resolve");
+		resolve_artifacts(plan.Stages.front().Name, setupExe.get_data(), setupExe.get_size(), get_plan_policy(plan), graph);
+	}
+	add_resolve_timings(graph, timings);
+	if (cancellation.is_cancelled())
+		return ReturnCode::Cancelled;
+
+	const Artifact* cabinet = find_plan_cabinet(plan, graph);
+	if (!cabinet)
+		return ReturnCode::ErrorExtractingCab;
+	if (cabinet->Size != plan.CabinetSize)
+		return ReturnCode::PlanMismatch;
+
+	// Without the index every folder is decoded as a single segment
+	CabinetIndex index;
+	bool indexed;
+	{
+		StageTimer timer(timings, L"index_cab");
+		indexed = !plan.IndexPath.empty() && load_cabinet_index(plan.IndexPath, cabinet->Data, cabinet->Size, index);
+	}
+
+	BlockVerifier verifier;
+	bool decoded;
+	{
+		StageTimer timer(timings, L"apply_cab");
+		decoded = decode_plan_files(plan, cabinet->Data, cabinet->Size, indexed ? &index : nullptr, verifyChecksums ? &verifier : nullptr, cancellation, write);
+	}
+	if (verifyChecksums)
+		add_stage_timing(timings, L"verify_cab", verifier.get_time());
+	if (!decoded)
+		return cancellation.is_cancelled() ? ReturnCode::Cancelled : ReturnCode::ErrorExtractingCab;
+	return ReturnCode::Success;
+}
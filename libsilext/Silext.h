@@ -0,0 +1,162 @@
+#pragma once
+
+/* libsilext - The Silverlight installer extractor as a library
+*
+* extract_setup runs the whole pipeline and passes every payload file to a FileSink, so that a
+* consumer can take the files in process. The Silext CLI is a sink that writes them to disk.
+*
+* Consumers also link bit7z (dep/bit7z of the CLI), which the reference backends use.
+*/
+
+#include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "Async.h"
+#include "Md5.h"
+#include "PathFilter.h"
+#include "Plan.h"
+#include "Timing.h"
+
+struct DirInfo
+{
+	std::wstring ParentKey;
+	std::wstring Name;
+};
+
+struct FileInfo
+{
+	std::wstring FileName;
+	std::wstring DirectoryKey;
+	std::optional<Md5Digest> Md5; // From the MsiFileHash table, which holds it for unversioned files only
+};
+
+struct DbInfo
+{
+	std::map<std::wstring, DirInfo> Directories;
+	std::map<std::wstring, FileInfo> Files;
+};
+
+struct ExtractOptions
+{
+	const bool sixtyFourBitOnly;
+	const bool referenceBackends;
+	const PathFilter pathFilter; // Applied to the relative paths, after sixtyFourBitOnly
+	const std::wstring indexPath; // Random-access index of the payload cabinet, built on first use; empty for none
+	const std::wstring metadataCacheDir; // Where the metadata of setup EXEs is cached by their hash; empty for none
+	const bool verifyChecksums; // Of the CFDATA blocks the native decoders decode, reported as verify_cab
+};
+
+enum class ReturnCode
+{
+	Success = 0,
+	SuccessNoCleanup = 1,
+
+	CannotInitializeWorkDir = -1,
+	InvalidArguments = -2,
+	UnexpectedAmountOfMsiFiles = -3,
+	UnexpectedAmountOf7zFiles = -4,
+	UnexpectedAmountOfMspFiles = -5,
+	UnexpectedAmountOfMstFiles = -6,
+	UnexpectedAmountOfPayloadFiles = -7,
+	UnexpectedAmountOfCabFiles = -8,
+	ErrorExtractingCab = -9,
+	ManifestMismatch = -10,
+	CannotAccessManifest = -11,
+	Cancelled = -12,
+	CannotMount = -13,
+	PlanMismatch = -14,
+	CannotAccessPlan = -15,
+	CannotAccessHashes = -16,
+	HashMismatch = -17
+};
+
+// A payload file as it is passed to a FileSink
+struct SinkFile
+{
+	std::wstring Path; // Relative to the root of the extracted tree
+	std::wstring NameInCabinet; // The key of the file in the File table
+	uint64_t Size;
+	FILETIME LastWriteTime; // Zero if the cabinet holds no valid time stamp
+	DWORD Attributes; // The read-only, hidden, system and archive attributes stored in the cabinet
+};
+
+const size_t MaxSinkChunk = 1024 * 1024;
+
+// Receives the payload. Every file is passed as begin_file, its data in chunks of at most
+// MaxSinkChunk bytes and end_file. Files are passed one at a time, in cabinet order, on the
+// thread that called extract_setup. Returning false stops the extraction with ErrorExtractingCab.
+class FileSink
+{
+public:
+	virtual ~FileSink() = default;
+
+	virtual bool begin_file(const SinkFile& file) = 0;
+	virtual bool write_chunk(const uint8_t* data, size_t size) = 0;
+	virtual bool end_file() = 0;
+};
+
+// Extracts the payload of the installer setupExeName into sink, and returns the File and Directory
+// tables it was laid out by in dbInfo_out. workDir is an existing directory for the MSI and its
+// transform, which the MSI API can only open from disk; with the native backends the payload
+// itself is not written anywhere. Cancelling stops the extraction at the next stage.
+ReturnCode extract_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, FileSink& sink, const CancellationToken& cancellation, DbInfo& dbInfo_out, StageTimings& timings);
+
+// A payload file as listed from the cabinet header
+struct ListedFile
+{
+	std::wstring Path; // Relative to the root of the extracted tree
+	std::wstring NameInCabinet;
+	uint64_t Size;
+	uint16_t Folder;
+	uint32_t FolderOffset; // In the uncompressed data of the folder
+	FILETIME LastWriteTime;
+	DWORD Attributes;
+};
+
+// Runs only the metadata stages: the files the extraction would produce are listed from the entries
+// in the header of the payload cabinet, without decompressing any of its data.
+ReturnCode list_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, const CancellationToken& cancellation, DbInfo& dbInfo_out, std::vector<ListedFile>& files_out, StageTimings& timings);
+
+// The payload of an installer opened for random access, e.g. to serve it as a file system. Opening
+// runs the metadata stages and loads the random-access index from ExtractOptions::indexPath, or
+// builds it (kept in memory only if indexPath is empty). The data of a file is then decoded on
+// demand, through an LRU cache of decoded cabinet blocks of cacheBytes shared by all files.
+class SetupPayload
+{
+public:
+	SetupPayload();
+	SetupPayload(const SetupPayload&) = delete;
+	SetupPayload& operator=(const SetupPayload&) = delete;
+	~SetupPayload();
+
+	ReturnCode open(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, size_t cacheBytes, const CancellationToken& cancellation, DbInfo& dbInfo_out, StageTimings& timings);
+
+	const std::vector<ListedFile>& get_files() const;
+
+	// Reads size bytes at offset in file, one of get_files; callable from any thread
+	bool read_file(const ListedFile& file, uint64_t offset, uint8_t* out, size_t size);
+
+	// Releases the setup EXE, or the cabinet staged in the work dir by the reference backends
+	void close();
+
+private:
+	struct State;
+	std::unique_ptr<State> state;
+};
+
+// Runs the metadata stages like list_setup, and records everything the extraction found out in plan_out:
+// the containers from the setup EXE to the payload cabinet, the codec and segments of every folder of
+// the cabinet, and where every listed file is in them. The segments are the checkpoints of the
+// random-access index at ExtractOptions::indexPath, which is built if it is missing. Requires the
+// native backends.
+ReturnCode plan_setup(const std::wstring& setupExeName, const std::wstring& workDir, const ExtractOptions& extractOptions, const CancellationToken& cancellation, ExtractionPlan& plan_out, DbInfo& dbInfo_out, StageTimings& timings);
+
+// Executes a plan: decodes only the containers it records on the way to the payload cabinet, none of
+// the MSI stages run, and then the segments of the cabinet with planned files all at the same time.
+// Returns PlanMismatch if the setup EXE or the cabinet is not the one the plan was made for.
+ReturnCode apply_plan(const ExtractionPlan& plan, bool verifyChecksums, const CancellationToken& cancellation, const PlanWriter& write, StageTimings& timings);
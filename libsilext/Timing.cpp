@@ -0,0 +1,20 @@
+#include "Timing.h"
+
+#include <algorithm>
+
+void add_stage_timing(StageTimings& timings, const std::wstring& name, std::chrono::steady_clock::duration elapsed, unsigned int count)
+{
+	auto timingIt = std::find_if(timings.begin(), timings.end(), [&name](const StageTiming& timing)
+	{
+		return timing.Name == name;
+	});
+	if (timingIt == timings.end())
+	{
+		timings.push_back({ name, elapsed, count });
+	}
+	else
+	{
+		timingIt->Elapsed += elapsed;
+		timingIt->Count += count;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct StageTiming
+{
+	std::wstring Name;
+	std::chrono::steady_clock::duration Elapsed;
+	unsigned int Count;
+};
+
+using StageTimings = std::vector<StageTiming>;
+
+void add_stage_timing(StageTimings& timings, const std::wstring& name, std::chrono::steady_clock::duration elapsed, unsigned int count = 1);
+
+// Measures the lifetime of the timer as a named pipeline stage. Stages that are
+// entered repeatedly (e.g. once per file) are accumulated into a single entry.
+struct StageTimer
+{
+	StageTimer(StageTimings& timings, const std::wstring& name)
+		: timings(timings), name(name), start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~StageTimer()
+	{
+		add_stage_timing(timings, name, std::chrono::steady_clock::now() - start);
+	}
+
+	StageTimings& timings;
+	const std::wstring name;
+	const std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,233 @@
+#include "Transcode.h"
+
+#include <windows.h>
+#include <cstdint>
+#include <immintrin.h>
+#include "Cpu.h"
+
+static_assert(sizeof(wchar_t) == sizeof(uint16_t), "wchar_t holds UTF-16 code units");
+
+namespace
+{
+	const uint16_t ReplacementCharacter = 0xFFFD;
+
+	// Each converts the ASCII prefix of in a block at a time, stopping at the first block with other
+	// characters, and returns how many characters it converted
+	size_t narrow_ascii_avx2(const uint16_t* in, size_t length, uint8_t* out)
+	{
+		const __m256i nonAscii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+		size_t i = 0;
+		for (; length - i >= 16; i += 16)
+		{
+			__m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			if (!_mm256_testz_si256(chars, nonAscii))
+				break;
+			// Packing works within each 128-bit lane, the permute joins the lower halves of both
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(chars, chars), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(packed));
+		}
+		return i;
+	}
+
+	size_t narrow_ascii_sse2(const uint16_t* in, size_t length, uint8_t* out)
+	{
+		const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; length - i >= 8; i += 8)
+		{
+			__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chars, nonAscii), zero)) != 0xFFFF)
+				break;
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(chars, chars));
+		}
+		return i;
+	}
+
+	size_t widen_ascii_avx2(const uint8_t* in, size_t length, uint16_t* out)
+	{
+		size_t i = 0;
+		for (; length - i >= 32; i += 32)
+		{
+			__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			if (_mm256_movemask_epi8(bytes))
+				break;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+		}
+		return i;
+	}
+
+	size_t widen_ascii_sse2(const uint8_t* in, size_t length, uint16_t* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; length - i >= 16; i += 16)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			if (_mm_movemask_epi8(bytes))
+				break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(bytes, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(bytes, zero));
+		}
+		return i;
+	}
+
+	// The whole ASCII prefix, the blocks first and then the characters before the first other one
+	size_t narrow_ascii(const uint16_t* in, size_t length, uint8_t* out)
+	{
+		size_t i = get_cpu_features().Avx2 ? narrow_ascii_avx2(in, length, out) : 0;
+		i += narrow_ascii_sse2(in + i, length - i, out + i);
+		for (; i < length && in[i] < 0x80; i++)
+			out[i] = static_cast<uint8_t>(in[i]);
+		return i;
+	}
+
+	size_t widen_ascii(const uint8_t* in, size_t length, uint16_t* out)
+	{
+		size_t i = get_cpu_features().Avx2 ? widen_ascii_avx2(in, length, out) : 0;
+		i += widen_ascii_sse2(in + i, length - i, out + i);
+		for (; i < length && in[i] < 0x80; i++)
+			out[i] = in[i];
+		return i;
+	}
+
+	// Decodes the sequence at in[0], which is not ASCII, and returns how many bytes it takes. An invalid
+	// sequence takes its longest valid prefix, but at least the first byte.
+	size_t decode_utf8_sequence(const uint8_t* in, size_t length, uint32_t& codePoint_out)
+	{
+		uint8_t lead = in[0];
+		uint32_t codePoint;
+		size_t needed;
+		uint8_t low = 0x80, high = 0xBF; // Of the next continuation byte, narrower after some leads
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			needed = 1;
+			codePoint = lead & 0x1F;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			needed = 2;
+			codePoint = lead & 0x0F;
+			if (lead == 0xE0)
+				low = 0xA0; // Overlong
+			else if (lead == 0xED)
+				high = 0x9F; // Surrogates
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			needed = 3;
+			codePoint = lead & 0x07;
+			if (lead == 0xF0)
+				low = 0x90; // Overlong
+			else if (lead == 0xF4)
+				high = 0x8F; // Above U+10FFFF
+		}
+		else
+		{
+			codePoint_out = ReplacementCharacter;
+			return 1;
+		}
+
+		for (size_t i = 1; i <= needed; i++)
+		{
+			if (i >= length || in[i] < low || in[i] > high)
+			{
+				codePoint_out = ReplacementCharacter;
+				return i;
+			}
+			codePoint = (codePoint << 6) | (in[i] & 0x3F);
+			low = 0x80;
+			high = 0xBF;
+		}
+		codePoint_out = codePoint;
+		return needed + 1;
+	}
+}
+
+size_t utf16_to_utf8(const wchar_t* in, size_t length, char* out)
+{
+	auto units = reinterpret_cast<const uint16_t*>(in);
+	auto bytes = reinterpret_cast<uint8_t*>(out);
+	size_t written = 0;
+	for (size_t i = 0; i < length;)
+	{
+		size_t ascii = narrow_ascii(units + i, length - i, bytes + written);
+		i += ascii;
+		written += ascii;
+
+		for (; i < length && units[i] >= 0x80; i++)
+		{
+			uint32_t codePoint = units[i];
+			if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+			{
+				if (codePoint <= 0xDBFF && i + 1 < length && units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF)
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (units[++i] - 0xDC00);
+				else
+					codePoint = ReplacementCharacter;
+			}
+
+			if (codePoint < 0x800)
+			{
+				bytes[written++] = static_cast<uint8_t>(0xC0 | (codePoint >> 6));
+			}
+			else if (codePoint < 0x10000)
+			{
+				bytes[written++] = static_cast<uint8_t>(0xE0 | (codePoint >> 12));
+				bytes[written++] = static_cast<uint8_t>(0x80 | ((codePoint >> 6) & 0x3F));
+			}
+			else
+			{
+				bytes[written++] = static_cast<uint8_t>(0xF0 | (codePoint >> 18));
+				bytes[written++] = static_cast<uint8_t>(0x80 | ((codePoint >> 12) & 0x3F));
+				bytes[written++] = static_cast<uint8_t>(0x80 | ((codePoint >> 6) & 0x3F));
+			}
+			bytes[written++] = static_cast<uint8_t>(0x80 | (codePoint & 0x3F));
+		}
+	}
+	return written;
+}
+
+size_t utf8_to_utf16(const char* in, size_t length, wchar_t* out)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(in);
+	auto units = reinterpret_cast<uint16_t*>(out);
+	size_t written = 0;
+	for (size_t i = 0; i < length;)
+	{
+		size_t ascii = widen_ascii(bytes + i, length - i, units + written);
+		i += ascii;
+		written += ascii;
+
+		while (i < length && bytes[i] >= 0x80)
+		{
+			uint32_t codePoint;
+			i += decode_utf8_sequence(bytes + i, length - i, codePoint);
+			if (codePoint >= 0x10000)
+			{
+				units[written++] = static_cast<uint16_t>(0xD800 + ((codePoint - 0x10000) >> 10));
+				units[written++] = static_cast<uint16_t>(0xDC00 + (codePoint & 0x3FF));
+			}
+			else
+			{
+				units[written++] = static_cast<uint16_t>(codePoint);
+			}
+		}
+	}
+	return written;
+}
+
+size_t decode_code_page(const char* in, size_t length, unsigned int codePage, wchar_t* out)
+{
+	if (codePage == CP_UTF8)
+		return utf8_to_utf16(in, length, out);
+
+	// ASCII is the same in every code page Windows uses for file names, and a byte before a non-ASCII
+	// one cannot be the lead byte of a double-byte character
+	size_t ascii = widen_ascii(reinterpret_cast<const uint8_t*>(in), length, reinterpret_cast<uint16_t*>(out));
+	if (ascii == length)
+		return length;
+
+	int decoded = MultiByteToWideChar(codePage, 0, in + ascii, static_cast<int>(length - ascii), out + ascii, static_cast<int>(length - ascii));
+	return decoded > 0 ? ascii + decoded : 0;
+}
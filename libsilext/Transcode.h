@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+// Conversions between the UTF-16 of the Windows API and the UTF-8 of tar headers, listings and plans.
+// Runs of ASCII, which make up nearly all names in an installer, are converted 32 or 16 characters at
+// a time; everything else one code point at a time. Each writes to out, which holds the largest
+// possible result, and returns the number of code units written.
+
+// Unpaired surrogates become U+FFFD, as with WideCharToMultiByte. out holds 3 * length chars.
+size_t utf16_to_utf8(const wchar_t* in, size_t length, char* out);
+
+// Every maximal invalid subsequence becomes one U+FFFD, as Unicode recommends and MultiByteToWideChar
+// does. out holds length wchar_t.
+size_t utf8_to_utf16(const char* in, size_t length, wchar_t* out);
+
+// Decodes a string in a Windows code page (e.g. a cabinet name in CP_ACP); after an ASCII prefix the
+// rest is left to MultiByteToWideChar unless it is UTF-8. out holds length wchar_t.
+size_t decode_code_page(const char* in, size_t length, unsigned int codePage, wchar_t* out);
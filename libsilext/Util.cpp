@@ -0,0 +1,137 @@
+#include "Util.h"
+
+#include <windows.h>
+#include <shlwapi.h>
+#include <fstream>
+#include "Transcode.h"
+
+#pragma comment(lib, "Shlwapi.lib")
+
+std::vector<std::wstring> split(const std::wstring& s, wchar_t seperator)
+{
+	std::vector<std::wstring> output;
+	std::wstring::size_type prev_pos = 0, pos = 0;
+	while ((pos = s.find(seperator, pos)) != std::wstring::npos)
+	{
+		auto substring(s.substr(prev_pos, pos - prev_pos));
+		output.push_back(substring);
+		prev_pos = ++pos;
+	}
+
+	output.push_back(s.substr(prev_pos, pos - prev_pos));
+	return output;
+}
+
+std::wstring concat_path(const std::wstring& firstPath, const std::wstring& secondPath)
+{
+	wchar_t combinedPath[MAX_PATH];
+	PathCombine(combinedPath, firstPath.c_str(), secondPath.c_str());
+	return combinedPath;
+}
+
+std::vector<std::wstring> find_files(const std::wstring& basePath, const std::wstring& filter)
+{
+	std::vector<std::wstring> files;
+
+	std::wstring fullPath = concat_path(basePath, filter);
+
+	WIN32_FIND_DATA findData = { 0 };
+	HANDLE hFind = FindFirstFile(fullPath.c_str(), &findData);
+	if (INVALID_HANDLE_VALUE != hFind)
+	{
+		do
+		{
+			if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				files.push_back(concat_path(basePath, findData.cFileName));
+		} while (FindNextFile(hFind, &findData) == TRUE);
+
+		FindClose(hFind);
+	}
+	return files;
+}
+
+std::string to_utf8(const std::wstring& s)
+{
+	std::string result(s.size() * 3, '\0');
+	result.resize(utf16_to_utf8(s.data(), s.size(), &result[0]));
+	return result;
+}
+
+std::wstring from_utf8(const std::string& s)
+{
+	std::wstring result(s.size(), L'\0');
+	result.resize(utf8_to_utf16(s.data(), s.size(), &result[0]));
+	return result;
+}
+
+bool write_file(const std::wstring& path, const uint8_t* data, size_t size)
+{
+	std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+	file.write(reinterpret_cast<const char*>(data), size);
+	return file.good();
+}
+
+std::wstring to_hex(const uint8_t* data, size_t size)
+{
+	const wchar_t digits[] = L"0123456789abcdef";
+	std::wstring hex(2 * size, L'0');
+	for (size_t i = 0; i < size; i++)
+	{
+		hex[2 * i] = digits[data[i] >> 4];
+		hex[2 * i + 1] = digits[data[i] & 15];
+	}
+	return hex;
+}
+
+bool from_hex(const std::wstring& s, uint8_t* out, size_t size)
+{
+	if (s.size() != 2 * size)
+		return false;
+
+	auto digit = [](wchar_t c) { return c >= L'0' && c <= L'9' ? c - L'0' : c >= L'a' && c <= L'f' ? c - L'a' + 10 : c >= L'A' && c <= L'F' ? c - L'A' + 10 : -1; };
+	for (size_t i = 0; i < size; i++)
+	{
+		int high = digit(s[2 * i]);
+		int low = digit(s[2 * i + 1]);
+		if (high < 0 || low < 0)
+			return false;
+		out[i] = static_cast<uint8_t>(high << 4 | low);
+	}
+	return true;
+}
+
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash)
+{
+	const uint64_t fnvPrime = 1099511628211ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * fnvPrime;
+	return hash;
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		UnmapViewOfFile(data);
+}
+
+bool MappedFile::open(const std::wstring& path)
+{
+	HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!data && GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0)
+	{
+		HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping)
+		{
+			data = static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+			if (data)
+				size = static_cast<size_t>(fileSize.QuadPart);
+			CloseHandle(hMapping);
+		}
+	}
+	CloseHandle(hFile);
+	return data != nullptr;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+std::vector<std::wstring> split(const std::wstring& s, wchar_t seperator);
+
+std::wstring concat_path(const std::wstring& firstPath, const std::wstring& secondPath);
+
+// The files (not directories) in basePath that match filter, with their full path
+std::vector<std::wstring> find_files(const std::wstring& basePath, const std::wstring& filter);
+
+std::string to_utf8(const std::wstring& s);
+
+std::wstring from_utf8(const std::string& s);
+
+bool write_file(const std::wstring& path, const uint8_t* data, size_t size);
+
+// Lowercase, two digits per byte
+std::wstring to_hex(const uint8_t* data, size_t size);
+
+// False unless s is exactly two hex digits per byte of out
+bool from_hex(const std::wstring& s, uint8_t* out, size_t size);
+
+const uint64_t FnvOffsetBasis = 14695981039346656037ull;
+
+// FNV-1a, to tell whether a cache file was made for the same input, or an extracted tree is unchanged
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = FnvOffsetBasis);
+
+// The fields of the binary cache files, in the byte order of the machine that wrote them
+template <typename T>
+void append_value(std::vector<uint8_t>& out, const T& value)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(&value);
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+bool read_value(const uint8_t*& p, const uint8_t* end, T& value_out)
+{
+	if (static_cast<size_t>(end - p) < sizeof(T))
+		return false;
+	memcpy(&value_out, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+// A read-only view of a whole file, so that archives can be read in place
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const std::wstring& path);
+
+	const uint8_t* get_data() const { return data; }
+	size_t get_size() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};